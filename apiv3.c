@@ -72,6 +72,8 @@ static gimli_iter_status_t visit_tracer(gimli_hook_f func, void *farg, void *arg
   gimli_proc_t proc = arg;
   gimli_tracer_f tracer = (gimli_tracer_f)func;
 
+  /* tracers print with stdio; put what we've rendered ahead of them */
+  gimli_out_flush();
   tracer(proc, farg);
 
   return GIMLI_ITER_CONT;
@@ -87,6 +89,11 @@ int gimli_module_register_var_printer(gimli_var_printer_f func, void *arg)
   return gimli_hook_register("prettyprinter", (gimli_hook_f)func, arg);
 }
 
+static gimli_iter_status_t filter_printer_type(gimli_proc_t proc,
+    gimli_stack_frame_t frame,
+    const char *varname, gimli_type_t t, gimli_addr_t addr,
+    int depth, void *arg);
+
 struct prettyargs {
   gimli_proc_t proc;
   gimli_stack_frame_t frame;
@@ -101,6 +108,12 @@ static gimli_iter_status_t visit_pretty(gimli_hook_f func, void *farg, void *arg
   struct prettyargs *args = arg;
   gimli_var_printer_f pretty = (gimli_var_printer_f)func;
 
+  /* this is called for every value we print, so only flush when the
+   * printer may actually write something; the per-type filter flushes
+   * once it has found a printer for the type */
+  if (pretty != filter_printer_type) {
+    gimli_out_flush();
+  }
   return pretty(args->proc, args->frame, args->varname,
       args->t, args->addr, args->depth, farg);
 }
@@ -134,6 +147,7 @@ static gimli_iter_status_t filter_printer_type(gimli_proc_t proc,
 
   decl = gimli_type_declname(t);
   if (gimli_hash_find(printer_by_type, decl, (void**)&list)) {
+    gimli_out_flush();
     return list->func(proc, frame, varname, t, addr, depth, list->arg);
   }
 
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2012 Message Systems, Inc. All rights reserved
+ * For licensing information, see:
+ * https://bitbucket.org/wez/gimli/src/tip/LICENSE
+ */
+#include "impl.h"
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/* The monitor only gives the tracer so long before it kills it, and
+ * whatever hasn't been written by then is lost.  Rather than let the
+ * variables of the first few threads eat all of that time, the work is
+ * graded into tiers, each more costly and less vital than the last;
+ * see enum gimli_budget_tier.  A tier is only started if there is
+ * budget left for it, and the renderers note what they skipped.
+ *
+ * The time budget is shared fairly: each thread may spend on its
+ * variables no more than the time remaining divided by the number of
+ * threads left to render, optionally capped per thread.  Locals and
+ * pointers may only use the first three quarters of that share, which
+ * leaves something for the parameters of the frames that follow.
+ * Symbolizing a stack is cheap by comparison and is bounded only by the
+ * overall deadline, so under a tight budget we still get every stack.
+ *
+ * The monitor's clock starts when it forks us, so the overall deadline
+ * is measured from gimli_budget_begin(), which glider calls first
+ * thing; attaching and loading the maps count against it.  Memory is
+ * sampled once per thread and per frame rather than on every check */
+struct budget {
+  /* in milliseconds; 0 means unlimited */
+  int total_ms;
+  int thread_ms;
+  /* peak resident set size, in KB; 0 means unlimited */
+  long mem_kb;
+
+  uint64_t start;
+  uint64_t deadline;
+  uint64_t thread_deadline;
+  uint64_t locals_deadline;
+  int threads_left;
+  /* set once the last sample of our peak RSS exceeded mem_kb */
+  int over_memory;
+  const char *exhausted;
+};
+
+static struct budget budget;
+
+static uint64_t now_ms(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return ((uint64_t)tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+static long peak_rss_kb(void)
+{
+  struct rusage ru;
+
+  if (getrusage(RUSAGE_SELF, &ru)) {
+    return 0;
+  }
+#ifdef __MACH__
+  /* reported in bytes rather than KB */
+  return ru.ru_maxrss / 1024;
+#else
+  return ru.ru_maxrss;
+#endif
+}
+
+void gimli_budget_set(int total_ms, int thread_ms, int mem_mb)
+{
+  budget.total_ms = total_ms;
+  budget.thread_ms = thread_ms;
+  budget.mem_kb = (long)mem_mb * 1024;
+  if (!budget.start) {
+    budget.start = now_ms();
+  }
+  budget.deadline = total_ms ? budget.start + total_ms : 0;
+}
+
+int gimli_budget_enabled(void)
+{
+  return budget.total_ms || budget.thread_ms || budget.mem_kb;
+}
+
+void gimli_budget_begin(void)
+{
+  budget.start = now_ms();
+  budget.deadline = budget.total_ms ? budget.start + budget.total_ms : 0;
+  budget.exhausted = NULL;
+}
+
+/* Takes a fresh sample of our memory use; peak RSS never goes down, so
+ * once we're over we stay over */
+void gimli_budget_sample(void)
+{
+  if (budget.mem_kb && !budget.over_memory &&
+      peak_rss_kb() > budget.mem_kb) {
+    budget.over_memory = 1;
+  }
+}
+
+/* Sets the number of threads left to render, among which the remaining
+ * time is shared */
+void gimli_budget_threads(int nthreads)
+{
+  budget.threads_left = nthreads;
+}
+
+void gimli_budget_begin_thread(void)
+{
+  uint64_t now = now_ms();
+  uint64_t share = 0;
+
+  if (budget.deadline) {
+    share = budget.deadline > now ? budget.deadline - now : 0;
+    if (budget.threads_left > 1) {
+      share /= budget.threads_left;
+    }
+  }
+  if (budget.thread_ms && (!budget.deadline ||
+        (uint64_t)budget.thread_ms < share)) {
+    share = budget.thread_ms;
+  }
+  if (budget.deadline || budget.thread_ms) {
+    budget.thread_deadline = now + share;
+    budget.locals_deadline = now + (share * 3 / 4);
+  } else {
+    budget.thread_deadline = 0;
+    budget.locals_deadline = 0;
+  }
+  if (budget.threads_left > 0) {
+    budget.threads_left--;
+  }
+  gimli_budget_sample();
+}
+
+/* Returns true if there is budget left to begin work in the given
+ * tier.  Once a budget is found to be exhausted, the reason is kept for
+ * gimli_budget_reason() */
+int gimli_budget_allows(enum gimli_budget_tier tier)
+{
+  uint64_t now;
+
+  if (tier == GIMLI_TIER_PCS || !gimli_budget_enabled()) {
+    return 1;
+  }
+
+  if (budget.over_memory) {
+    budget.exhausted = "memory";
+    return 0;
+  }
+
+  now = now_ms();
+  if (budget.deadline && now >= budget.deadline) {
+    budget.exhausted = "time";
+    return 0;
+  }
+  if (tier >= GIMLI_TIER_PARAMS && budget.thread_deadline &&
+      now >= budget.thread_deadline) {
+    budget.exhausted = "time";
+    return 0;
+  }
+  if (tier >= GIMLI_TIER_LOCALS && budget.locals_deadline &&
+      now >= budget.locals_deadline) {
+    budget.exhausted = "time";
+    return 0;
+  }
+  return 1;
+}
+
+/* "time" or "memory": whichever budget last turned work away */
+const char *gimli_budget_reason(void)
+{
+  return budget.exhausted ? budget.exhausted : "time";
+}
+
+/* vim:ts=2:sw=2:et:
+ */
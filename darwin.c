@@ -775,14 +775,19 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
   }
 
   c = *cur;
-  if (gimli_dwarf_unwind_next(cur) && cur->st.pc) {
+  if (cur->strategy != GIMLI_UNWIND_FP) {
+    if (gimli_dwarf_unwind_next(cur) && cur->st.pc) {
 #if defined(__x86_64__)
-//    cur->st.regs.GIMLI_DARWIN_REGNAME(rsp) = (intptr_t)cur->st.fp;
+//      cur->st.regs.GIMLI_DARWIN_REGNAME(rsp) = (intptr_t)cur->st.fp;
 #endif
-    return 1;
-  }
-  if (debug) {
-    fprintf(stderr, "dwarf unwind unsuccessful fp=%p\n", cur->st.fp);
+      return 1;
+    }
+    if (debug) {
+      fprintf(stderr, "dwarf unwind unsuccessful fp=%p\n", cur->st.fp);
+    }
+    if (cur->strategy == GIMLI_UNWIND_DWARF) {
+      return 0;
+    }
   }
 
   if (c.st.fp) {
@@ -798,6 +803,11 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
       if (debug) fprintf(stderr, "next frame fp is same as current\n");
       return 0;
     }
+    if (cur->strategy == GIMLI_UNWIND_FP &&
+        !gimli_fp_frame_is_sane(cur->proc, c.st.fp, frame.fp, frame.pc)) {
+      if (debug) fprintf(stderr, "next frame is implausible\n");
+      return 0;
+    }
     cur->st.fp = frame.fp;
     cur->st.pc = frame.pc;
     if (cur->st.pc > 0 && !gimli_is_signal_frame(cur)) {
@@ -810,6 +820,7 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
 #else
 # error code me
 #endif
+    cur->method = GIMLI_UNWIND_METHOD_FP;
     return 1;
   } else if (debug) {
     fprintf(stderr, "no dwarf and fp is nil\n");
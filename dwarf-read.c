@@ -164,408 +164,6 @@ int dw_read_encptr(gimli_proc_t proc,
   return 1;
 }
 
-static int sort_by_addr(const void *A, const void *B)
-{
-  struct gimli_line_info *a = (struct gimli_line_info*)A;
-  struct gimli_line_info *b = (struct gimli_line_info*)B;
-
-  return a->addr - b->addr;
-}
-
-static int search_compare_line(const void *addrp, const void *L)
-{
-  struct gimli_line_info *line = (struct gimli_line_info*)L;
-  gimli_addr_t pc = *(gimli_addr_t*)addrp;
-
-  if (pc < line->addr) {
-    return -1;
-  }
-  if (pc < line->end) {
-    return 0;
-  }
-  return 1;
-}
-
-static int process_line_numbers(gimli_mapped_object_t f);
-
-/* read dwarf info to determine the source/line information for a given
- * address */
-int gimli_determine_source_line_number(gimli_proc_t proc,
-  gimli_addr_t pc, char *src, int srclen,
-  uint64_t *lineno)
-{
-  struct gimli_object_mapping *m;
-  gimli_mapped_object_t f;
-  struct gimli_line_info *linfo;
-
-  m = gimli_mapping_for_addr(proc, pc);
-  if (!m) {
-    return 0;
-  }
-  f = m->objfile;
-
-  if (!f->elf) {
-    /* can happen if the original file has been removed from disk */
-    return 0;
-  }
-  if (!f->lines) {
-    process_line_numbers(f);
-    if (!f->lines) {
-      return 0;
-    }
-  }
-
-#ifdef __MACH__
-  pc -= f->base_addr;
-#else
-  if (!gimli_object_is_executable(f->elf)) {
-    pc -= calc_reloc(f);
-  }
-#endif
-
-  linfo = bsearch(&pc, f->lines, f->linecount, sizeof(*linfo),
-      search_compare_line);
-
-  if (linfo) {
-    snprintf(src, srclen, "%s", linfo->filename);
-    *lineno = linfo->lineno;
-    return 1;
-  }
-  return 0;
-}
-
-
-static int process_line_numbers(gimli_mapped_object_t f)
-{
-  struct gimli_section_data *s = NULL;
-  struct {
-    char *address;
-    uint64_t file;
-    uint64_t line;
-    uint64_t column;
-    uint8_t is_stmt; /* recommended breakpoint location */
-    uint8_t basic_block; /* is start of a basic block */
-    uint8_t end_sequence;
-    uint8_t prologue_end;
-    uint8_t epilogue_begin;
-    uint64_t isa;
-  } regs;
-  const uint8_t *data, *end;
-  uint32_t initlen;
-  uint64_t len;
-  int is_64 = 0;
-  uint16_t ver;
-  struct {
-    uint8_t min_insn_len;
-    uint8_t def_is_stmt;
-    int8_t line_base;
-    uint8_t line_range;
-    uint8_t opcode_base;
-  } hdr_1;
-  uint64_t *opcode_lengths = NULL;
-  int i;
-  const char *filenames[1024];
-  uint8_t op;
-  struct gimli_line_info *linfo;
-  int debugline = debug && 0;
-
-  if (f->aux_elf) {
-    s = gimli_get_section_by_name(f->aux_elf, ".debug_line");
-    if (s) {
-      data = s->data;
-    }
-  }
-  if (!s) {
-    s = gimli_get_section_by_name(f->elf, ".debug_line");
-    if (s) {
-      data = s->data;
-    }
-  }
-  if (!s) {
-    return 0;
-  }
-  if (debugline) fprintf(stderr, "\nGot debug_line info\n");
-
-  end = data + s->size;
-
-  while (data < end) {
-    const uint8_t *cuend;
-    void *prior;
-
-    memset(&regs, 0, sizeof(regs));
-    regs.file = 1;
-    regs.line = 1;
-    prior = NULL;
-
-    /* read the initial length, this tells us which dwarf version and format
-     * we're dealing with */
-    memcpy(&initlen, data, sizeof(initlen));
-    data += sizeof(initlen);
-
-    if (initlen == 0xffffffff) {
-      /* this is a 64-bit dwarf */
-      is_64 = 1;
-      memcpy(&len, data, sizeof(len));
-      data += sizeof(len);
-    } else {
-      len = initlen;
-    }
-    cuend = data + len;
-
-    memcpy(&ver, data, sizeof(ver));
-    data += sizeof(ver);
-
-    if (debugline) {
-      fprintf(stderr, "initlen is 0x%" PRIx64 " (%d bit) ver=%u\n",
-        len, is_64 ? 64 : 32, ver);
-    }
-
-    if (is_64) {
-      memcpy(&len, data, sizeof(len));
-      data += sizeof(len);
-    } else {
-      memcpy(&initlen, data, sizeof(initlen));
-      data += sizeof(initlen);
-      len = initlen;
-    }
-    memcpy(&hdr_1, data, sizeof(hdr_1));
-    data += sizeof(hdr_1);
-    regs.is_stmt = hdr_1.def_is_stmt;
-
-    if (debugline) {
-      fprintf(stderr,
-        "headerlen is %" PRIu64 ", min_insn_len=%u line_base=%d line_range=%u\n"
-        "opcode_base=%u\n",
-        len, hdr_1.min_insn_len, hdr_1.line_base, hdr_1.line_range,
-        hdr_1.opcode_base);
-    }
-    if (opcode_lengths) free(opcode_lengths);
-    opcode_lengths = calloc(hdr_1.opcode_base, sizeof(uint64_t));
-    for (i = 1; i < hdr_1.opcode_base; i++) {
-      opcode_lengths[i-1] = dw_read_uleb128(&data, cuend);
-      if (debugline) {
-        fprintf(stderr, "op len [%d] = %" PRIu64 "\n", i, opcode_lengths[i-1]);
-      }
-    }
-    /* include_directories */
-    while (*data && data < cuend) {
-      if (debugline) fprintf(stderr, "inc_dir: %s\n", data);
-      data += strlen((char*)data) + 1;
-    }
-    data++;
-
-    /* files */
-    i = 1;
-    memset(filenames, 0, sizeof(filenames));
-    while (*data && data < cuend) {
-      if (i >= sizeof(filenames)/sizeof(filenames[0])) {
-        fprintf(stderr, "DWARF: too many files for line number info reader\n");
-        return 0;
-      }
-      if (debugline) fprintf(stderr, "file[%d] = %s\n", i, data);
-      filenames[i] = (char*)data;
-      data += strlen((char*)data) + 1;
-      /* ignore additional data about the file */
-      dw_read_uleb128(&data, cuend);
-      dw_read_uleb128(&data, cuend);
-      dw_read_uleb128(&data, cuend);
-      i++;
-    }
-    data++;
-
-    /* opcodes */
-    while (data < cuend) {
-      memcpy(&op, data, sizeof(op));
-      data += sizeof(op);
-
-      prior = regs.address;
-
-      if (op == 0) {
-        /* extended */
-        const uint8_t *next;
-        initlen = dw_read_uleb128(&data, cuend);
-        memcpy(&op, data, sizeof(op));
-        next = data + initlen;
-        data += sizeof(op);
-        switch (op) {
-          case DW_LNE_set_address:
-            {
-              void *addr;
-              memcpy(&addr, data, sizeof(addr));
-              if (debugline) fprintf(stderr, "set_address %p\n", addr);
-              regs.address = addr;
-              break;
-            }
-          case DW_LNE_end_sequence:
-            {
-              if (debugline) fprintf(stderr, "end_sequence\n");
-              memset(&regs, 0, sizeof(regs));
-              regs.file = 1;
-              regs.line = 1;
-              break;
-            }
-          case DW_LNE_define_file:
-            {
-              const char *fname = (char*)data;
-              uint64_t fno;
-
-              data += strlen(fname)+1;
-              fno = dw_read_uleb128(&data, cuend);
-              filenames[fno] = fname;
-              if (debugline) fprintf(stderr, "define_files[%" PRIu64 "] = %s\n", fno, fname);
-              break;
-            }
-
-          default:
-//            fprintf(stderr,
-//              "DWARF: line nos.: unhandled extended op=%02x, len=%" PRIu32 "\n",
-//              op, initlen);
-            ;
-        }
-        data = next;
-      } else if (op < hdr_1.opcode_base) {
-        /* standard opcode */
-        switch (op) {
-          case DW_LNS_copy:
-            if (debugline) fprintf(stderr, "copy\n");
-            regs.basic_block = 0;
-            regs.prologue_end = 0;
-            regs.epilogue_begin = 0;
-            break;
-          case DW_LNS_advance_line:
-            {
-              int64_t d = dw_read_leb128(&data, cuend);
-              if (debugline) {
-                fprintf(stderr, "advance_line from %" PRId64 " to %" PRId64 "\n",
-                  regs.line, regs.line + d);
-              }
-              regs.line += d;
-              break;
-            }
-
-          case DW_LNS_advance_pc:
-            {
-              uint64_t u = dw_read_uleb128(&data, cuend);
-              regs.address += u * hdr_1.min_insn_len;
-              if (debugline) {
-                fprintf(stderr, "advance_pc: addr=0x%" PRIx64 "\n", (uintptr_t)regs.address);
-              }
-              break;
-            }
-          case DW_LNS_set_file:
-          {
-            uint64_t u = dw_read_uleb128(&data, cuend);
-            regs.file = u;
-            if (debugline) fprintf(stderr, "set_file: %" PRIu64 "\n", regs.file);
-            break;
-          }
-          case DW_LNS_set_column:
-          {
-            uint64_t u = dw_read_uleb128(&data, cuend);
-            regs.column = u;
-            if (debugline) fprintf(stderr, "set_column: %" PRIu64 "\n", regs.column);
-            break;
-          }
-          case DW_LNS_negate_stmt:
-            if (debugline) fprintf(stderr, "negate_stmt\n");
-            regs.is_stmt = !regs.is_stmt;
-            break;
-          case DW_LNS_set_basic_block:
-            if (debugline) fprintf(stderr, "set_basic_block\n");
-            regs.basic_block = 1;
-            break;
-          case DW_LNS_const_add_pc:
-            regs.address += ((255 - hdr_1.opcode_base) /
-                            hdr_1.line_range) * hdr_1.min_insn_len;
-            if (debugline) {
-              fprintf(stderr, "const_add_pc: addr=0x%" PRIx64 "\n", (uintptr_t)regs.address);
-            }
-            break;
-          case DW_LNS_fixed_advance_pc:
-          {
-            uint16_t u;
-            memcpy(&u, data, sizeof(u));
-            data += sizeof(u);
-            regs.address += u;
-            if (debugline) {
-              fprintf(stderr, "fixed_advance_pc: 0x%" PRIx64 "\n", (uintptr_t)regs.address);
-            }
-            break;
-          }
-          case DW_LNS_set_prologue_end:
-            if (debugline) {
-              fprintf(stderr, "set_prologue_end\n");
-            }
-            regs.prologue_end = 1;
-            break;
-          case DW_LNS_set_epilogue_begin:
-            if (debugline) {
-              fprintf(stderr, "set_epilogue_begin\n");
-            }
-            regs.epilogue_begin = 1;
-            break;
-          case DW_LNS_set_isa:
-            regs.isa = dw_read_uleb128(&data, cuend);
-            if (debugline) {
-              fprintf(stderr, "set_isa: 0x%" PRIx64 "\n", regs.isa);
-            }
-            break;
-          default:
-            fprintf(stderr, "DWARF: line nos: unhandled op: %02x\n", op);
-            /* consume unknown/unhandled args */
-            for (i = 0; i < opcode_lengths[i]; i++) {
-              dw_read_uleb128(&data, cuend);
-            }
-        }
-      } else {
-        /* special opcode */
-        op -= hdr_1.opcode_base;
-
-        if (debugline) {
-          fprintf(stderr, "special before: addr = %p, line = %" PRId64 "\n",
-              regs.address, regs.line);
-          fprintf(stderr, "line_base = %d, line_range = %d\n",
-            hdr_1.line_base, hdr_1.line_range);
-        }
-
-        regs.address += (op / hdr_1.line_range) * hdr_1.min_insn_len;
-        regs.line += hdr_1.line_base + (op % hdr_1.line_range);
-        if (debugline) {
-          fprintf(stderr, "special: addr = %p, line = %" PRId64 "\n",
-            regs.address, regs.line);
-        }
-      }
-
-
-      if (regs.address && filenames[regs.file]) {
-        if (f->linecount + 1 >= f->linealloc) {
-          f->linealloc = f->linealloc ? f->linealloc * 2 : 1024;
-          f->lines = realloc(f->lines, f->linealloc * sizeof(*linfo));
-        }
-        linfo = &f->lines[f->linecount++];
-        linfo->filename = filenames[regs.file];
-        linfo->lineno = regs.line;
-        linfo->addr = (gimli_addr_t)regs.address;
-      }
-    }
-  }
-
-  qsort(f->lines, f->linecount, sizeof(struct gimli_line_info), sort_by_addr);
-//printf("sorting %d lines in %s\n", f->linecount, f->objname);
-
-  free(opcode_lengths);
-
-  /* make a pass to fill in the end member to make it easier to find
-   * an approx match */
-  if (f->linecount) {
-    for (i = 0; i < f->linecount - 1; i++) {
-      f->lines[i].end = f->lines[i+1].addr;
-    }
-  }
-
-  return 0;
-}
-
 static int get_sect_data(gimli_mapped_object_t f, const char *name,
   const uint8_t **startptr, const uint8_t **endptr, gimli_object_file_t *elf)
 {
@@ -658,6 +256,24 @@ int dw_calc_location(struct gimli_unwind_cursor *cur,
 }
 
 
+static int init_abbr(gimli_mapped_object_t file)
+{
+  if (file->abbr.map) {
+    return 1;
+  }
+  if (!get_sect_data(file, ".debug_abbrev",
+        &file->abbr.start, &file->abbr.end, &file->abbr.elf)) {
+    printf("could not get abbrev data for %s\n", file->objname);
+    return 0;
+  }
+
+  /* observed approx 11-13 per abbrev, err on the side of avoiding
+   * rebuckets */
+  file->abbr.map = gimli_hash_new_size(NULL, GIMLI_HASH_U64_KEYS,
+      (file->abbr.end - file->abbr.start) / 10);
+  return 1;
+}
+
 static const uint8_t *find_abbr(gimli_mapped_object_t file,
     uint64_t da_offset,
     uint64_t fcode)
@@ -668,17 +284,8 @@ static const uint8_t *find_abbr(gimli_mapped_object_t file,
   const uint8_t *abbr;
   int slow_mode = 0;
 
-  if (!file->abbr.map) {
-    if (!get_sect_data(file, ".debug_abbrev",
-          &file->abbr.start, &file->abbr.end, &file->abbr.elf)) {
-      printf("could not get abbrev data for %s\n", file->objname);
-      return 0;
-    }
-
-    /* observed approx 11-13 per abbrev, err on the side of avoiding
-     * rebuckets */
-    file->abbr.map = gimli_hash_new_size(NULL, GIMLI_HASH_U64_KEYS,
-        (file->abbr.end - file->abbr.start) / 10);
+  if (!init_abbr(file)) {
+    return 0;
   }
 
   /* NOTE: even though DWARF allows for 64-bit offsets, we're making the assumption
@@ -697,6 +304,12 @@ static const uint8_t *find_abbr(gimli_mapped_object_t file,
     if (gimli_hash_find_u64(file->abbr.map, key, (void**)&abbr)) {
       return abbr;
     }
+    /* the scan workers share the map; dw_scan_prime should have
+     * recorded everything they need, but if it missed something we
+     * find it the slow way rather than race on an insert */
+    if (file->abbr.frozen) {
+      slow_mode = 1;
+    }
   }
 
   abbr = file->abbr.start + da_offset;
@@ -836,6 +449,30 @@ static uint64_t get_value(uint64_t form, uint64_t addr_size, int is_64,
       *byteptr = data;
       data += *vptr;
       break;
+    case DW_FORM_sec_offset:
+      if (is_64) {
+        memcpy(vptr, data, sizeof(*vptr));
+        data += sizeof(*vptr);
+      } else {
+        memcpy(&u32, data, sizeof(u32));
+        data += sizeof(u32);
+        *vptr = u32;
+      }
+      break;
+    case DW_FORM_exprloc:
+      *vptr = dw_read_uleb128(&data, end);
+      *byteptr = data;
+      data += *vptr;
+      break;
+    case DW_FORM_flag_present:
+      /* implicitly true; occupies no space in the DIE */
+      *vptr = 1;
+      break;
+    case DW_FORM_ref_sig8:
+      /* type signature into .debug_types; we can't follow these */
+      memcpy(vptr, data, sizeof(*vptr));
+      data += sizeof(*vptr);
+      break;
     case DW_FORM_strp:
       if (is_64) {
         memcpy(vptr, data, sizeof(*vptr));
@@ -887,14 +524,19 @@ static uint64_t get_value(uint64_t form, uint64_t addr_size, int is_64,
     case DW_FORM_block1:
     case DW_FORM_block2:
     case DW_FORM_block4:
+    case DW_FORM_exprloc:
       form = DW_FORM_block;
       break;
     case DW_FORM_data1:
     case DW_FORM_data2:
     case DW_FORM_data4:
     case DW_FORM_data8:
+    case DW_FORM_sec_offset:
       form = DW_FORM_data8;
       break;
+    case DW_FORM_flag_present:
+      form = DW_FORM_flag;
+      break;
     case DW_FORM_ref1:
     case DW_FORM_ref2:
     case DW_FORM_ref4:
@@ -912,15 +554,25 @@ static uint64_t get_value(uint64_t form, uint64_t addr_size, int is_64,
   return form;
 }
 
+/* State for decoding the DIEs of a single CU.
+ * The slabs are those of the object file when decoding on demand,
+ * or private to a scan worker when decoding in parallel */
+struct dw_cu_reader {
+  gimli_mapped_object_t file;
+  struct gimli_dwarf_cu *cu;
+  const uint8_t *custart;
+  uint64_t da_offset;
+  int is_64;
+  uint8_t addr_size;
+  struct gimli_slab *dieslab, *attrslab;
+};
+
 static struct gimli_dwarf_die *process_die(
-  gimli_mapped_object_t file,
-  struct gimli_dwarf_cu *cu,
-  const uint8_t *custart,
-  const uint8_t **datap, const uint8_t *end,
-  uint64_t da_offset,
-  int is_64, uint8_t addr_size
+  struct dw_cu_reader *r,
+  const uint8_t **datap, const uint8_t *end
 )
 {
+  gimli_mapped_object_t file = r->file;
   const uint8_t *data = *datap;
   uint64_t abbr_code;
   uint64_t tag;
@@ -940,7 +592,7 @@ static struct gimli_dwarf_die *process_die(
     *datap = data;
     return NULL;
   }
-  abbr = find_abbr(file, da_offset, abbr_code);
+  abbr = find_abbr(file, r->da_offset, abbr_code);
   if (!abbr) {
     printf("Couldn't locate abbrev code %" PRId64 "\n", abbr_code);
     *datap = data;
@@ -956,7 +608,7 @@ static struct gimli_dwarf_die *process_die(
     abort();
   }
 
-  die = gimli_slab_alloc(&file->dieslab);
+  die = gimli_slab_alloc(r->dieslab);
   memset(die, 0, sizeof(*die));
   die->offset = offset;
   die->tag = tag;
@@ -970,11 +622,11 @@ static struct gimli_dwarf_die *process_die(
       break;
     }
 
-    attr = gimli_slab_alloc(&file->attrslab);
+    attr = gimli_slab_alloc(r->attrslab);
     memset(attr, 0, sizeof(*attr));
     attr->attr = atype;
 
-    attr->form = get_value(aform, addr_size, is_64, &data, end,
+    attr->form = get_value(aform, r->addr_size, r->is_64, &data, end,
         &attr->code, &attr->ptr, file->debug_info.elf);
 
     if (attr->form == 0) {
@@ -987,9 +639,9 @@ static struct gimli_dwarf_die *process_die(
     } else if (attr->form == DW_FORM_ref_udata) {
       /* offset from start of its respective CU */
 //      printf("ref CU, code is %" PRIx64, attr->code);
-      attr->code += (int64_t)(custart - file->debug_info.start);
+      attr->code += (int64_t)(r->custart - file->debug_info.start);
 //      printf(" fixed up to %" PRIx64 "\n", attr->code);
-      attr->ptr = (const uint8_t*)cu;
+      attr->ptr = (const uint8_t*)r->cu;
       attr->form = DW_FORM_data8;
     }
 
@@ -1002,8 +654,7 @@ static struct gimli_dwarf_die *process_die(
     /* go recursive and pull those in now.
      * The first child may be NULL and not indicate a terminator */
     while (1) {
-      kid = process_die(file, cu, custart, &data, end, da_offset,
-            is_64, addr_size);
+      kid = process_die(r, &data, end);
       if (kid == NULL) {
         if (STAILQ_FIRST(&die->kids)) {
           break;
@@ -1106,87 +757,122 @@ static void insert_cu(struct gimli_dwarf_cu **rootp, struct gimli_dwarf_cu *cu)
   }
 }
 
-static struct gimli_dwarf_cu *load_cu(gimli_mapped_object_t f, uint64_t offset)
+struct dw_cu_header {
+  uint64_t offset, end;
+  uint64_t da_offset;
+  const uint8_t *custart, *cuend;
+  /* start of the DIE data, following the header */
+  const uint8_t *dies;
+  uint16_t ver;
+  int is_64;
+  uint8_t addr_size;
+};
+
+/* Parse the CU header at offset; fills in hdr and returns 1 on success */
+static int read_cu_header(gimli_mapped_object_t f, uint64_t offset,
+  struct dw_cu_header *hdr)
 {
-  const uint8_t *data, *next;
-  const uint8_t *cuend, *custart;
-  gimli_object_file_t elf = NULL;
+  const uint8_t *data;
   uint64_t initlen;
   uint32_t len32;
-  uint16_t ver;
-  uint64_t da_offset;
-  int is_64 = 0;
-  uint8_t addr_size, seg_size;
-  struct gimli_dwarf_cu *cu, *cuptr;
-  struct gimli_dwarf_die *die = NULL;
 
-  if (!init_debug_info(f)) {
-    return 0;
-  }
   data = f->debug_info.start + offset;
 
-#if 0
-  printf("Loading CU @ offset %" PRIx64 " from data of size %" PRIu64 "\n",
-      offset,
-      f->debug_info.end - f->debug_info.start);
-#endif
-
   if (data >= f->debug_info.end) {
     printf("CU offset %" PRIx64 " it out of bounds\n", offset);
     return 0;
   }
 
-  custart = data;
+  hdr->custart = data;
   memcpy(&len32, data, sizeof(len32));
   data += sizeof(len32);
   if (len32 == 0xffffffff) {
-    is_64 = 1;
+    hdr->is_64 = 1;
     memcpy(&initlen, data, sizeof(initlen));
     data += sizeof(initlen);
   } else {
-    is_64 = 0;
+    hdr->is_64 = 0;
     initlen = len32;
   }
-  cuend = data + initlen;
+  hdr->cuend = data + initlen;
+  if (hdr->cuend > f->debug_info.end) {
+    printf("%s: CU @ offset 0x%" PRIx64 " overruns .debug_info\n",
+        f->objname, offset);
+    return 0;
+  }
 
-  memcpy(&ver, data, sizeof(ver));
-  data += sizeof(ver);
-  if (ver < 2 || ver > 3) {
-    printf("%s: CU @ offset 0x%" PRIx64 " with dwarf version %d; ending processing\n",
-        f->objname, offset, ver);
-    abort();
-    return 0;
-  }
+  memcpy(&hdr->ver, data, sizeof(hdr->ver));
+  data += sizeof(hdr->ver);
 
-  if (is_64) {
-    memcpy(&da_offset, data, sizeof(da_offset));
-    data += sizeof(da_offset);
+  if (hdr->is_64) {
+    memcpy(&hdr->da_offset, data, sizeof(hdr->da_offset));
+    data += sizeof(hdr->da_offset);
   } else {
     memcpy(&len32, data, sizeof(len32));
     data += sizeof(len32);
-    da_offset = len32;
+    hdr->da_offset = len32;
+  }
+
+  memcpy(&hdr->addr_size, data, sizeof(hdr->addr_size));
+  data += sizeof(hdr->addr_size);
+
+  hdr->dies = data;
+  hdr->offset = offset;
+  hdr->end = hdr->cuend - f->debug_info.start;
+
+  return 1;
+}
+
+/* Decode the CU at offset, allocating its DIEs from the provided slabs.
+ * The CU is not added to the CU tree; that is the responsibility
+ * of the caller */
+static struct gimli_dwarf_cu *decode_cu(gimli_mapped_object_t f,
+  uint64_t offset, struct gimli_slab *dieslab, struct gimli_slab *attrslab)
+{
+  const uint8_t *data;
+  struct dw_cu_header hdr;
+  struct dw_cu_reader r;
+  struct gimli_dwarf_cu *cu;
+  struct gimli_dwarf_die *die = NULL;
+
+#if 0
+  printf("Loading CU @ offset %" PRIx64 " from data of size %" PRIu64 "\n",
+      offset,
+      f->debug_info.end - f->debug_info.start);
+#endif
+
+  if (!read_cu_header(f, offset, &hdr)) {
+    return 0;
   }
 
-  memcpy(&addr_size, data, sizeof(addr_size));
-  data += sizeof(addr_size);
+  if (hdr.ver < 2 || hdr.ver > 4) {
+    printf("%s: CU @ offset 0x%" PRIx64 " with dwarf version %d; ending processing\n",
+        f->objname, offset, hdr.ver);
+    abort();
+    return 0;
+  }
 
   cu = calloc(1, sizeof(*cu));
   cu->offset = offset;
-  cu->end = cuend - f->debug_info.start;
-  cu->da_offset = da_offset;
+  cu->end = hdr.end;
+  cu->da_offset = hdr.da_offset;
+  cu->addr_size = hdr.addr_size;
   STAILQ_INIT(&cu->dies);
 
-  /* insert into the cu tree */
-  insert_cu(&f->debug_info.cus, cu);
-#if 0
-  printf("Recording CU %" PRIx64 " - %" PRIx64 " @ %p\n",
-      cu->offset, cu->end, cu);
-#endif
+  memset(&r, 0, sizeof(r));
+  r.file = f;
+  r.cu = cu;
+  r.custart = hdr.custart;
+  r.da_offset = hdr.da_offset;
+  r.is_64 = hdr.is_64;
+  r.addr_size = hdr.addr_size;
+  r.dieslab = dieslab;
+  r.attrslab = attrslab;
 
   /* now we have a series of Debugging Information Entries (DIE) */
-  while (data < cuend) {
-    die = process_die(f, cu, custart, &data, cuend,
-        da_offset, is_64, addr_size);
+  data = hdr.dies;
+  while (data < hdr.cuend) {
+    die = process_die(&r, &data, hdr.cuend);
     if (!die) {
       continue;
     }
@@ -1203,6 +889,29 @@ static struct gimli_dwarf_cu *load_cu(gimli_mapped_object_t f, uint64_t offset)
   return cu;
 }
 
+static struct gimli_dwarf_cu *load_cu(gimli_mapped_object_t f, uint64_t offset)
+{
+  struct gimli_dwarf_cu *cu;
+
+  if (!init_debug_info(f)) {
+    return 0;
+  }
+
+  cu = decode_cu(f, offset, &f->dieslab, &f->attrslab);
+  if (!cu) {
+    return 0;
+  }
+
+  /* insert into the cu tree */
+  insert_cu(&f->debug_info.cus, cu);
+#if 0
+  printf("Recording CU %" PRIx64 " - %" PRIx64 " @ %p\n",
+      cu->offset, cu->end, cu);
+#endif
+
+  return cu;
+}
+
 /* searches the CU binary search tree for the requested offset */
 static struct gimli_dwarf_cu *find_cu(
   gimli_mapped_object_t f,
@@ -1300,12 +1009,280 @@ static int gimli_dwarf_die_get_uint64_t_attr(
   return 0;
 }
 
+/* Parallel CU scanning.
+ * Each CU header gives the exact byte range of the CU, so CUs can
+ * be decoded independently of one another.  A scan enumerates the
+ * CUs of an object from their headers, then hands them out to a
+ * pool of worker threads that decode them into private slabs and
+ * optionally run a visitor against each one.
+ * When the workers are done, their slabs are merged into the slabs
+ * of the object and the CUs are inserted into the CU tree in offset
+ * order, so that the end result is the same as loading them serially.
+ * Anything that has to be registered with the object (types, for
+ * instance) is expected to be done by the caller once the scan has
+ * completed, walking the items in offset order */
+
+#define GIMLI_DWARF_MAX_SCAN_THREADS 32
+
+struct dw_scan_item {
+  uint64_t offset;
+  uint64_t da_offset;
+  struct gimli_dwarf_cu *cu;
+  /* set if the CU was decoded by this scan */
+  int decoded;
+  /* returned from the visitor */
+  void *result;
+};
+
+/* Called from worker threads; must not modify the object other
+ * than via the slabs it was handed */
+typedef void *(*dw_scan_visit_func_t)(gimli_mapped_object_t file,
+    struct gimli_dwarf_cu *cu, void *arg);
+
+struct dw_scan {
+  gimli_mapped_object_t file;
+  struct dw_scan_item *items;
+  int nitems;
+  pthread_mutex_t lock;
+  /* next item to hand out */
+  int next;
+  dw_scan_visit_func_t visit;
+  void *arg;
+};
+
+struct dw_scan_worker {
+  struct dw_scan *scan;
+  pthread_t thr;
+  struct gimli_slab dieslab, attrslab;
+};
+
+static int dw_scan_threads(void)
+{
+  const char *env = getenv("GIMLI_DWARF_THREADS");
+  long n = 0;
+
+  if (env) {
+    n = strtol(env, NULL, 10);
+  }
+#ifdef _SC_NPROCESSORS_ONLN
+  if (n <= 0) {
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+#endif
+  if (n < 1) {
+    n = 1;
+  }
+  if (n > GIMLI_DWARF_MAX_SCAN_THREADS) {
+    n = GIMLI_DWARF_MAX_SCAN_THREADS;
+  }
+  return n;
+}
+
+static void *dw_scan_worker_main(void *arg)
+{
+  struct dw_scan_worker *w = arg;
+  struct dw_scan *scan = w->scan;
+  struct dw_scan_item *item;
+  int idx;
+
+  while (1) {
+    pthread_mutex_lock(&scan->lock);
+    idx = scan->next++;
+    pthread_mutex_unlock(&scan->lock);
+
+    if (idx >= scan->nitems) {
+      break;
+    }
+    item = &scan->items[idx];
+
+    if (!item->cu) {
+      item->cu = decode_cu(scan->file, item->offset,
+          &w->dieslab, &w->attrslab);
+      item->decoded = 1;
+    }
+    if (!item->cu || !scan->visit) {
+      continue;
+    }
+
+    item->result = scan->visit(scan->file, item->cu, scan->arg);
+  }
+
+  return NULL;
+}
+
+/* Everything that the workers look up by name or key has to be
+ * populated up front, so that the workers only ever read from
+ * the shared hashes */
+static int dw_scan_prime(struct dw_scan *scan)
+{
+  gimli_mapped_object_t file = scan->file;
+  gimli_object_file_t elf;
+  const uint8_t *start, *end, *abbr;
+  gimli_hash_t seen;
+  uint64_t code;
+  int i;
+
+  elf = file->debug_info.elf;
+  get_sect_data(NULL, ".debug_str", &start, &end, &elf);
+  elf = NULL;
+  get_sect_data(file, ".debug_loc", &start, &end, &elf);
+
+  if (!init_abbr(file)) {
+    return 0;
+  }
+
+  /* walk each abbreviation table referenced by the CUs and record
+   * every code that it contains */
+  seen = gimli_hash_new_size(NULL, GIMLI_HASH_U64_KEYS, 0);
+  for (i = 0; i < scan->nitems; i++) {
+    if (scan->items[i].cu ||
+        !gimli_hash_insert_u64(seen, scan->items[i].da_offset, NULL)) {
+      continue;
+    }
+    abbr = file->abbr.start + scan->items[i].da_offset;
+    while (abbr < file->abbr.end) {
+      code = dw_read_uleb128(&abbr, file->abbr.end);
+      if (code == 0) {
+        /* end of this table */
+        break;
+      }
+      if (scan->items[i].da_offset <= UINT32_MAX && code <= UINT32_MAX) {
+        gimli_hash_insert_u64(file->abbr.map,
+            (scan->items[i].da_offset << 32) | code, (void*)abbr);
+      }
+
+      /* skip tag, has_children and the attribute specs */
+      dw_read_uleb128(&abbr, file->abbr.end);
+      abbr += sizeof(uint8_t);
+      while (abbr < file->abbr.end) {
+        dw_read_uleb128(&abbr, file->abbr.end);
+        if (dw_read_uleb128(&abbr, file->abbr.end) == 0) {
+          break;
+        }
+      }
+    }
+  }
+  gimli_hash_destroy(seen);
+
+  return 1;
+}
+
+/* Scan all of the CUs in file.  If visit is non-NULL, it is called
+ * for each CU (possibly concurrently) and its return value is recorded
+ * in the result field of the corresponding item.
+ * Returns the array of scanned items in offset order; the caller
+ * must free it (and any results) */
+static struct dw_scan_item *dw_scan_cus(gimli_mapped_object_t file,
+  dw_scan_visit_func_t visit, void *arg, int *nitemsp)
+{
+  struct dw_scan scan;
+  struct dw_scan_worker *workers = NULL;
+  struct dw_scan_item *item;
+  struct dw_cu_header hdr;
+  int alloc = 0, pending = 0, nthreads, i;
+  uint64_t off;
+
+  *nitemsp = 0;
+  if (!init_debug_info(file)) {
+    return NULL;
+  }
+
+  memset(&scan, 0, sizeof(scan));
+  scan.file = file;
+  scan.visit = visit;
+  scan.arg = arg;
+
+  /* enumerate the CUs from their headers */
+  off = 0;
+  while (file->debug_info.start + off < file->debug_info.end) {
+    if (scan.nitems + 1 >= alloc) {
+      alloc = alloc ? alloc * 2 : 1024;
+      scan.items = realloc(scan.items, alloc * sizeof(*scan.items));
+    }
+    item = &scan.items[scan.nitems];
+    memset(item, 0, sizeof(*item));
+    item->offset = off;
+
+    item->cu = find_cu(file, off);
+    if (item->cu) {
+      item->da_offset = item->cu->da_offset;
+      off = item->cu->end;
+    } else {
+      if (!read_cu_header(file, off, &hdr)) {
+        break;
+      }
+      item->da_offset = hdr.da_offset;
+      off = hdr.end;
+      pending++;
+    }
+    scan.nitems++;
+  }
+  pthread_mutex_init(&scan.lock, NULL);
+
+  nthreads = dw_scan_threads();
+  if (nthreads > pending) {
+    nthreads = pending;
+  }
+
+  if (nthreads <= 1) {
+    /* not worth the overhead of threads; decode straight into
+     * the slabs of the object */
+    struct dw_scan_worker self;
+
+    memset(&self, 0, sizeof(self));
+    self.scan = &scan;
+    gimli_slab_init(&self.dieslab, sizeof(struct gimli_dwarf_die), "die");
+    gimli_slab_init(&self.attrslab, sizeof(struct gimli_dwarf_attr), "attr");
+    dw_scan_worker_main(&self);
+    gimli_slab_merge(&file->dieslab, &self.dieslab);
+    gimli_slab_merge(&file->attrslab, &self.attrslab);
+  } else if (dw_scan_prime(&scan)) {
+    workers = calloc(nthreads, sizeof(*workers));
+    file->abbr.frozen = 1;
+
+    for (i = 0; i < nthreads; i++) {
+      workers[i].scan = &scan;
+      gimli_slab_init(&workers[i].dieslab,
+          sizeof(struct gimli_dwarf_die), "die");
+      gimli_slab_init(&workers[i].attrslab,
+          sizeof(struct gimli_dwarf_attr), "attr");
+      if (pthread_create(&workers[i].thr, NULL,
+            dw_scan_worker_main, &workers[i])) {
+        /* run it inline instead; the others will pick up the slack */
+        dw_scan_worker_main(&workers[i]);
+        workers[i].scan = NULL;
+      }
+    }
+    for (i = 0; i < nthreads; i++) {
+      if (workers[i].scan) {
+        pthread_join(workers[i].thr, NULL);
+      }
+      gimli_slab_merge(&file->dieslab, &workers[i].dieslab);
+      gimli_slab_merge(&file->attrslab, &workers[i].attrslab);
+    }
+    file->abbr.frozen = 0;
+    free(workers);
+  }
+  pthread_mutex_destroy(&scan.lock);
+
+  /* record the newly decoded CUs */
+  for (i = 0; i < scan.nitems; i++) {
+    item = &scan.items[i];
+    if (item->decoded && item->cu) {
+      insert_cu(&file->debug_info.cus, item->cu);
+    }
+  }
+
+  *nitemsp = scan.nitems;
+  return scan.items;
+}
+
 static int sort_compare_arange(const void *A, const void *B)
 {
   struct dw_die_arange *a = (struct dw_die_arange*)A;
   struct dw_die_arange *b = (struct dw_die_arange*)B;
 
-  return a->addr - b->addr;
+  return a->addr < b->addr ? -1 : a->addr > b->addr ? 1 : 0;
 }
 
 /* Load the DIE location data from an object file */
@@ -1396,171 +1373,1625 @@ static int load_arange(struct gimli_object_mapping *m)
         addr = len32;
       }
 
-      if (data >= next) break;
+      if (data >= next) break;
+
+      if (addr_size == 8) {
+        memcpy(&l, data, sizeof(l));
+        data += sizeof(l);
+      } else {
+        memcpy(&len32, data, sizeof(len32));
+        data += sizeof(len32);
+        l = len32;
+      }
+
+      if (addr == 0 && l == 0) {
+        break;
+      }
+
+      addr += reloc;
+
+      if (m->objfile->num_arange + 1 >= m->objfile->alloc_arange) {
+        m->objfile->alloc_arange = m->objfile->alloc_arange ? m->objfile->alloc_arange * 2 : 1024;
+        m->objfile->arange = realloc(m->objfile->arange, m->objfile->alloc_arange * sizeof(*arange));
+      }
+      arange = &m->objfile->arange[m->objfile->num_arange++];
+      arange->addr = addr;
+      arange->len = l;
+      arange->di_offset = di_offset;
+
+//      printf("arange: addr=" PTRFMT " 0x%" PRIx64 "\n", addr, l);
+    }
+    data = next;
+  }
+
+  /* ensure ascending order */
+  qsort(m->objfile->arange, m->objfile->num_arange, sizeof(struct dw_die_arange),
+      sort_compare_arange);
+//printf("sorting %d arange in %s\n", m->objfile->num_arange, m->objfile->objname);
+
+  return 1;
+}
+
+static int search_compare_arange(const void *K, const void *R)
+{
+  struct dw_die_arange *arange = (struct dw_die_arange*)R;
+  gimli_addr_t pc = *(gimli_addr_t*)K;
+
+  if (pc < arange->addr) {
+    return -1;
+  }
+
+  if (pc < arange->addr + arange->len) {
+    return 0;
+  }
+
+  return 1;
+}
+
+/* The variable index maps the addresses of static and global
+ * variables to their DIEs.  It is built for the whole object the
+ * first time a data address in it is resolved; only variables whose
+ * location is a plain DW_OP_addr are included, which covers everything
+ * except thread-local storage */
+struct dw_var_addr {
+  gimli_addr_t addr;
+  uint64_t size;
+  struct gimli_dwarf_die *die;
+};
+
+struct dw_var_addr_list {
+  struct dw_var_addr *vars;
+  int nvars, alloc;
+};
+
+static struct gimli_dwarf_attr *die_get_attr_follow(
+    gimli_mapped_object_t file, struct gimli_dwarf_die *die, uint64_t attrcode)
+{
+  struct gimli_dwarf_attr *attr;
+  int depth;
+
+  for (depth = 0; die && depth < 8; depth++) {
+    attr = gimli_dwarf_die_get_attr(die, attrcode);
+    if (attr) {
+      return attr;
+    }
+    attr = gimli_dwarf_die_get_attr(die, DW_AT_abstract_origin);
+    if (!attr) {
+      attr = gimli_dwarf_die_get_attr(die, DW_AT_specification);
+    }
+    if (!attr) {
+      break;
+    }
+    die = gimli_dwarf_get_die(file, attr->code);
+  }
+  return NULL;
+}
+
+/* Compute the size of the type referenced by attr, by walking the DIEs
+ * rather than loading the type */
+static uint64_t die_type_size(gimli_mapped_object_t file,
+    struct gimli_dwarf_attr *type)
+{
+  struct gimli_dwarf_die *die, *kid;
+  uint64_t size, n, lo, hi, count;
+  int depth;
+
+  for (depth = 0; type && depth < 16; depth++) {
+    die = gimli_dwarf_get_die(file, type->code);
+    if (!die) {
+      return 0;
+    }
+    if (gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_byte_size, &size)) {
+      return size;
+    }
+    switch (die->tag) {
+      case DW_TAG_pointer_type:
+      case DW_TAG_reference_type:
+        return sizeof(void*);
+
+      case DW_TAG_array_type:
+        size = die_type_size(file, gimli_dwarf_die_get_attr(die, DW_AT_type));
+        n = 1;
+        STAILQ_FOREACH(kid, &die->kids, siblings) {
+          if (kid->tag != DW_TAG_subrange_type) {
+            continue;
+          }
+          if (gimli_dwarf_die_get_uint64_t_attr(kid, DW_AT_count, &count)) {
+            n *= count;
+          } else if (gimli_dwarf_die_get_uint64_t_attr(kid,
+                DW_AT_upper_bound, &hi)) {
+            lo = 0;
+            gimli_dwarf_die_get_uint64_t_attr(kid, DW_AT_lower_bound, &lo);
+            n *= hi - lo + 1;
+          } else {
+            /* flexible */
+            n = 0;
+          }
+        }
+        return size * n;
+
+      default:
+        /* typedef and qualifiers */
+        type = gimli_dwarf_die_get_attr(die, DW_AT_type);
+    }
+  }
+  return 0;
+}
+
+static void collect_var_addrs(gimli_mapped_object_t file,
+    struct gimli_dwarf_cu *cu, struct gimli_dwarf_die *die,
+    struct dw_var_addr_list *list)
+{
+  struct gimli_dwarf_die *kid;
+  struct gimli_dwarf_attr *location;
+  struct dw_var_addr *v;
+  uint64_t u64;
+  uint32_t u32;
+
+  STAILQ_FOREACH(kid, &die->kids, siblings) {
+    if (STAILQ_FIRST(&kid->kids)) {
+      /* static locals live inside subprograms and blocks */
+      collect_var_addrs(file, cu, kid, list);
+    }
+    if (kid->tag != DW_TAG_variable) {
+      continue;
+    }
+    location = gimli_dwarf_die_get_attr(kid, DW_AT_location);
+    if (!location || location->form != DW_FORM_block ||
+        location->code != 1 + cu->addr_size ||
+        location->ptr[0] != DW_OP_addr) {
+      continue;
+    }
+
+    if (list->nvars + 1 >= list->alloc) {
+      list->alloc = list->alloc ? list->alloc * 2 : 64;
+      list->vars = realloc(list->vars, list->alloc * sizeof(*v));
+    }
+    v = &list->vars[list->nvars++];
+    if (cu->addr_size == 8) {
+      memcpy(&u64, location->ptr + 1, sizeof(u64));
+      v->addr = u64;
+    } else {
+      memcpy(&u32, location->ptr + 1, sizeof(u32));
+      v->addr = u32;
+    }
+    v->addr += file->debug_info.reloc;
+    v->size = 0;
+    v->die = kid;
+  }
+}
+
+static void *visit_var_addrs(gimli_mapped_object_t file,
+    struct gimli_dwarf_cu *cu, void *arg)
+{
+  struct dw_var_addr_list *list = calloc(1, sizeof(*list));
+  struct gimli_dwarf_die *die;
+
+  STAILQ_FOREACH(die, &cu->dies, siblings) {
+    collect_var_addrs(file, cu, die, list);
+  }
+  if (!list->nvars) {
+    free(list);
+    return NULL;
+  }
+  return list;
+}
+
+static int sort_compare_var_addr(const void *A, const void *B)
+{
+  struct dw_var_addr *a = (struct dw_var_addr*)A;
+  struct dw_var_addr *b = (struct dw_var_addr*)B;
+
+  if (a->addr != b->addr) {
+    return a->addr < b->addr ? -1 : 1;
+  }
+  /* keep the order deterministic */
+  return a->die->offset < b->die->offset ? -1 :
+    a->die->offset > b->die->offset ? 1 : 0;
+}
+
+static void load_var_addrs(gimli_mapped_object_t file)
+{
+  struct dw_scan_item *items;
+  struct dw_var_addr_list *list;
+  const uint8_t *start, *end;
+  uint32_t i, n = 0;
+  int nitems, j;
+
+  file->varaddrs_loaded = 1;
+
+  if (!get_sect_data(file, ".debug_info", &start, &end, NULL) ||
+      !init_debug_info(file)) {
+    return;
+  }
+
+  items = dw_scan_cus(file, visit_var_addrs, NULL, &nitems);
+  for (j = 0; j < nitems; j++) {
+    if (items[j].result) {
+      n += ((struct dw_var_addr_list*)items[j].result)->nvars;
+    }
+  }
+  file->varaddrs = calloc(n ? n : 1, sizeof(*file->varaddrs));
+  for (j = 0; j < nitems; j++) {
+    list = items[j].result;
+    if (!list) {
+      continue;
+    }
+    memcpy(file->varaddrs + file->num_varaddrs, list->vars,
+        list->nvars * sizeof(*list->vars));
+    file->num_varaddrs += list->nvars;
+    free(list->vars);
+    free(list);
+  }
+  free(items);
+
+  /* sizes may reference types in other CUs, so resolve them now that
+   * the scan has completed */
+  for (i = 0; i < file->num_varaddrs; i++) {
+    file->varaddrs[i].size = die_type_size(file,
+        die_get_attr_follow(file, file->varaddrs[i].die, DW_AT_type));
+  }
+
+  qsort(file->varaddrs, file->num_varaddrs, sizeof(*file->varaddrs),
+      sort_compare_var_addr);
+}
+
+/* Find the variable containing addr, and the offset of addr within it */
+static struct dw_var_addr *find_var_addr(gimli_proc_t proc,
+    gimli_addr_t addr, gimli_mapped_object_t *filep, uint64_t *offset)
+{
+  struct gimli_object_mapping *m;
+  gimli_mapped_object_t file;
+  struct dw_var_addr *v;
+  uint32_t lo, hi, mid;
+
+  m = gimli_mapping_for_addr(proc, addr);
+  if (!m) {
+    return NULL;
+  }
+  file = m->objfile;
+  if (!file->elf) {
+    return NULL;
+  }
+  if (!file->varaddrs_loaded) {
+    load_var_addrs(file);
+  }
+#ifdef __MACH__
+  addr -= file->base_addr;
+#endif
+
+  /* find the last variable that starts at or below addr */
+  lo = 0;
+  hi = file->num_varaddrs;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (file->varaddrs[mid].addr <= addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    return NULL;
+  }
+  v = &file->varaddrs[lo - 1];
+  /* if we don't know the size, only an exact match will do */
+  if (addr != v->addr && addr >= v->addr + v->size) {
+    return NULL;
+  }
+  *filep = file;
+  *offset = addr - v->addr;
+  return v;
+}
+
+/* Locate the DW_TAG_variable die for the variable that starts
+ * at the provided data address */
+static struct gimli_dwarf_die *gimli_dwarf_get_die_for_data(
+    gimli_proc_t proc, gimli_addr_t addr)
+{
+  struct dw_var_addr *v;
+  gimli_mapped_object_t file;
+  uint64_t offset;
+
+  v = find_var_addr(proc, addr, &file, &offset);
+  if (!v || offset) {
+    return NULL;
+  }
+  return v->die;
+}
+
+/* Returns the name of the variable that contains addr, and the offset
+ * of addr within it */
+const char *gimli_dwarf_data_var_name(gimli_proc_t proc,
+    gimli_addr_t addr, uint64_t *offset)
+{
+  struct dw_var_addr *v;
+  gimli_mapped_object_t file;
+  struct gimli_dwarf_attr *name;
+
+  v = find_var_addr(proc, addr, &file, offset);
+  if (!v) {
+    return NULL;
+  }
+  name = die_get_attr_follow(file, v->die, DW_AT_name);
+  if (!name || name->form != DW_FORM_string) {
+    return NULL;
+  }
+  return (const char*)name->ptr;
+}
+
+/* The pc index maps address ranges to the innermost DW_TAG_subprogram
+ * or DW_TAG_inlined_subroutine that covers them.
+ * The ranges are leaves: they don't overlap, and where a subprogram
+ * has inlined code, the inlined portion is carved out of the range
+ * of the subprogram, so a single search yields the innermost DIE;
+ * its parents describe the inline chain.
+ * The index is populated a CU at a time, as PCs are looked up */
+struct dw_pc_range {
+  gimli_addr_t lo, hi;
+  struct gimli_dwarf_die *die;
+};
+
+/* a covered range of a DIE, prior to flattening */
+struct dw_pc_span {
+  gimli_addr_t lo, hi;
+  int depth;
+  struct gimli_dwarf_die *die;
+};
+
+struct dw_pc_collect {
+  gimli_mapped_object_t file;
+  struct gimli_dwarf_cu *cu;
+  gimli_addr_t cu_base;
+  struct dw_pc_span *spans;
+  int nspans, alloc;
+};
+
+static int sort_compare_pc_span(const void *A, const void *B)
+{
+  struct dw_pc_span *a = (struct dw_pc_span*)A;
+  struct dw_pc_span *b = (struct dw_pc_span*)B;
+
+  if (a->lo != b->lo) {
+    return a->lo < b->lo ? -1 : 1;
+  }
+  /* outermost first */
+  if (a->depth != b->depth) {
+    return a->depth - b->depth;
+  }
+  if (a->hi != b->hi) {
+    return a->hi > b->hi ? -1 : 1;
+  }
+  return 0;
+}
+
+static int sort_compare_pc_range(const void *A, const void *B)
+{
+  struct dw_pc_range *a = (struct dw_pc_range*)A;
+  struct dw_pc_range *b = (struct dw_pc_range*)B;
+
+  return a->lo < b->lo ? -1 : a->lo > b->lo ? 1 : 0;
+}
+
+static int search_compare_pc_range(const void *K, const void *R)
+{
+  struct dw_pc_range *r = (struct dw_pc_range*)R;
+  gimli_addr_t pc = *(gimli_addr_t*)K;
+
+  if (pc < r->lo) {
+    return -1;
+  }
+  if (pc < r->hi) {
+    return 0;
+  }
+  return 1;
+}
+
+static void add_pc_span(struct dw_pc_collect *c, struct gimli_dwarf_die *die,
+    int depth, gimli_addr_t lo, gimli_addr_t hi)
+{
+  struct dw_pc_span *span;
+
+  if (hi <= lo) {
+    return;
+  }
+  if (c->nspans + 1 >= c->alloc) {
+    c->alloc = c->alloc ? c->alloc * 2 : 64;
+    c->spans = realloc(c->spans, c->alloc * sizeof(*c->spans));
+  }
+  span = &c->spans[c->nspans++];
+  span->lo = lo;
+  span->hi = hi;
+  span->depth = depth;
+  span->die = die;
+}
+
+/* Walk a .debug_ranges list, adding a span for each entry */
+static int add_pc_span_list(struct dw_pc_collect *c,
+    struct gimli_dwarf_die *die, int depth, uint64_t offset)
+{
+  const uint8_t *data, *end;
+  gimli_object_file_t elf = c->file->debug_info.elf;
+  gimli_addr_t base = c->cu_base;
+  uint64_t lo, hi;
+  uint32_t u32;
+  int n = 0;
+
+  if (!get_sect_data(c->file, ".debug_ranges", &data, &end, &elf)) {
+    return 0;
+  }
+  data += offset;
+
+  while (data + 2 * c->cu->addr_size <= end) {
+    if (c->cu->addr_size == 8) {
+      memcpy(&lo, data, sizeof(lo));
+      memcpy(&hi, data + sizeof(lo), sizeof(hi));
+    } else {
+      memcpy(&u32, data, sizeof(u32));
+      lo = u32;
+      memcpy(&u32, data + sizeof(u32), sizeof(u32));
+      hi = u32;
+      if (lo == UINT32_MAX) {
+        lo = UINT64_MAX;
+      }
+    }
+    data += 2 * c->cu->addr_size;
+
+    if (lo == 0 && hi == 0) {
+      /* end of list */
+      break;
+    }
+    if (lo == UINT64_MAX) {
+      /* base address selection */
+      base = hi + c->file->debug_info.reloc;
+      continue;
+    }
+    add_pc_span(c, die, depth, base + lo, base + hi);
+    n++;
+  }
+  return n;
+}
+
+/* Add the span(s) covered by die; returns the number added */
+static int add_die_pc_spans(struct dw_pc_collect *c,
+    struct gimli_dwarf_die *die, int depth)
+{
+  struct gimli_dwarf_attr *lo, *hi, *ranges;
+
+  ranges = gimli_dwarf_die_get_attr(die, DW_AT_ranges);
+  if (ranges) {
+    return add_pc_span_list(c, die, depth, ranges->code);
+  }
+
+  lo = gimli_dwarf_die_get_attr(die, DW_AT_low_pc);
+  hi = gimli_dwarf_die_get_attr(die, DW_AT_high_pc);
+  if (!lo || !hi) {
+    return 0;
+  }
+  if (hi->form == DW_FORM_addr) {
+    add_pc_span(c, die, depth, lo->code, hi->code);
+  } else {
+    /* DWARF 4: high_pc is the length of the range */
+    add_pc_span(c, die, depth, lo->code, lo->code + hi->code);
+  }
+  return 1;
+}
+
+static void collect_pc_spans(struct dw_pc_collect *c,
+    struct gimli_dwarf_die *die, int depth)
+{
+  struct gimli_dwarf_die *kid;
+
+  STAILQ_FOREACH(kid, &die->kids, siblings) {
+    switch (kid->tag) {
+      case DW_TAG_subprogram:
+      case DW_TAG_inlined_subroutine:
+        add_die_pc_spans(c, kid, depth);
+        collect_pc_spans(c, kid, depth + 1);
+        break;
+      case DW_TAG_lexical_block:
+      case DW_TAG_namespace:
+      case DW_TAG_class_type:
+      case DW_TAG_structure_type:
+      case DW_TAG_union_type:
+        /* may contain nested subprograms or inlined code */
+        collect_pc_spans(c, kid, depth);
+        break;
+    }
+  }
+}
+
+static void add_pc_range(gimli_mapped_object_t file,
+    gimli_addr_t lo, gimli_addr_t hi, struct gimli_dwarf_die *die)
+{
+  struct dw_pc_range *r;
+
+  if (hi <= lo) {
+    return;
+  }
+  if (file->num_pcranges + 1 >= file->alloc_pcranges) {
+    file->alloc_pcranges = file->alloc_pcranges ?
+      file->alloc_pcranges * 2 : 1024;
+    file->pcranges = realloc(file->pcranges,
+        file->alloc_pcranges * sizeof(*r));
+  }
+  r = &file->pcranges[file->num_pcranges++];
+  r->lo = lo;
+  r->hi = hi;
+  r->die = die;
+}
+
+/* Flatten the nested spans of a CU into leaf ranges and add them
+ * to the index for its object */
+static void index_cu_pcs(gimli_mapped_object_t file, struct gimli_dwarf_cu *cu)
+{
+  struct dw_pc_collect c;
+  struct dw_pc_span *stack[64], *span;
+  struct gimli_dwarf_die *die;
+  struct dw_pc_range *added;
+  gimli_addr_t pos = 0;
+  int i, top = -1;
+  uint32_t first, j, k, nadded;
+
+  if (cu->pc_indexed) {
+    return;
+  }
+  cu->pc_indexed = 1;
+
+  memset(&c, 0, sizeof(c));
+  c.file = file;
+  c.cu = cu;
+
+  STAILQ_FOREACH(die, &cu->dies, siblings) {
+    if (die->tag != DW_TAG_compile_unit && die->tag != DW_TAG_partial_unit) {
+      continue;
+    }
+    c.cu_base = file->debug_info.reloc;
+    gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_low_pc, &c.cu_base);
+    collect_pc_spans(&c, die, 0);
+  }
+  if (!c.nspans) {
+    return;
+  }
+
+  qsort(c.spans, c.nspans, sizeof(*c.spans), sort_compare_pc_span);
+  first = file->num_pcranges;
+
+  /* sweep the spans in address order, keeping a stack of those
+   * that are open; the top of the stack is the innermost */
+  for (i = 0; i < c.nspans; i++) {
+    span = &c.spans[i];
+
+    /* close out those that end before this one starts */
+    while (top >= 0 && stack[top]->hi <= span->lo) {
+      if (pos < stack[top]->hi) {
+        add_pc_range(file, pos, stack[top]->hi, stack[top]->die);
+        pos = stack[top]->hi;
+      }
+      top--;
+    }
+    if (top >= 0) {
+      /* nested; the enclosing span covers up to here */
+      if (pos < span->lo) {
+        add_pc_range(file, pos, span->lo, stack[top]->die);
+      }
+      /* tolerate improperly nested data by clipping */
+      if (span->hi > stack[top]->hi) {
+        span->hi = stack[top]->hi;
+      }
+    }
+    if (span->lo < pos) {
+      span->lo = pos;
+    }
+    if (span->hi <= span->lo) {
+      continue;
+    }
+    if (top + 1 >= sizeof(stack)/sizeof(stack[0])) {
+      printf("DWARF: %s: subprograms nested too deeply at " PTRFMT "\n",
+          file->objname, (PTRFMT_T)span->lo);
+      continue;
+    }
+    pos = span->lo;
+    stack[++top] = span;
+  }
+  while (top >= 0) {
+    if (pos < stack[top]->hi) {
+      add_pc_range(file, pos, stack[top]->hi, stack[top]->die);
+      pos = stack[top]->hi;
+    }
+    top--;
+  }
+  free(c.spans);
+
+  /* the sweep emits this CU's ranges in address order; merge them into
+   * the ranges of the CUs indexed before it.  CUs are commonly laid out
+   * in address order, in which case they can stay where they are */
+  nadded = file->num_pcranges - first;
+  if (!nadded || !first || sort_compare_pc_range(&file->pcranges[first - 1],
+        &file->pcranges[first]) <= 0) {
+    return;
+  }
+  added = malloc(nadded * sizeof(*added));
+  if (!added) {
+    qsort(file->pcranges, file->num_pcranges, sizeof(*file->pcranges),
+        sort_compare_pc_range);
+    return;
+  }
+  memcpy(added, &file->pcranges[first], nadded * sizeof(*added));
+  /* from the top down, so that nothing is overwritten before it moves */
+  i = first;
+  j = nadded;
+  k = first + nadded;
+  while (j > 0) {
+    if (i > 0 && sort_compare_pc_range(&file->pcranges[i - 1],
+          &added[j - 1]) > 0) {
+      file->pcranges[--k] = file->pcranges[--i];
+    } else {
+      file->pcranges[--k] = added[--j];
+    }
+  }
+  free(added);
+}
+
+/* Line number information is decoded one line program at a time,
+ * as PCs covered by it are looked up.  The program for a PC is
+ * located via the DW_AT_stmt_list attribute of the CU that contains
+ * it.  The decoded sequences of all of the programs that have been
+ * loaded for an object are kept in a single array sorted by address.
+ *
+ * Rows within a sequence are delta encoded in blocks of
+ * DW_LINE_BLOCK_ROWS rows.  Each block has a header holding the full
+ * state of its first row, so a lookup binary searches the headers and
+ * then decodes at most one block.  The remaining rows in a block are
+ * each encoded as:
+ *
+ *   uleb128  (address delta << 3) | flags
+ *   sleb128  line delta
+ *   uleb128  file index; present if DW_LINE_FILE is set in flags
+ *   uleb128  column; present if DW_LINE_COLUMN is set in flags
+ *
+ * The encoded form holds no pointers; addresses are relative to the
+ * start of the sequence and files are indices into the file table of
+ * the line program.
+ */
+#define DW_LINE_BLOCK_ROWS 32
+#define DW_LINE_IS_STMT    1
+#define DW_LINE_FILE       2
+#define DW_LINE_COLUMN     4
+
+struct dw_line_row {
+  gimli_addr_t addr;
+  uint32_t file;
+  uint32_t line;
+  uint32_t column;
+  uint8_t is_stmt;
+};
+
+struct dw_line_block {
+  /* address of the first row, relative to the start of the sequence */
+  uint32_t addr;
+  /* offset of the encoded rows that follow the first */
+  uint32_t data;
+  uint32_t file;
+  uint32_t line;
+  uint32_t column;
+  uint8_t is_stmt;
+};
+
+struct dw_line_table;
+
+struct dw_line_seq {
+  /* range of addresses covered by the sequence; unrelocated */
+  gimli_addr_t lo, hi;
+  struct dw_line_table *table;
+  struct dw_line_block *blocks;
+  uint8_t *data;
+  uint32_t nrows;
+  uint32_t nblocks;
+  uint32_t datalen;
+};
+
+struct dw_line_table {
+  /* offset of the line program within .debug_line */
+  uint64_t offset;
+  const char **files;
+  uint32_t nfiles;
+  struct dw_line_seq *seqs;
+  uint32_t nseqs;
+};
+
+/* Accumulates the rows of the sequence currently being decoded */
+struct dw_line_enc {
+  struct dw_line_seq seq;
+  struct dw_line_row prev;
+  uint32_t blockalloc;
+  uint32_t dataalloc;
+};
+
+static void free_line_table(void *arg)
+{
+  struct dw_line_table *t = arg;
+  uint32_t i;
+
+  for (i = 0; i < t->nseqs; i++) {
+    free(t->seqs[i].blocks);
+    free(t->seqs[i].data);
+  }
+  free(t->seqs);
+  free(t->files);
+  free(t);
+}
+
+static int sort_compare_line_seq(const void *A, const void *B)
+{
+  struct dw_line_seq *a = *(struct dw_line_seq**)A;
+  struct dw_line_seq *b = *(struct dw_line_seq**)B;
+
+  return a->lo < b->lo ? -1 : a->lo > b->lo ? 1 : 0;
+}
+
+static int search_compare_line_seq(const void *addrp, const void *S)
+{
+  struct dw_line_seq *seq = *(struct dw_line_seq**)S;
+  gimli_addr_t pc = *(gimli_addr_t*)addrp;
+
+  if (pc < seq->lo) {
+    return -1;
+  }
+  if (pc < seq->hi) {
+    return 0;
+  }
+  return 1;
+}
+
+static int put_uleb128(uint8_t *data, uint64_t v)
+{
+  int n = 0;
+
+  do {
+    uint8_t b = v & 0x7f;
+
+    v >>= 7;
+    if (v) {
+      b |= 0x80;
+    }
+    data[n++] = b;
+  } while (v);
+
+  return n;
+}
+
+static int put_leb128(uint8_t *data, int64_t v)
+{
+  int n = 0;
+  int more = 1;
+
+  while (more) {
+    uint8_t b = v & 0x7f;
+
+    v >>= 7;
+    if ((v == 0 && !(b & 0x40)) || (v == -1 && (b & 0x40))) {
+      more = 0;
+    } else {
+      b |= 0x80;
+    }
+    data[n++] = b;
+  }
+
+  return n;
+}
+
+/* Append a row to the sequence being accumulated in enc */
+static void add_line_row(struct dw_line_enc *enc, struct dw_line_row *row)
+{
+  struct dw_line_seq *seq = &enc->seq;
+  struct dw_line_block *blk;
+  uint8_t *data;
+  uint8_t flags = 0;
+
+  if (seq->nrows == 0) {
+    seq->lo = row->addr;
+  } else if (row->addr < enc->prev.addr || row->addr - seq->lo > UINT32_MAX) {
+    /* rows within a sequence must have non-decreasing addresses */
+    return;
+  }
+
+  if (seq->nrows % DW_LINE_BLOCK_ROWS == 0) {
+    if (seq->nblocks + 1 >= enc->blockalloc) {
+      enc->blockalloc = enc->blockalloc ? enc->blockalloc * 2 : 4;
+      seq->blocks = realloc(seq->blocks,
+          enc->blockalloc * sizeof(*seq->blocks));
+    }
+    blk = &seq->blocks[seq->nblocks++];
+    blk->addr = row->addr - seq->lo;
+    blk->data = seq->datalen;
+    blk->file = row->file;
+    blk->line = row->line;
+    blk->column = row->column;
+    blk->is_stmt = row->is_stmt;
+  } else {
+    /* worst case: 4 lebs of 10 bytes */
+    if (seq->datalen + 40 >= enc->dataalloc) {
+      enc->dataalloc = enc->dataalloc ? enc->dataalloc * 2 : 256;
+      seq->data = realloc(seq->data, enc->dataalloc);
+    }
+    data = seq->data + seq->datalen;
+
+    if (row->is_stmt) {
+      flags |= DW_LINE_IS_STMT;
+    }
+    if (row->file != enc->prev.file) {
+      flags |= DW_LINE_FILE;
+    }
+    if (row->column != enc->prev.column) {
+      flags |= DW_LINE_COLUMN;
+    }
+    data += put_uleb128(data, ((row->addr - enc->prev.addr) << 3) | flags);
+    data += put_leb128(data, (int64_t)row->line - (int64_t)enc->prev.line);
+    if (flags & DW_LINE_FILE) {
+      data += put_uleb128(data, row->file);
+    }
+    if (flags & DW_LINE_COLUMN) {
+      data += put_uleb128(data, row->column);
+    }
+    seq->datalen = data - seq->data;
+  }
+
+  seq->nrows++;
+  enc->prev = *row;
+}
+
+/* Closes out the sequence being accumulated in enc, adding it to t */
+static void finish_line_seq(struct dw_line_table *t, struct dw_line_enc *enc,
+    uint32_t *seqalloc, gimli_addr_t end_addr)
+{
+  struct dw_line_seq *seq = &enc->seq;
+
+  if (seq->nrows == 0 || seq->lo == 0 || end_addr <= seq->lo) {
+    /* empty, or discarded by the linker */
+    free(seq->blocks);
+    free(seq->data);
+    memset(enc, 0, sizeof(*enc));
+    return;
+  }
+  seq->hi = end_addr;
+  seq->table = t;
+  /* trim to size */
+  seq->blocks = realloc(seq->blocks, seq->nblocks * sizeof(*seq->blocks));
+  if (seq->datalen) {
+    seq->data = realloc(seq->data, seq->datalen);
+  }
+
+  if (t->nseqs + 1 >= *seqalloc) {
+    *seqalloc = *seqalloc ? *seqalloc * 2 : 16;
+    t->seqs = realloc(t->seqs, *seqalloc * sizeof(*seq));
+  }
+  t->seqs[t->nseqs++] = *seq;
+  memset(enc, 0, sizeof(*enc));
+}
+
+/* Locate the row covering the unrelocated address addr in seq */
+static void find_line_row(struct dw_line_seq *seq, gimli_addr_t addr,
+    struct dw_line_row *row)
+{
+  struct dw_line_block *blk;
+  const uint8_t *data, *end;
+  uint32_t lo = 0, hi = seq->nblocks, mid, i, n;
+  uint32_t rel = addr - seq->lo;
+  uint64_t u;
+
+  /* last block starting at or before addr */
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if (seq->blocks[mid].addr <= rel) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  blk = &seq->blocks[lo];
+
+  row->addr = blk->addr;
+  row->file = blk->file;
+  row->line = blk->line;
+  row->column = blk->column;
+  row->is_stmt = blk->is_stmt;
+
+  n = seq->nrows - lo * DW_LINE_BLOCK_ROWS;
+  if (n > DW_LINE_BLOCK_ROWS) {
+    n = DW_LINE_BLOCK_ROWS;
+  }
+  data = seq->data + blk->data;
+  end = seq->data + seq->datalen;
+
+  /* the row we want is the last one at or before addr */
+  for (i = 1; i < n; i++) {
+    const uint8_t *next = data;
+    uint8_t flags;
+
+    u = dw_read_uleb128(&next, end);
+    if (row->addr + (u >> 3) > rel) {
+      break;
+    }
+    flags = u & 7;
+    row->addr += u >> 3;
+    row->line += dw_read_leb128(&next, end);
+    row->is_stmt = flags & DW_LINE_IS_STMT;
+    if (flags & DW_LINE_FILE) {
+      row->file = dw_read_uleb128(&next, end);
+    }
+    if (flags & DW_LINE_COLUMN) {
+      row->column = dw_read_uleb128(&next, end);
+    }
+    data = next;
+  }
+  row->addr += seq->lo;
+}
+
+/* the line programs live alongside the rest of the debug info,
+ * which may be in the aux object */
+static int get_line_sect(gimli_mapped_object_t f,
+  const uint8_t **startptr, const uint8_t **endptr)
+{
+  struct gimli_section_data *s = NULL;
+
+  if (f->aux_elf) {
+    s = gimli_get_section_by_name(f->aux_elf, ".debug_line");
+  }
+  if (!s) {
+    s = gimli_get_section_by_name(f->elf, ".debug_line");
+  }
+  if (!s || !s->data) {
+    return 0;
+  }
+  *startptr = (const uint8_t*)s->data;
+  *endptr = *startptr + s->size;
+  return 1;
+}
+
+/* Decode the line program at offset in the .debug_line section
+ * [sect, sectend) */
+static struct dw_line_table *decode_line_program(gimli_mapped_object_t f,
+  const uint8_t *sect, const uint8_t *sectend, uint64_t offset)
+{
+  struct {
+    gimli_addr_t address;
+    uint64_t file;
+    uint64_t line;
+    uint64_t column;
+    uint8_t is_stmt; /* recommended breakpoint location */
+    uint8_t basic_block; /* is start of a basic block */
+    uint8_t end_sequence;
+    uint8_t prologue_end;
+    uint8_t epilogue_begin;
+    uint64_t isa;
+  } regs;
+  const uint8_t *data, *cuend, *prog;
+  uint32_t initlen;
+  uint64_t len;
+  int is_64 = 0;
+  uint16_t ver;
+  struct {
+    uint8_t min_insn_len;
+    uint8_t def_is_stmt;
+    int8_t line_base;
+    uint8_t line_range;
+    uint8_t opcode_base;
+  } hdr_1;
+  uint8_t opcode_lengths[256];
+  int i;
+  uint8_t op;
+  uint32_t filealloc = 0, seqalloc = 0;
+  struct dw_line_table *t;
+  struct dw_line_enc enc;
+  struct dw_line_row row;
+  int debugline = debug && 0;
+
+  data = sect + offset;
+
+  /* read the initial length, this tells us which dwarf version and format
+   * we're dealing with */
+  memcpy(&initlen, data, sizeof(initlen));
+  data += sizeof(initlen);
+
+  if (initlen == 0xffffffff) {
+    /* this is a 64-bit dwarf */
+    is_64 = 1;
+    memcpy(&len, data, sizeof(len));
+    data += sizeof(len);
+  } else {
+    len = initlen;
+  }
+  cuend = data + len;
+  if (cuend > sectend) {
+    printf("DWARF: %s: line program at 0x%" PRIx64 " overruns .debug_line\n",
+        f->objname, offset);
+    return NULL;
+  }
+
+  memcpy(&ver, data, sizeof(ver));
+  data += sizeof(ver);
+
+  if (debugline) {
+    fprintf(stderr, "initlen is 0x%" PRIx64 " (%d bit) ver=%u\n",
+      len, is_64 ? 64 : 32, ver);
+  }
+  if (ver < 2 || ver > 4) {
+    printf("DWARF: %s: line program at 0x%" PRIx64 " has unsupported version %d\n",
+        f->objname, offset, ver);
+    return NULL;
+  }
+
+  if (is_64) {
+    memcpy(&len, data, sizeof(len));
+    data += sizeof(len);
+  } else {
+    memcpy(&initlen, data, sizeof(initlen));
+    data += sizeof(initlen);
+    len = initlen;
+  }
+  prog = data + len;
+
+  memcpy(&hdr_1.min_insn_len, data, sizeof(hdr_1.min_insn_len));
+  data += sizeof(hdr_1.min_insn_len);
+  if (ver >= 4) {
+    /* maximum_operations_per_instruction; only meaningful for VLIW */
+    data++;
+  }
+  memcpy(&hdr_1.def_is_stmt, data, sizeof(hdr_1) - 1);
+  data += sizeof(hdr_1) - 1;
+
+  if (debugline) {
+    fprintf(stderr,
+      "headerlen is %" PRIu64 ", min_insn_len=%u line_base=%d line_range=%u\n"
+      "opcode_base=%u\n",
+      len, hdr_1.min_insn_len, hdr_1.line_base, hdr_1.line_range,
+      hdr_1.opcode_base);
+  }
+  if (hdr_1.line_range == 0) {
+    printf("DWARF: %s: line program at 0x%" PRIx64 " has no line_range\n",
+        f->objname, offset);
+    return NULL;
+  }
+  memset(opcode_lengths, 0, sizeof(opcode_lengths));
+  for (i = 1; i < hdr_1.opcode_base; i++) {
+    opcode_lengths[i] = *data++;
+    if (debugline) {
+      fprintf(stderr, "op len [%d] = %u\n", i, opcode_lengths[i]);
+    }
+  }
+
+  t = calloc(1, sizeof(*t));
+  t->offset = offset;
+
+  /* include_directories */
+  while (*data && data < prog) {
+    if (debugline) fprintf(stderr, "inc_dir: %s\n", data);
+    data += strlen((char*)data) + 1;
+  }
+  data++;
+
+  /* files; numbered from 1 */
+  t->nfiles = 1;
+  filealloc = 16;
+  t->files = calloc(filealloc, sizeof(*t->files));
+  while (*data && data < prog) {
+    if (t->nfiles + 1 >= filealloc) {
+      filealloc *= 2;
+      t->files = realloc(t->files, filealloc * sizeof(*t->files));
+    }
+    if (debugline) fprintf(stderr, "file[%d] = %s\n", t->nfiles, data);
+    t->files[t->nfiles++] = (char*)data;
+    data += strlen((char*)data) + 1;
+    /* ignore additional data about the file */
+    dw_read_uleb128(&data, prog);
+    dw_read_uleb128(&data, prog);
+    dw_read_uleb128(&data, prog);
+  }
+
+  memset(&regs, 0, sizeof(regs));
+  regs.file = 1;
+  regs.line = 1;
+  regs.is_stmt = hdr_1.def_is_stmt;
+  memset(&enc, 0, sizeof(enc));
+
+  /* opcodes */
+  data = prog;
+  while (data < cuend) {
+    int emit = 0;
+
+    memcpy(&op, data, sizeof(op));
+    data += sizeof(op);
+
+    if (op == 0) {
+      /* extended */
+      const uint8_t *next;
+      initlen = dw_read_uleb128(&data, cuend);
+      memcpy(&op, data, sizeof(op));
+      next = data + initlen;
+      data += sizeof(op);
+      switch (op) {
+        case DW_LNE_set_address:
+          {
+            void *addr;
+            memcpy(&addr, data, sizeof(addr));
+            if (debugline) fprintf(stderr, "set_address %p\n", addr);
+            regs.address = (gimli_addr_t)addr;
+            break;
+          }
+        case DW_LNE_end_sequence:
+          {
+            if (debugline) fprintf(stderr, "end_sequence\n");
+            finish_line_seq(t, &enc, &seqalloc, regs.address);
+            memset(&regs, 0, sizeof(regs));
+            regs.file = 1;
+            regs.line = 1;
+            regs.is_stmt = hdr_1.def_is_stmt;
+            break;
+          }
+        case DW_LNE_define_file:
+          {
+            const char *fname = (char*)data;
+
+            if (t->nfiles + 1 >= filealloc) {
+              filealloc *= 2;
+              t->files = realloc(t->files, filealloc * sizeof(*t->files));
+            }
+            t->files[t->nfiles++] = fname;
+            if (debugline) fprintf(stderr, "define_files[%u] = %s\n", t->nfiles - 1, fname);
+            break;
+          }
+
+        default:
+//          fprintf(stderr,
+//            "DWARF: line nos.: unhandled extended op=%02x, len=%" PRIu32 "\n",
+//            op, initlen);
+          ;
+      }
+      data = next;
+    } else if (op < hdr_1.opcode_base) {
+      /* standard opcode */
+      switch (op) {
+        case DW_LNS_copy:
+          if (debugline) fprintf(stderr, "copy\n");
+          emit = 1;
+          break;
+        case DW_LNS_advance_line:
+          {
+            int64_t d = dw_read_leb128(&data, cuend);
+            if (debugline) {
+              fprintf(stderr, "advance_line from %" PRId64 " to %" PRId64 "\n",
+                regs.line, regs.line + d);
+            }
+            regs.line += d;
+            break;
+          }
+
+        case DW_LNS_advance_pc:
+          {
+            uint64_t u = dw_read_uleb128(&data, cuend);
+            regs.address += u * hdr_1.min_insn_len;
+            if (debugline) {
+              fprintf(stderr, "advance_pc: addr=0x%" PRIx64 "\n", (uint64_t)regs.address);
+            }
+            break;
+          }
+        case DW_LNS_set_file:
+        {
+          uint64_t u = dw_read_uleb128(&data, cuend);
+          regs.file = u;
+          if (debugline) fprintf(stderr, "set_file: %" PRIu64 "\n", regs.file);
+          break;
+        }
+        case DW_LNS_set_column:
+        {
+          uint64_t u = dw_read_uleb128(&data, cuend);
+          regs.column = u;
+          if (debugline) fprintf(stderr, "set_column: %" PRIu64 "\n", regs.column);
+          break;
+        }
+        case DW_LNS_negate_stmt:
+          if (debugline) fprintf(stderr, "negate_stmt\n");
+          regs.is_stmt = !regs.is_stmt;
+          break;
+        case DW_LNS_set_basic_block:
+          if (debugline) fprintf(stderr, "set_basic_block\n");
+          regs.basic_block = 1;
+          break;
+        case DW_LNS_const_add_pc:
+          regs.address += ((255 - hdr_1.opcode_base) /
+                          hdr_1.line_range) * hdr_1.min_insn_len;
+          if (debugline) {
+            fprintf(stderr, "const_add_pc: addr=0x%" PRIx64 "\n", (uint64_t)regs.address);
+          }
+          break;
+        case DW_LNS_fixed_advance_pc:
+        {
+          uint16_t u;
+          memcpy(&u, data, sizeof(u));
+          data += sizeof(u);
+          regs.address += u;
+          if (debugline) {
+            fprintf(stderr, "fixed_advance_pc: 0x%" PRIx64 "\n", (uint64_t)regs.address);
+          }
+          break;
+        }
+        case DW_LNS_set_prologue_end:
+          if (debugline) {
+            fprintf(stderr, "set_prologue_end\n");
+          }
+          regs.prologue_end = 1;
+          break;
+        case DW_LNS_set_epilogue_begin:
+          if (debugline) {
+            fprintf(stderr, "set_epilogue_begin\n");
+          }
+          regs.epilogue_begin = 1;
+          break;
+        case DW_LNS_set_isa:
+          regs.isa = dw_read_uleb128(&data, cuend);
+          if (debugline) {
+            fprintf(stderr, "set_isa: 0x%" PRIx64 "\n", regs.isa);
+          }
+          break;
+        default:
+          fprintf(stderr, "DWARF: line nos: unhandled op: %02x\n", op);
+          /* consume unknown/unhandled args */
+          for (i = 0; i < opcode_lengths[op]; i++) {
+            dw_read_uleb128(&data, cuend);
+          }
+      }
+    } else {
+      /* special opcode */
+      op -= hdr_1.opcode_base;
+
+      regs.address += (op / hdr_1.line_range) * hdr_1.min_insn_len;
+      regs.line += hdr_1.line_base + (op % hdr_1.line_range);
+      if (debugline) {
+        fprintf(stderr, "special: addr = 0x%" PRIx64 ", line = %" PRId64 "\n",
+          (uint64_t)regs.address, regs.line);
+      }
+      emit = 1;
+    }
+
+    if (!emit) {
+      continue;
+    }
+
+    /* append a row to the matrix */
+    row.addr = regs.address;
+    row.file = regs.file;
+    row.line = regs.line;
+    row.column = regs.column;
+    row.is_stmt = regs.is_stmt;
+    add_line_row(&enc, &row);
+
+    regs.basic_block = 0;
+    regs.prologue_end = 0;
+    regs.epilogue_begin = 0;
+  }
+  /* a well formed program ends each sequence explicitly */
+  free(enc.seq.blocks);
+  free(enc.seq.data);
+
+  return t;
+}
+
+/* Find or decode the line program at offset; returns NULL if it
+ * could not be decoded, or describes no code */
+static struct dw_line_table *load_line_table(gimli_mapped_object_t f,
+    uint64_t offset)
+{
+  struct dw_line_table *t;
+  struct dw_line_seq **seqs;
+  const uint8_t *sect, *end;
+  uint32_t i, j, k;
+
+  if (!f->line_tables) {
+    f->line_tables = gimli_hash_new_size(free_line_table,
+        GIMLI_HASH_U64_KEYS, 0);
+  }
+  if (gimli_hash_find_u64(f->line_tables, offset, (void**)&t)) {
+    return t->nseqs ? t : NULL;
+  }
+  if (!get_line_sect(f, &sect, &end) || sect + offset >= end) {
+    return NULL;
+  }
+
+  t = decode_line_program(f, sect, end, offset);
+  if (!t) {
+    /* remember the failure, so that we neither decode it again nor
+     * repeat the diagnostic on every lookup in this CU */
+    t = calloc(1, sizeof(*t));
+    if (t) {
+      t->offset = offset;
+      gimli_hash_insert_u64(f->line_tables, offset, t);
+    }
+    return NULL;
+  }
+  gimli_hash_insert_u64(f->line_tables, offset, t);
+  if (!t->nseqs) {
+    return NULL;
+  }
+
+  /* make its sequences searchable by merging them, in order, into
+   * those we already have */
+  seqs = malloc(t->nseqs * sizeof(*seqs));
+  if (!seqs) {
+    return NULL;
+  }
+  for (i = 0; i < t->nseqs; i++) {
+    seqs[i] = &t->seqs[i];
+  }
+  qsort(seqs, t->nseqs, sizeof(*seqs), sort_compare_line_seq);
 
-      if (addr_size == 8) {
-        memcpy(&l, data, sizeof(l));
-        data += sizeof(l);
-      } else {
-        memcpy(&len32, data, sizeof(len32));
-        data += sizeof(len32);
-        l = len32;
-      }
+  if (f->num_line_seqs + t->nseqs >= f->alloc_line_seqs) {
+    f->alloc_line_seqs = power_2(f->num_line_seqs + t->nseqs + 1);
+    f->line_seqs = realloc(f->line_seqs,
+        f->alloc_line_seqs * sizeof(*f->line_seqs));
+  }
+  /* from the top down, so that nothing is overwritten before it moves */
+  i = f->num_line_seqs;
+  j = t->nseqs;
+  k = i + j;
+  while (j > 0) {
+    if (i > 0 && sort_compare_line_seq(&f->line_seqs[i - 1],
+          &seqs[j - 1]) > 0) {
+      f->line_seqs[--k] = f->line_seqs[--i];
+    } else {
+      f->line_seqs[--k] = seqs[--j];
+    }
+  }
+  f->num_line_seqs += t->nseqs;
+  free(seqs);
 
-      if (addr == 0 && l == 0) {
-        break;
-      }
+  return t;
+}
 
-      addr += reloc;
+/* Decode all of the line programs for an object; this is a batch
+ * operation intended for consumers that will need most of them */
+int gimli_dwarf_load_all_lines(gimli_mapped_object_t f)
+{
+  const uint8_t *sect, *end, *data;
+  uint32_t len32;
+  uint64_t len;
 
-      if (m->objfile->num_arange + 1 >= m->objfile->alloc_arange) {
-        m->objfile->alloc_arange = m->objfile->alloc_arange ? m->objfile->alloc_arange * 2 : 1024;
-        m->objfile->arange = realloc(m->objfile->arange, m->objfile->alloc_arange * sizeof(*arange));
-      }
-      arange = &m->objfile->arange[m->objfile->num_arange++];
-      arange->addr = addr;
-      arange->len = l;
-      arange->di_offset = di_offset;
+  if (f->lines_complete) {
+    return 1;
+  }
+  f->lines_complete = 1;
 
-//      printf("arange: addr=" PTRFMT " 0x%" PRIx64 "\n", addr, l);
-    }
-    data = next;
+  if (!f->elf || !get_line_sect(f, &sect, &end)) {
+    return 0;
   }
 
-  /* ensure ascending order */
-  qsort(m->objfile->arange, m->objfile->num_arange, sizeof(struct dw_die_arange),
-      sort_compare_arange);
-//printf("sorting %d arange in %s\n", m->objfile->num_arange, m->objfile->objname);
+  data = sect;
+  while (data + sizeof(len32) <= end) {
+    load_line_table(f, data - sect);
 
+    memcpy(&len32, data, sizeof(len32));
+    data += sizeof(len32);
+    if (len32 == 0xffffffff) {
+      memcpy(&len, data, sizeof(len));
+      data += sizeof(len);
+    } else {
+      len = len32;
+    }
+    data += len;
+  }
   return 1;
 }
 
-static int search_compare_arange(const void *K, const void *R)
+/* Read the DW_AT_stmt_list of the CU at cu_offset.
+ * Only the root DIE of the CU is parsed if the CU isn't already loaded */
+static int cu_stmt_list(gimli_mapped_object_t f, uint64_t cu_offset,
+    uint64_t *stmt_list)
 {
-  struct dw_die_arange *arange = (struct dw_die_arange*)R;
-  gimli_addr_t pc = *(gimli_addr_t*)K;
+  struct gimli_dwarf_cu *cu;
+  struct gimli_dwarf_die *die;
+  struct dw_cu_header hdr;
+  const uint8_t *data, *abbr, *ptr;
+  uint64_t code, atype, aform, val;
 
-  if (pc < arange->addr) {
-    return -1;
+  cu = find_cu(f, cu_offset);
+  if (cu) {
+    STAILQ_FOREACH(die, &cu->dies, siblings) {
+      if (gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_stmt_list, stmt_list)) {
+        return 1;
+      }
+    }
+    return 0;
   }
 
-  if (pc < arange->addr + arange->len) {
+  if (!init_debug_info(f) || !read_cu_header(f, cu_offset, &hdr)) {
     return 0;
   }
+  data = hdr.dies;
+  code = dw_read_uleb128(&data, hdr.cuend);
+  abbr = find_abbr(f, hdr.da_offset, code);
+  if (!abbr) {
+    return 0;
+  }
+  /* skip tag and has_children */
+  dw_read_uleb128(&abbr, f->abbr.end);
+  abbr += sizeof(uint8_t);
 
-  return 1;
+  while (data < hdr.cuend && abbr < f->abbr.end) {
+    atype = dw_read_uleb128(&abbr, f->abbr.end);
+    aform = dw_read_uleb128(&abbr, f->abbr.end);
+    if (atype == 0) {
+      break;
+    }
+    if (!get_value(aform, hdr.addr_size, hdr.is_64, &data, hdr.cuend,
+          &val, &ptr, f->debug_info.elf)) {
+      break;
+    }
+    if (atype == DW_AT_stmt_list) {
+      *stmt_list = val;
+      return 1;
+    }
+  }
+  return 0;
 }
 
-/* Given a CU, locate the DIE corresponding to the provided data address */
-static struct gimli_dwarf_die *find_var_die_for_addr(gimli_proc_t proc,
-    struct gimli_object_mapping *m,
-    struct gimli_dwarf_cu *cu, gimli_addr_t addr)
+/* Load the line program covering pc, if there is one we haven't
+ * already loaded.  Returns 1 if more line information was loaded */
+static int load_lines_for_pc(struct gimli_object_mapping *m, gimli_addr_t pc)
 {
-  struct gimli_dwarf_die *die, *kid;
-  struct gimli_unwind_cursor cur;
-  uint64_t frame_base = 0;
-  uint64_t comp_unit_base = 0;
-  int is_stack = 0;
-  struct gimli_dwarf_attr *frame_base_attr;
+  gimli_mapped_object_t f = m->objfile;
+  struct dw_die_arange *arange;
+  struct dw_pc_range *r;
+  struct gimli_dwarf_die *die;
+  uint64_t stmt_list;
+  uint64_t cu_offset;
 
-  memset(&cur, 0, sizeof(cur));
-  cur.proc = proc;
+  if (f->lines_complete) {
+    return 0;
+  }
 #ifdef __MACH__
-  addr -= m->objfile->base_addr;
+  pc -= f->base_addr;
 #endif
 
-  STAILQ_FOREACH(die, &cu->dies, siblings) {
-    uint64_t lopc, hipc;
-
-    if (die->tag != DW_TAG_compile_unit) {
-      printf("DIE is not a compile unit!? tag=0x%" PRIx64 "\n", die->tag);
-      continue;
+  if (f->arange || load_arange(m)) {
+    arange = bsearch(&pc, f->arange, f->num_arange,
+        sizeof(*arange), search_compare_arange);
+    if (!arange) {
+      return 0;
     }
+    cu_offset = arange->di_offset;
+  } else if ((r = bsearch(&pc, f->pcranges, f->num_pcranges,
+          sizeof(*r), search_compare_pc_range))) {
+    /* the interval index has already been populated */
+    for (die = r->die; die->parent; die = die->parent) {
+      ;
+    }
+    if (!gimli_dwarf_die_get_uint64_t_attr(die, DW_AT_stmt_list, &stmt_list)) {
+      return 0;
+    }
+    return f->line_tables == NULL ||
+      !gimli_hash_find_u64(f->line_tables, stmt_list, NULL) ?
+      load_line_table(f, stmt_list) != NULL : 0;
+  } else {
+    /* no way to find the CU without decoding the lot; it's cheaper
+     * to decode all the line programs */
+    return gimli_dwarf_load_all_lines(f);
+  }
 
-    gimli_dwarf_die_get_uint64_t_attr(die,
-        DW_AT_low_pc, &comp_unit_base);
+  if (!cu_stmt_list(f, cu_offset, &stmt_list)) {
+    return 0;
+  }
+  if (f->line_tables && gimli_hash_find_u64(f->line_tables, stmt_list, NULL)) {
+    /* already loaded, and it didn't cover the pc */
+    return 0;
+  }
+  return load_line_table(f, stmt_list) != NULL;
+}
 
-    frame_base_attr = gimli_dwarf_die_get_attr(die, DW_AT_frame_base);
-    if (frame_base_attr) {
-      switch (frame_base_attr->form) {
-        case DW_FORM_block:
-          dw_eval_expr(&cur, (uint8_t*)frame_base_attr->ptr, frame_base_attr->code,
-              0, &frame_base, NULL, &is_stack);
-          break;
-        case DW_FORM_data8:
-          dw_calc_location(&cur, comp_unit_base, m,
-              frame_base_attr->code, &frame_base, NULL, &is_stack);
-          break;
-        default:
-          printf("Unhandled frame base form 0x%" PRIx64 "\n",
-              frame_base_attr->form);
-          return 0;
-      }
-    }
+/* read dwarf info to determine the source location for a given
+ * address */
+/* Determines the source location of pc, which lies in m.  If hint is
+ * not NULL, it remembers the line sequence we last found, so that a
+ * caller looking up nearby addresses in turn can usually skip the
+ * search for it */
+int gimli_source_location_near(gimli_proc_t proc,
+  struct gimli_object_mapping *m, gimli_addr_t pc,
+  struct gimli_line_hint *hint, struct gimli_source_location *loc)
+{
+  gimli_mapped_object_t f = m->objfile;
+  struct dw_line_seq **seqp, *seq = NULL;
+  struct dw_line_row row;
+  gimli_addr_t addr;
 
-    /* this is the die for the compilation unit; we need to walk
-     * through it and find the data it contains */
-    STAILQ_FOREACH(kid, &die->kids, siblings) {
-      uint64_t res = 0;
-      is_stack = 1;
-      struct gimli_dwarf_attr *location, *type, *name;
+  if (!f->elf) {
+    /* can happen if the original file has been removed from disk */
+    return 0;
+  }
 
-      if (kid->tag != DW_TAG_variable && kid->tag != DW_TAG_constant) {
-//        printf("skipping kid with tag 0x%" PRIx64 "\n", kid->tag);
-        continue;
-      }
+#ifdef __MACH__
+  addr = pc - f->base_addr;
+#else
+  addr = pc;
+  if (!gimli_object_is_executable(f->elf)) {
+    addr -= calc_reloc(f);
+  }
+#endif
 
-      location = gimli_dwarf_die_get_attr(kid, DW_AT_location);
-      if (!location) {
-        continue;
-      }
+  if (hint && hint->file == f) {
+    seq = hint->seq;
+    if (addr < seq->lo || addr >= seq->hi) {
+      seq = NULL;
+    }
+  }
 
-      switch (location->form) {
-        case DW_FORM_block:
-          if (!dw_eval_expr(&cur, (uint8_t*)location->ptr, location->code,
-                frame_base, &res, NULL, &is_stack)) {
-            res = 0;
-          }
-          break;
-        case DW_FORM_data8:
-          if (!dw_calc_location(&cur, comp_unit_base, m,
-                location->code, &res, NULL, &is_stack)) {
-            res = 0;
-          }
-          break;
-        default:
-          printf("Unhandled location form 0x%" PRIx64 "\n", location->form);
-          res = 0;
+  if (!seq) {
+    do {
+      seqp = bsearch(&addr, f->line_seqs, f->num_line_seqs,
+          sizeof(*seqp), search_compare_line_seq);
+      if (seqp) {
+        break;
       }
+    } while (load_lines_for_pc(m, pc));
 
-      if (res == addr) {
-        return kid;
-      }
+    if (!seqp) {
+      return 0;
+    }
+    seq = *seqp;
+    if (hint) {
+      hint->file = f;
+      hint->seq = seq;
     }
   }
 
-  /* no joy */
-  return NULL;
+  find_line_row(seq, addr, &row);
+  if (row.file == 0 || row.file >= seq->table->nfiles) {
+    return 0;
+  }
+
+  loc->filename = seq->table->files[row.file];
+  loc->lineno = row.line;
+  loc->column = row.column;
+  loc->is_stmt = row.is_stmt;
+  return 1;
 }
 
-/* attempt to locate a DW_TAG_variable or DW_TAG_constant die
- * corresponding to the provided data address.
- * We make this attempt using the debug_aranges data, but it
- * may not be successful, as gcc doesn't appear to generate
- * it for the data segment, despite the DWARF standard indicating
- * that it can be used in that fashion.
- * In that case, we have to fall back to crawling the CU data.
- * */
-static struct gimli_dwarf_die *gimli_dwarf_get_die_for_data(
-    gimli_proc_t proc, gimli_addr_t pc)
+int gimli_determine_source_location(gimli_proc_t proc,
+  gimli_addr_t pc, struct gimli_source_location *loc)
+{
+  struct gimli_object_mapping *m;
+
+  m = gimli_mapping_for_addr(proc, pc);
+  if (!m) {
+    return 0;
+  }
+  return gimli_source_location_near(proc, m, pc, NULL, loc);
+}
+
+int gimli_determine_source_line_number(gimli_proc_t proc,
+  gimli_addr_t pc, char *src, int srclen,
+  uint64_t *lineno)
+{
+  struct gimli_source_location loc;
+
+  if (!gimli_determine_source_location(proc, pc, &loc)) {
+    return 0;
+  }
+  snprintf(src, srclen, "%s", loc.filename);
+  *lineno = loc.lineno;
+  return 1;
+}
+
+/* Locate the leaf range for pc, indexing the CU that contains it
+ * if we haven't already done so */
+static struct dw_pc_range *find_pc_range(gimli_proc_t proc, gimli_addr_t pc)
 {
   struct gimli_object_mapping *m;
-  struct gimli_dwarf_cu *cu;
-  struct dw_die_arange *arange;
-  struct gimli_dwarf_die *die;
   gimli_mapped_object_t file;
-  const uint8_t *cuptr;
-  uint64_t off;
+  struct dw_pc_range *r;
+  struct dw_die_arange *arange;
+  struct dw_scan_item *items;
+  struct gimli_dwarf_cu *cu;
+  const uint8_t *start, *end;
+  int nitems, i;
 
   m = gimli_mapping_for_addr(proc, pc);
   if (!m) {
@@ -1571,120 +3002,111 @@ static struct gimli_dwarf_die *gimli_dwarf_get_die_for_data(
   if (!file->elf) {
     return NULL;
   }
-
-  if (!file->arange && !load_arange(m)) {
-    return NULL;
-  }
-#ifdef __MACH__
-  pc -= m->objfile->base_addr;
-#endif
-  arange = bsearch(&pc, file->arange, file->num_arange,
-      sizeof(*arange), search_compare_arange);
 #ifdef __MACH__
-  pc += m->objfile->base_addr;
+  pc -= file->base_addr;
 #endif
 
-  if (arange) {
+  r = bsearch(&pc, file->pcranges, file->num_pcranges,
+      sizeof(*r), search_compare_pc_range);
+  if (r || file->pcindex_complete) {
+    return r;
+  }
+
+  if (file->arange || load_arange(m)) {
+    arange = bsearch(&pc, file->arange, file->num_arange,
+        sizeof(*arange), search_compare_arange);
+    if (!arange) {
+//      printf("no arange for pc " PTRFMT "\n", pc);
+      return NULL;
+    }
     /* arange gives us a pointer to the CU */
     cu = find_cu(file, arange->di_offset);
     if (!cu) {
       cu = load_cu(file, arange->di_offset);
     }
-    if (cu) {
-      return find_var_die_for_addr(proc, m, cu, pc);
+    if (!cu || cu->pc_indexed) {
+      return NULL;
     }
-  }
-
-  cuptr = file->debug_info.start;
-  while (cuptr < file->debug_info.end) {
-    off = cuptr - file->debug_info.start;
-    cu = find_cu(file, off);
-    if (!cu) {
-      cu = load_cu(file, off);
+    index_cu_pcs(file, cu);
+  } else {
+    /* no .debug_aranges; the only way to find it is to index
+     * all of the CUs, so we may as well do that just the once */
+    file->pcindex_complete = 1;
+    if (!get_sect_data(file, ".debug_info", &start, &end, NULL)) {
+      return NULL;
     }
-    if (!cu) break;
-    cuptr = file->debug_info.start + cu->end;
-
-    die = find_var_die_for_addr(proc, m, cu, pc);
-    if (die) return die;
+    items = dw_scan_cus(file, NULL, NULL, &nitems);
+    for (i = 0; i < nitems; i++) {
+      if (items[i].cu) {
+        index_cu_pcs(file, items[i].cu);
+      }
+    }
+    free(items);
   }
 
-  return NULL;
+  return bsearch(&pc, file->pcranges, file->num_pcranges,
+      sizeof(*r), search_compare_pc_range);
 }
 
-struct gimli_dwarf_die *gimli_dwarf_get_die_for_pc(gimli_proc_t proc, gimli_addr_t pc)
+/* Returns the DIEs for the code at pc, innermost first.
+ * If the pc is in inlined code, the leading entries are the
+ * DW_TAG_inlined_subroutine DIEs and the last is the
+ * DW_TAG_subprogram into which they were inlined.
+ * Returns the number of entries populated */
+int gimli_dwarf_get_die_chain_for_pc(gimli_proc_t proc, gimli_addr_t pc,
+    struct gimli_dwarf_die **chain, int nchain)
 {
-  struct gimli_object_mapping *m;
-  struct gimli_dwarf_die *die, *kid;
-  struct gimli_dwarf_cu *cu;
-  struct dw_die_arange *arange;
+  struct dw_pc_range *r;
+  struct gimli_dwarf_die *die;
+  int n = 0;
 
-  m = gimli_mapping_for_addr(proc, pc);
-  if (!m) {
-    return NULL;
+  r = find_pc_range(proc, pc);
+  if (!r) {
+    return 0;
   }
 
-  if (!m->objfile->elf) {
-    return NULL;
+  for (die = r->die; die && n < nchain; die = die->parent) {
+    if (die->tag == DW_TAG_inlined_subroutine) {
+      chain[n++] = die;
+      continue;
+    }
+    if (die->tag == DW_TAG_subprogram) {
+      chain[n++] = die;
+      break;
+    }
   }
+  return n;
+}
 
-  if (!m->objfile->arange && !load_arange(m)) {
-    return NULL;
-  }
-#ifdef __MACH__
-  pc -= m->objfile->base_addr;
-#endif
+/* Returns the subprogram DIE that contains pc */
+struct gimli_dwarf_die *gimli_dwarf_get_die_for_pc(gimli_proc_t proc, gimli_addr_t pc)
+{
+  struct dw_pc_range *r;
+  struct gimli_dwarf_die *die;
 
-  arange = bsearch(&pc, m->objfile->arange, m->objfile->num_arange,
-      sizeof(*arange), search_compare_arange);
-  if (!arange) {
-//    printf("no arange for pc " PTRFMT "\n", pc);
-    return NULL;
-  }
-  /* arange gives us a pointer to the CU */
-  cu = find_cu(m->objfile, arange->di_offset);
-  if (!cu) {
-    cu = load_cu(m->objfile, arange->di_offset);
-  }
-  if (!cu) {
-//    printf("no CU for pc " PTRFMT " arange said off %" PRIx64 "\n", pc, arange->di_offset);
+  r = find_pc_range(proc, pc);
+  if (!r) {
     return NULL;
   }
-
-//  printf("got CU " PTRFMT " - " PTRFMT " arange said off %" PRIx64 "\n", cu->offset, cu->end, arange->di_offset);
-
-  STAILQ_FOREACH(die, &cu->dies, siblings) {
-    uint64_t lopc, hipc;
-
-    if (die->tag != DW_TAG_compile_unit) {
-      printf("DIE is not a compile unit!? tag=0x%" PRIx64 "\n", die->tag);
-      continue;
+  for (die = r->die; die; die = die->parent) {
+    if (die->tag == DW_TAG_subprogram) {
+      return die;
     }
+  }
+  return NULL;
+}
 
-    /* this is the die for the compilation unit; we need to walk
-     * through it and find the subprogram that matches */
-    STAILQ_FOREACH(kid, &die->kids, siblings) {
-      lopc = arange->addr;
-      hipc = arange->len;
-
-      if (kid->tag != DW_TAG_subprogram) {
-        continue;
-      }
-
-      if (!gimli_dwarf_die_get_uint64_t_attr(kid, DW_AT_low_pc, &lopc)) {
-        continue;
-      }
-      if (!gimli_dwarf_die_get_uint64_t_attr(kid, DW_AT_high_pc, &hipc)) {
-        continue;
-      }
+/* Resolve the name of a subprogram or inlined subroutine DIE,
+ * following its abstract origin or specification as needed */
+const char *gimli_dwarf_die_name(gimli_mapped_object_t file,
+    struct gimli_dwarf_die *die)
+{
+  struct gimli_dwarf_attr *attr;
 
-      if (pc >= lopc && pc <= hipc) {
-        return kid;
-      }
-    }
+  attr = die_get_attr_follow(file, die, DW_AT_name);
+  if (attr && attr->form == DW_FORM_string) {
+    return (const char*)attr->ptr;
   }
-
-  /* no joy */
   return NULL;
 }
 
@@ -2115,6 +3537,11 @@ static gimli_type_t load_type(
 {
   struct gimli_dwarf_die *die;
 
+  if (type->form == DW_FORM_ref_sig8) {
+    /* lives in .debug_types, which we don't read */
+    return NULL;
+  }
+
   die = gimli_dwarf_get_die(file, type->code);
   if (!die) {
     return NULL;
@@ -2155,30 +3582,25 @@ static void load_types_in_die(gimli_mapped_object_t file,
  * that we haven't already loaded */
 void gimli_dwarf_load_all_types(gimli_mapped_object_t file)
 {
-  struct gimli_dwarf_cu *cu;
   struct gimli_dwarf_die *die;
-  const uint8_t *cuptr;
-  uint64_t off;
+  struct dw_scan_item *items;
+  int nitems, i;
 
   if (!init_debug_info(file)) {
     return;
   }
 
-  cuptr = file->debug_info.start;
-  while (cuptr < file->debug_info.end) {
-    off = cuptr - file->debug_info.start;
-    cu = find_cu(file, off);
-    if (!cu) {
-      cu = load_cu(file, off);
+  /* decode in parallel, then map the types in CU order */
+  items = dw_scan_cus(file, NULL, NULL, &nitems);
+  for (i = 0; i < nitems; i++) {
+    if (!items[i].cu) {
+      continue;
     }
-    if (!cu) break;
-    cuptr = file->debug_info.start + cu->end;
-
-    /* now walk the DIEs and map the types */
-    STAILQ_FOREACH(die, &cu->dies, siblings) {
+    STAILQ_FOREACH(die, &items[i].cu->dies, siblings) {
       load_types_in_die(file, die);
     }
   }
+  free(items);
 }
 
 /* Locate the DIE for a data address and load its type
@@ -2199,7 +3621,7 @@ gimli_type_t gimli_dwarf_load_type_for_data(gimli_proc_t proc,
   m = gimli_mapping_for_addr(proc, addr);
   file = m->objfile;
 
-  type = gimli_dwarf_die_get_attr(die, DW_AT_type);
+  type = die_get_attr_follow(file, die, DW_AT_type);
   if (!type) {
     return NULL;
   }
@@ -2209,6 +3631,7 @@ gimli_type_t gimli_dwarf_load_type_for_data(gimli_proc_t proc,
 
 static void load_var(
     gimli_stack_frame_t frame,
+    struct gimli_unwind_cursor *cur,
     struct gimli_dwarf_die *die,
     uint64_t frame_base, uint64_t comp_unit_base,
     struct gimli_object_mapping *m)
@@ -2229,13 +3652,13 @@ static void load_var(
   if (location) {
     switch (location->form) {
       case DW_FORM_block:
-        if (!dw_eval_expr(&frame->cur, (uint8_t*)location->ptr, location->code,
+        if (!dw_eval_expr(cur, (uint8_t*)location->ptr, location->code,
               frame_base, &res, NULL, &is_stack)) {
           res = 0;
         }
         break;
       case DW_FORM_data8:
-        if (!dw_calc_location(&frame->cur, comp_unit_base, m,
+        if (!dw_calc_location(cur, comp_unit_base, m,
               location->code, &res, NULL, &is_stack)) {
           res = 0;
         }
@@ -2253,7 +3676,7 @@ static void load_var(
   var = calloc(1, sizeof(*var));
   var->varname = name ? name->ptr : NULL;
   var->addr = res;
-  var->proc = frame->cur.proc;
+  var->proc = cur->proc;
   var->type = load_type(m->objfile, type);
   var->is_param = (die->tag == DW_TAG_formal_parameter) ?
     GIMLI_WANT_PARAMS : GIMLI_WANT_LOCALS;
@@ -2264,13 +3687,14 @@ static void load_var(
 /* load DWARF DIEs to collect information about variables */
 int gimli_dwarf_load_frame_var_info(gimli_stack_frame_t frame)
 {
-  struct gimli_dwarf_die *die, *kid;
+  struct gimli_dwarf_die *die, *kid, *cu_die;
   uint64_t frame_base = 0;
   uint64_t comp_unit_base = 0;
   struct gimli_dwarf_attr *frame_base_attr;
   struct gimli_object_mapping *m;
-  gimli_proc_t proc = frame->cur.proc;
-  gimli_addr_t pc = (gimli_addr_t)frame->cur.st.pc;
+  struct gimli_unwind_cursor *cur;
+  gimli_proc_t proc = frame->trace->thr->proc;
+  gimli_addr_t pc = frame->pc;
 
   if (frame->loaded_vars) return 1;
   frame->loaded_vars = 1;
@@ -2281,10 +3705,19 @@ int gimli_dwarf_load_frame_var_info(gimli_stack_frame_t frame)
     return 0;
   }
   m = gimli_mapping_for_addr(proc, pc);
+  /* only now do we need the registers */
+  cur = gimli_stack_frame_cursor(frame);
+  if (!cur) {
+    return 0;
+  }
 
-  if (die->parent->tag == DW_TAG_compile_unit) {
-    gimli_dwarf_die_get_uint64_t_attr(die->parent,
-      DW_AT_low_pc, &comp_unit_base);
+  /* nested subprograms may be several levels down */
+  for (cu_die = die->parent; cu_die; cu_die = cu_die->parent) {
+    if (cu_die->tag == DW_TAG_compile_unit) {
+      gimli_dwarf_die_get_uint64_t_attr(cu_die,
+        DW_AT_low_pc, &comp_unit_base);
+      break;
+    }
   }
 
   frame_base_attr = gimli_dwarf_die_get_attr(die, DW_AT_frame_base);
@@ -2293,11 +3726,11 @@ int gimli_dwarf_load_frame_var_info(gimli_stack_frame_t frame)
 
     switch (frame_base_attr->form) {
       case DW_FORM_block:
-        dw_eval_expr(&frame->cur, (uint8_t*)frame_base_attr->ptr, frame_base_attr->code,
+        dw_eval_expr(cur, (uint8_t*)frame_base_attr->ptr, frame_base_attr->code,
             0, &frame_base, NULL, &is_stack);
         break;
       case DW_FORM_data8:
-        dw_calc_location(&frame->cur, comp_unit_base, m,
+        dw_calc_location(cur, comp_unit_base, m,
             frame_base_attr->code, &frame_base, NULL, &is_stack);
         break;
       default:
@@ -2309,7 +3742,7 @@ int gimli_dwarf_load_frame_var_info(gimli_stack_frame_t frame)
 
   STAILQ_FOREACH(kid, &die->kids, siblings) {
     if (kid->tag == DW_TAG_formal_parameter || kid->tag == DW_TAG_variable) {
-      load_var(frame, kid, frame_base, comp_unit_base, m);
+      load_var(frame, cur, kid, frame_base, comp_unit_base, m);
     }
   }
 
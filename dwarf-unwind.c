@@ -6,6 +6,13 @@
 #include "impl.h"
 #include "gimli_dwarf.h"
 
+/* DWARF column of the frame pointer */
+#if defined(__x86_64__)
+# define DW_FP_COL 6
+#elif defined(__i386__)
+# define DW_FP_COL 5
+#endif
+
 struct dw_rule_stack {
   struct gimli_dwarf_reg_column cols[GIMLI_MAX_DWARF_REGS];
   struct dw_rule_stack *next;
@@ -84,18 +91,25 @@ static void set_expr(struct gimli_unwind_cursor *cur,
   cur->dw.cols[colno].ops = ops;
 }
 
+/* Called with the rules in effect from loc up to the next location
+ * in the CFA rule table */
+typedef void (*dw_row_func_t)(void *arg, uint64_t loc,
+    struct gimli_unwind_cursor *cur);
+
 /* Here, pc is initially set to the program counter that corresponds
  * to the start of the dwarf instructions (the initial location).
  * As we process through the CFA rule table, we may advance the pc
  * forward (representing looking further down into the code for that
  * function).  There's no need to continue processing rules once we
  * pass the pc address of interest (cur->st.pc), so we break out of
- * the loop at that point */
+ * the loop at that point.
+ * If emit is not NULL, it is passed each row of the table as we go */
 static int process_dwarf_insns(struct gimli_unwind_cursor *cur,
     struct dw_cie *cie, struct dw_fde *fde, const uint8_t *insns,
-    const uint8_t *insn_end, uint64_t pc)
+    const uint8_t *insn_end, uint64_t pc, dw_row_func_t emit, void *emit_arg)
 {
   uint64_t regnum, arg;
+  uint64_t last = pc;
 
   if (debug) {
     fprintf(stderr,
@@ -106,6 +120,10 @@ static int process_dwarf_insns(struct gimli_unwind_cursor *cur,
     uint8_t op = (uint8_t)*insns;
     uint8_t oprand;
 
+    if (emit && pc != last) {
+      emit(emit_arg, last, cur);
+      last = pc;
+    }
     insns++;
     /* extract encoded operand */
     if (op & 0xc0) {
@@ -380,6 +398,10 @@ static int process_dwarf_insns(struct gimli_unwind_cursor *cur,
     }
   }
 
+  if (emit) {
+    emit(emit_arg, last, cur);
+  }
+
   return 1;
 }
 
@@ -546,6 +568,15 @@ static int apply_regs(struct gimli_unwind_cursor *cur,
     fprintf(stderr, "retaddr is in col %" PRIu64 "\n", cie->ret_addr);
   }
 
+  /* an undefined return address marks the outermost frame */
+  if (cie->ret_addr < GIMLI_DWARF_CFA_REG &&
+      cur->dw.cols[cie->ret_addr].rule == DW_RULE_UNDEF) {
+    if (debug) {
+      fprintf(stderr, "DWARF: return address is undefined\n");
+    }
+    return 0;
+  }
+
   regaddr = gimli_reg_addr(cur, cie->ret_addr);
   if (!regaddr) {
     fprintf(stderr, "DWARF: line %d: could not find address for return addr column %" PRIu64 "\n",
@@ -580,7 +611,8 @@ static int sort_compare_fde(const void *A, const void *B)
   struct dw_fde *a = (struct dw_fde*)A;
   struct dw_fde *b = (struct dw_fde*)B;
 
-  return a->initial_loc - b->initial_loc;
+  return a->initial_loc < b->initial_loc ? -1 :
+    a->initial_loc > b->initial_loc ? 1 : 0;
 }
 
 static void cie_delref(void *ptr)
@@ -590,6 +622,63 @@ static void cie_delref(void *ptr)
   free(cie);
 }
 
+/* The .eh_frame_hdr section, when present, holds a table of
+ * (initial_location, FDE address) pairs sorted by initial_location.
+ * Using it we can locate and decode just the FDE (and its CIE) that
+ * covers a given pc, rather than parsing all of .eh_frame up front.
+ * Decoded records are cached, keyed by the address of the record.
+ *
+ * When the backing file is available, the header and records are
+ * taken from its sections and addresses are in the address space of
+ * the file; bias converts those to run-time addresses.  Otherwise they
+ * are read from the target and bias is 0 */
+struct dw_eh_hdr {
+  const uint8_t *hdr, *hdr_end;
+  gimli_addr_t hdr_addr;
+  /* copy of the header, when read from the target */
+  uint8_t *hdr_copy;
+  const uint8_t *table;
+  uint64_t fde_count;
+  uint8_t table_enc;
+  int entry_size;
+  /* .eh_frame, if taken from the file */
+  struct gimli_section_data *eh_frame;
+  gimli_addr_t bias;
+  /* record address => struct dw_cie */
+  gimli_hash_t cies;
+  /* record address => struct dw_fde */
+  gimli_hash_t fdes;
+};
+
+/* The rules that apply at a given pc depend only on the pc, so
+ * the row computed by running the CIE and FDE programs is memoized
+ * per object for each pc we unwind through, across threads and
+ * traces.  Only columns with a rule are retained; expression rules
+ * refer to their bytecode in the CIE/FDE, which lives as long as the
+ * object does */
+struct dw_unwind_col {
+  int col;
+  struct gimli_dwarf_reg_column rule;
+};
+
+struct dw_unwind_row {
+  struct dw_fde *fde;
+  int ncols;
+  struct dw_unwind_col cols[1];
+};
+
+static void fde_free(void *ptr)
+{
+  struct dw_fde *fde = ptr;
+
+  cie_delref(fde->cie);
+  free(fde);
+}
+
+#ifdef DW_FP_COL
+static void free_compact_table(gimli_mapped_object_t file);
+#endif
+
 void gimli_dw_fde_destroy(gimli_mapped_object_t file)
 {
   int i;
@@ -599,6 +688,212 @@ void gimli_dw_fde_destroy(gimli_mapped_object_t file)
     cie_delref(file->fdes[i].cie);
   }
   free(file->fdes);
+
+  if (file->unwind_rows) {
+    gimli_hash_destroy(file->unwind_rows);
+  }
+#ifdef DW_FP_COL
+  free_compact_table(file);
+#endif
+
+  if (file->eh_hdr) {
+    gimli_hash_destroy(file->eh_hdr->fdes);
+    gimli_hash_destroy(file->eh_hdr->cies);
+    free(file->eh_hdr->hdr_copy);
+    free(file->eh_hdr);
+  }
+}
+
+/* Reads the length and CIE id/pointer that begin each CFI record.
+ * Returns the start of the following record */
+static const uint8_t *read_cfi_header(const uint8_t **datap,
+    int is_eh_frame, uint64_t *cie_id, int *is_64p)
+{
+  const uint8_t *data = *datap;
+  const uint8_t *next;
+  uint32_t len;
+  uint64_t initlen;
+  int is_64 = 0;
+
+  memcpy(&len, data, sizeof(len));
+  data += sizeof(len);
+  if (len == 0xffffffff) {
+    is_64 = 1;
+    memcpy(&initlen, data, sizeof(initlen));
+    data += sizeof(initlen);
+  } else {
+    initlen = len;
+  }
+  next = data + initlen;
+  if (is_64) {
+    memcpy(cie_id, data, sizeof(*cie_id));
+    data += sizeof(*cie_id);
+  } else {
+    memcpy(&len, data, sizeof(len));
+    data += sizeof(len);
+    *cie_id = len;
+    if (*cie_id == 0xffffffff && !is_eh_frame) {
+      *cie_id = 0xffffffffffffffffULL;
+    }
+  }
+  *is_64p = is_64;
+  *datap = data;
+  return next;
+}
+
+/* Parse the body of a CIE; eh_frame points just past the CIE id and
+ * next is the start of the following record.  eh_start is the start
+ * of the data containing the record and sect_addr is its address;
+ * these are used to resolve pc-relative values */
+static int parse_cie(gimli_proc_t proc, struct dw_cie *cie,
+    const uint8_t *eh_frame, const uint8_t *next,
+    const uint8_t *eh_start, uint64_t sect_addr)
+{
+  const uint8_t *end = next;
+  const uint8_t *aug;
+  uint8_t ver;
+
+  cie->code_enc = DW_EH_PE_absptr;
+  cie->lsda_enc = DW_EH_PE_omit;
+
+  memcpy(&ver, eh_frame, sizeof(ver));
+  eh_frame += sizeof(ver);
+  cie->aug = eh_frame;
+  eh_frame += strlen((char*)cie->aug) + 1;
+  if (cie->aug[0] == 'e' && cie->aug[1] == 'h') {
+    /* ignore GNU 'eh' augmentation data that immediately
+     * follows the augmentation string */
+    eh_frame += sizeof(void*);
+  }
+  cie->code_align = dw_read_uleb128(&eh_frame, end);
+  cie->data_align = dw_read_leb128(&eh_frame, end);
+  if (ver == 3) {
+    cie->ret_addr = dw_read_uleb128(&eh_frame, end);
+  } else {
+    uint8_t r;
+    memcpy(&r, eh_frame, sizeof(r));
+    eh_frame += sizeof(r);
+    cie->ret_addr = r;
+  }
+  cie->init_insns = eh_frame;
+  cie->insn_end = next;
+
+  aug = cie->aug;
+
+  /* read in augmentation information */
+  while (aug && *aug) {
+    if (*aug == 'e' && *aug == 'h') {
+      /* skip the 'eh' augmentation; already processed above */
+      aug += 2;
+    } else if (*aug == 'z') {
+      /* augmentation section size */
+      uint64_t o = dw_read_uleb128(&eh_frame, end);
+      cie->init_insns = eh_frame + o;
+    } else if (*aug == 'P') {
+      uint8_t enc;
+
+      memcpy(&enc, eh_frame, sizeof(enc));
+      eh_frame += sizeof(enc);
+
+      /* the personality routines tend to be indirectly encoded.
+       * Since we don't need them in our use case, let's turn off
+       * the override bit; we still need to consume the data, but
+       * we don't want to attempt the indirection */
+      enc &= ~ DW_EH_PE_indirect;
+
+      if (!dw_read_encptr(proc, enc, &eh_frame, end,
+            sect_addr + eh_frame - eh_start,
+            &cie->personality_routine)) {
+        fprintf(stderr, "Error reading personality routine, "
+            "enc=%02x offset: %lx\n", enc, eh_frame - eh_start);
+        return 0;
+      }
+    } else if (*aug == 'R') {
+      memcpy(&cie->code_enc, eh_frame, sizeof(cie->code_enc));
+      eh_frame += sizeof(cie->code_enc);
+    } else if (*aug == 'L') {
+      /* A 'L' may be present at any position after the first character
+       * of the string. This character may only be present if 'z' is the
+       * first character of the string. If present, it indicates the
+       * presence of one argument in the Augmentation Data of the CIE,
+       * and a corresponding argument in the Augmentation Data of the
+       * FDE. The argument in the Augmentation Data of the CIE is 1-byte
+       * and represents the pointer encoding used for the argument in the
+       * Augmentation Data of the FDE, which is the address of a
+       * language-specific data area (LSDA). The size of the LSDA pointer
+       * is specified by the pointer encoding used.
+       */
+      memcpy(&cie->lsda_enc, eh_frame, sizeof(cie->lsda_enc));
+      eh_frame += sizeof(cie->lsda_enc);
+    } else if (*aug == 'S') {
+      /* 'S' indicates a signal frame; we should not do the PC decrement
+       * operation on these frames (see big comment about architecture
+       * in apply_regs */
+      cie->is_signal_frame = 1;
+    }
+    aug++;
+  }
+
+  if (debug) {
+    fprintf(stderr, "\n\nReading CIE, ver=%d aug=%s\n"
+        "code_align=%jd data_align=%jd ret_addr=%ju init_insns=%p-%p\n",
+        ver, cie->aug,
+        cie->code_align, cie->data_align, cie->ret_addr,
+        cie->init_insns, cie->insn_end);
+  }
+  return 1;
+}
+
+/* Parse the body of an FDE whose CIE has already been resolved.
+ * Arguments are as for parse_cie; bias is added to the initial
+ * location to make it a run-time address */
+static int parse_fde(gimli_proc_t proc, struct dw_fde *fde,
+    const uint8_t *eh_frame, const uint8_t *next,
+    const uint8_t *eh_start, uint64_t sect_addr, gimli_addr_t bias)
+{
+  const uint8_t *end = next;
+
+  if (!dw_read_encptr(proc, fde->cie->code_enc, &eh_frame, end,
+        sect_addr + eh_frame - eh_start, &fde->initial_loc)) {
+    fprintf(stderr, "Error while reading initial loc\n");
+    return 0;
+  }
+
+  if (!dw_read_encptr(proc, fde->cie->code_enc & 0x0f, &eh_frame, end,
+        sect_addr + eh_frame - eh_start,
+        &fde->addr_range)) {
+    fprintf(stderr, "Error while reading addr_range\n");
+    return 0;
+  }
+  if (debug) {
+    fprintf(stderr, "FDE: addr_range raw=0x%" PRIx64 "\ninit_loc=%" PRIx64 " addr=0x%" PRIX64 "\n",
+        fde->addr_range,
+        fde->initial_loc,
+        sect_addr);
+  }
+  fde->initial_loc += bias;
+
+  if (fde->cie->aug[0] == 'z') {
+    /* skip the augmentation data; the LSDA pointer lives there */
+    uint64_t o = dw_read_uleb128(&eh_frame, end);
+    eh_frame += o;
+  }
+
+  if (debug) {
+    char name[1024];
+    const char *sym = gimli_pc_sym_name(
+        proc,
+        fde->initial_loc, name, sizeof(name));
+    fprintf(stderr, "FDE: init=" PTRFMT "-" PTRFMT " %s aug=%s\n",
+        fde->initial_loc,
+        (fde->initial_loc + fde->addr_range),
+        sym,
+        fde->cie->aug);
+  }
+
+  fde->insns = eh_frame;
+  fde->insn_end = next;
+  return 1;
 }
 
 /* read the FDE data from an object file */
@@ -665,10 +960,7 @@ static int load_fde(struct gimli_object_mapping *m)
     while (eh_frame && eh_frame < end) {
       uint32_t len;
       uint64_t cie_id;
-      const uint8_t *aug;
       int is_64 = 0;
-      uint64_t initlen;
-      const uint8_t *next;
       const uint8_t *recstart = eh_frame;
 
       if (debug) fprintf(stderr, "\noffset: 0x%" PRIx64 "\n", (uint64_t)(eh_frame - eh_start));
@@ -676,38 +968,17 @@ static int load_fde(struct gimli_object_mapping *m)
       if (len == 0 && is_eh_frame) {
         break;
       }
-      eh_frame += sizeof(len);
-      if (len == 0xffffffff) {
-        is_64 = 1;
-        memcpy(&initlen, eh_frame, sizeof(initlen));
-        eh_frame += sizeof(initlen);
-      } else {
-        is_64 = 0;
-        initlen = len;
-      }
-      next = eh_frame + initlen;
-      if (is_64) {
-        memcpy(&cie_id, eh_frame, sizeof(cie_id));
-        eh_frame += sizeof(cie_id);
-      } else {
-        memcpy(&len, eh_frame, sizeof(len));
-        eh_frame += sizeof(len);
-        cie_id = len;
-        if (cie_id == 0xffffffff) {
-          cie_id = 0xffffffffffffffffULL;
-        }
-      }
+      next = read_cfi_header(&eh_frame, is_eh_frame, &cie_id, &is_64);
       if (debug) {
         fprintf(stderr,
-            "initlen: 0x%" PRIx64 " (next = 0x%" PRIx64 ") is64=%d "
+            "next = 0x%" PRIx64 " is64=%d "
             "cie_id=0x%" PRIx64 " (%" PRIu64 ")\n",
-            initlen, (uint64_t)(next - eh_start),
+            (uint64_t)(next - eh_start),
             is_64,
             cie_id, cie_id);
       }
       if ((is_eh_frame && cie_id == 0) ||
           (!is_eh_frame && cie_id == 0xffffffffffffffffULL)) {
-        uint8_t ver;
         struct dw_cie *cie;
 
         /* this is a cie */
@@ -715,99 +986,9 @@ static int load_fde(struct gimli_object_mapping *m)
         cie->refcnt = 1;
         cie->ptr = (uint64_t)(recstart - eh_start);
 
-        if (sizeof(void*) == 8) {
-          cie->code_enc = DW_EH_PE_udata8;
-        } else if (sizeof(void*) == 4) {
-          cie->code_enc = DW_EH_PE_udata4;
-        }
-        cie->code_enc = DW_EH_PE_absptr;
-        cie->lsda_enc = DW_EH_PE_omit;
-
-        memcpy(&ver, eh_frame, sizeof(ver));
-        eh_frame += sizeof(ver);
-        cie->aug = eh_frame;
-        eh_frame += strlen((char*)cie->aug) + 1;
-        if (cie->aug[0] == 'e' && cie->aug[1] == 'h') {
-          /* ignore GNU 'eh' augmentation data that immediately
-           * follows the augmentation string */
-          eh_frame += sizeof(void*);
-        }
-        cie->code_align = dw_read_uleb128(&eh_frame, end);
-        cie->data_align = dw_read_leb128(&eh_frame, end);
-        if (ver == 3) {
-          cie->ret_addr = dw_read_uleb128(&eh_frame, end);
-        } else {
-          uint8_t r;
-          memcpy(&r, eh_frame, sizeof(r));
-          eh_frame += sizeof(r);
-          cie->ret_addr = r;
-        }
-        cie->init_insns = eh_frame;
-        cie->insn_end = next;
-
-        aug = cie->aug;
-
-        /* read in augmentation information */
-        while (aug && *aug) {
-          if (*aug == 'e' && *aug == 'h') {
-            /* skip the 'eh' augmentation; already processed above */
-            aug += 2;
-          } else if (*aug == 'z') {
-            /* augmentation section size */
-            uint64_t o = dw_read_uleb128(&eh_frame, end);
-            cie->init_insns = eh_frame + o;
-          } else if (*aug == 'P') {
-            uint8_t enc;
-
-            memcpy(&enc, eh_frame, sizeof(enc));
-            eh_frame += sizeof(enc);
-
-            /* the personality routines tend to be indirectly encoded.
-             * Since we don't need them in our use case, let's turn off
-             * the override bit; we still need to consume the data, but
-             * we don't want to attempt the indirection */
-            enc &= ~ DW_EH_PE_indirect;
-
-            if (!dw_read_encptr(m->proc, enc, &eh_frame, end,
-                  s->addr + eh_frame - eh_start,
-                  &cie->personality_routine)) {
-              fprintf(stderr, "Error reading personality routine, "
-                  "enc=%02x offset: %lx\n", enc, eh_frame - eh_start);
-              return 0;
-            }
-          } else if (*aug == 'R') {
-            memcpy(&cie->code_enc, eh_frame, sizeof(cie->code_enc));
-            eh_frame += sizeof(cie->code_enc);
-          } else if (*aug == 'L') {
-            /* A 'L' may be present at any position after the first character
-             * of the string. This character may only be present if 'z' is the
-             * first character of the string. If present, it indicates the
-             * presence of one argument in the Augmentation Data of the CIE,
-             * and a corresponding argument in the Augmentation Data of the
-             * FDE. The argument in the Augmentation Data of the CIE is 1-byte
-             * and represents the pointer encoding used for the argument in the
-             * Augmentation Data of the FDE, which is the address of a
-             * language-specific data area (LSDA). The size of the LSDA pointer
-             * is specified by the pointer encoding used.
-             */
-            memcpy(&cie->lsda_enc, eh_frame, sizeof(cie->lsda_enc));
-            eh_frame += sizeof(cie->lsda_enc);
-          } else if (*aug == 'S') {
-            /* 'S' indicates a signal frame; we should not do the PC decrement
-             * operation on these frames (see big comment about architecture
-             * in apply_regs */
-            cie->is_signal_frame = 1;
-          }
-          aug++;
-        }
-
-        if (debug) {
-          fprintf(stderr, "\n\nReading CIE, len is %ju, ver=%d aug=%s\n"
-              "code_align=%jd data_align=%jd ret_addr=%ju init_insns=%p-%p\n",
-              initlen, ver, cie->aug,
-              cie->code_align, cie->data_align, cie->ret_addr,
-              cie->init_insns, cie->insn_end);
-
+        if (!parse_cie(m->proc, cie, eh_frame, next, eh_start, s->addr)) {
+          free(cie);
+          return 0;
         }
 
         gimli_hash_insert_u64(cie_tbl, cie->ptr, cie);
@@ -835,40 +1016,10 @@ static int load_fde(struct gimli_object_mapping *m)
         }
         fde->cie->refcnt++;
 
-        if (!dw_read_encptr(m->proc, fde->cie->code_enc, &eh_frame, end,
-              s->addr + eh_frame - eh_start, &fde->initial_loc)) {
-          fprintf(stderr, "Error while reading initial loc\n");
+        if (!parse_fde(m->proc, fde, eh_frame, next, eh_start, s->addr,
+              m->objfile->base_addr)) {
           return 0;
         }
-
-        if (!dw_read_encptr(m->proc, fde->cie->code_enc & 0x0f, &eh_frame, end,
-              s->addr + eh_frame - eh_start,
-              &fde->addr_range)) {
-          fprintf(stderr, "Error while reading addr_range\n");
-          return 0;
-        }
-        if (debug) {
-          fprintf(stderr, "FDE: addr_range raw=0x%" PRIx64 "\ninit_loc=%" PRIx64 " addr=0x%" PRIX64 "\n",
-              fde->addr_range,
-              fde->initial_loc,
-              s->addr);
-        }
-        fde->initial_loc += m->objfile->base_addr;
-        if (debug) {
-          char name[1024];
-          const char *sym = gimli_pc_sym_name(
-              m->proc,
-              fde->initial_loc, name, sizeof(name));
-          fprintf(stderr, "FDE: init=" PTRFMT "-" PTRFMT " %s aug=%s\n",
-              fde->initial_loc,
-              (fde->initial_loc + fde->addr_range),
-              sym,
-              fde->cie->aug);
-        }
-
-        fde->insns = eh_frame;
-        fde->insn_end = next;
-
       }
       eh_frame = next;
     }
@@ -884,6 +1035,416 @@ static int load_fde(struct gimli_object_mapping *m)
   return 1;
 }
 
+/* Finds the FDEs that describe signal trampolines, which are those whose
+ * CIE carries the 'S' augmentation, and passes the pc range of each to
+ * func.  This walks the .eh_frame of the object, but only parses CIEs
+ * that are flagged for signal frames and the FDEs that refer to them,
+ * and it retains nothing */
+int gimli_dwarf_visit_signal_fdes(struct gimli_object_mapping *m,
+  void (*func)(void *arg, gimli_addr_t start, gimli_addr_t end), void *arg)
+{
+  struct gimli_section_data *s;
+  const uint8_t *eh_start, *eh_frame, *end, *next;
+  gimli_hash_t cie_tbl;
+  int found = 0;
+
+  if (!m->objfile->elf) {
+    return 0;
+  }
+  s = gimli_get_section_by_name(m->objfile->elf, ".eh_frame");
+  if ((!s || !s->data) && m->objfile->aux_elf) {
+    s = gimli_get_section_by_name(m->objfile->aux_elf, ".eh_frame");
+  }
+  if (!s || !s->data) {
+    return 0;
+  }
+
+  cie_tbl = gimli_hash_new_size(cie_delref, GIMLI_HASH_U64_KEYS, 0);
+  eh_start = s->data;
+  end = eh_start + s->size;
+
+  for (eh_frame = eh_start; eh_frame + sizeof(uint32_t) <= end;
+      eh_frame = next) {
+    uint32_t len;
+    uint64_t cie_id;
+    int is_64 = 0;
+    const uint8_t *recstart = eh_frame;
+
+    memcpy(&len, eh_frame, sizeof(len));
+    if (len == 0) {
+      break;
+    }
+    next = read_cfi_header(&eh_frame, 1, &cie_id, &is_64);
+    if (next > end) {
+      break;
+    }
+
+    if (cie_id == 0) {
+      struct dw_cie *cie;
+
+      /* the augmentation string follows the version byte */
+      if (!strchr((char*)eh_frame + 1, 'S')) {
+        continue;
+      }
+      cie = calloc(1, sizeof(*cie));
+      cie->refcnt = 1;
+      cie->ptr = (uint64_t)(recstart - eh_start);
+      if (!parse_cie(m->proc, cie, eh_frame, next, eh_start, s->addr)) {
+        free(cie);
+        continue;
+      }
+      gimli_hash_insert_u64(cie_tbl, cie->ptr, cie);
+    } else {
+      struct dw_fde fde;
+
+      memset(&fde, 0, sizeof(fde));
+      cie_id = (uint64_t)(eh_frame - eh_start) - cie_id;
+      cie_id -= is_64 ? 8 : 4;
+      if (!gimli_hash_find_u64(cie_tbl, cie_id, (void**)&fde.cie)) {
+        continue;
+      }
+      if (!parse_fde(m->proc, &fde, eh_frame, next, eh_start, s->addr,
+            m->objfile->base_addr)) {
+        continue;
+      }
+      func(arg, fde.initial_loc, fde.initial_loc + fde.addr_range);
+      found++;
+    }
+  }
+
+  gimli_hash_destroy(cie_tbl);
+  return found;
+}
+
+#ifndef __MACH__
+/* Read a complete CFI record at addr from the target into a buffer
+ * that follows prefix bytes of caller-owned space */
+static uint8_t *read_cfi_record(gimli_proc_t proc, gimli_addr_t addr,
+    size_t prefix, uint64_t *lenp)
+{
+  uint32_t len32;
+  uint64_t len, hdrlen = sizeof(len32);
+  uint8_t *buf;
+
+  if (gimli_read_mem(proc, addr, &len32, sizeof(len32)) != sizeof(len32)) {
+    return NULL;
+  }
+  if (len32 == 0xffffffff) {
+    if (gimli_read_mem(proc, addr + sizeof(len32), &len, sizeof(len))
+        != sizeof(len)) {
+      return NULL;
+    }
+    hdrlen += sizeof(len);
+  } else {
+    len = len32;
+  }
+  /* no sane record is this large */
+  if (len == 0 || len > 1024 * 1024) {
+    return NULL;
+  }
+  len += hdrlen;
+
+  buf = calloc(1, prefix + len);
+  if (gimli_read_mem(proc, addr, buf + prefix, len) != len) {
+    free(buf);
+    return NULL;
+  }
+  *lenp = len;
+  return buf;
+}
+
+/* Returns the CIE at addr (in the address space of the header),
+ * decoding it if needed */
+static struct dw_cie *eh_hdr_get_cie(gimli_proc_t proc,
+    struct dw_eh_hdr *eh, gimli_addr_t addr)
+{
+  struct dw_cie *cie;
+  const uint8_t *data, *next, *start;
+  uint64_t cie_id, len;
+  int is_64;
+
+  if (gimli_hash_find_u64(eh->cies, addr, (void**)&cie)) {
+    return cie;
+  }
+
+  if (eh->eh_frame) {
+    if (addr < eh->eh_frame->addr ||
+        addr >= eh->eh_frame->addr + eh->eh_frame->size) {
+      return NULL;
+    }
+    cie = calloc(1, sizeof(*cie));
+    start = eh->eh_frame->data;
+    data = start + (addr - eh->eh_frame->addr);
+    next = read_cfi_header(&data, 1, &cie_id, &is_64);
+    if (next > start + eh->eh_frame->size) {
+      free(cie);
+      return NULL;
+    }
+  } else {
+    /* the record is held in the same allocation as the CIE */
+    cie = (struct dw_cie*)read_cfi_record(proc, addr, sizeof(*cie), &len);
+    if (!cie) {
+      return NULL;
+    }
+    start = (uint8_t*)(cie + 1);
+    data = start;
+    next = read_cfi_header(&data, 1, &cie_id, &is_64);
+    if (next > start + len) {
+      free(cie);
+      return NULL;
+    }
+  }
+
+  if (cie_id != 0) {
+    free(cie);
+    return NULL;
+  }
+  cie->refcnt = 1;
+  cie->ptr = addr;
+  if (!parse_cie(proc, cie, data, next, start,
+        eh->eh_frame ? eh->eh_frame->addr : addr)) {
+    free(cie);
+    return NULL;
+  }
+  gimli_hash_insert_u64(eh->cies, addr, cie);
+
+  return cie;
+}
+
+/* Returns the FDE at addr (in the address space of the header),
+ * decoding it and its CIE if needed */
+static struct dw_fde *eh_hdr_get_fde(gimli_proc_t proc,
+    struct dw_eh_hdr *eh, gimli_addr_t addr)
+{
+  struct dw_fde *fde;
+  const uint8_t *data, *next, *start;
+  uint64_t cie_id, len;
+  gimli_addr_t sect_addr;
+  int is_64;
+
+  if (gimli_hash_find_u64(eh->fdes, addr, (void**)&fde)) {
+    return fde;
+  }
+
+  if (eh->eh_frame) {
+    if (addr < eh->eh_frame->addr ||
+        addr >= eh->eh_frame->addr + eh->eh_frame->size) {
+      return NULL;
+    }
+    fde = calloc(1, sizeof(*fde));
+    start = eh->eh_frame->data;
+    sect_addr = eh->eh_frame->addr;
+    data = start + (addr - sect_addr);
+    next = read_cfi_header(&data, 1, &cie_id, &is_64);
+    if (next > start + eh->eh_frame->size) {
+      free(fde);
+      return NULL;
+    }
+  } else {
+    /* the record is held in the same allocation as the FDE */
+    fde = (struct dw_fde*)read_cfi_record(proc, addr, sizeof(*fde), &len);
+    if (!fde) {
+      return NULL;
+    }
+    start = (uint8_t*)(fde + 1);
+    sect_addr = addr;
+    data = start;
+    next = read_cfi_header(&data, 1, &cie_id, &is_64);
+    if (next > start + len) {
+      free(fde);
+      return NULL;
+    }
+  }
+  if (cie_id == 0) {
+    /* the table pointed us at a CIE */
+    free(fde);
+    return NULL;
+  }
+
+  /* the CIE pointer is relative to its own location */
+  fde->cie = eh_hdr_get_cie(proc, eh,
+      sect_addr + (data - start) - cie_id - (is_64 ? 8 : 4));
+  if (!fde->cie) {
+    fprintf(stderr, "DWARF: could not resolve CIE for FDE at " PTRFMT "\n",
+        addr);
+    free(fde);
+    return NULL;
+  }
+  fde->cie->refcnt++;
+
+  if (!parse_fde(proc, fde, data, next, start, sect_addr, eh->bias)) {
+    fde_free(fde);
+    return NULL;
+  }
+  gimli_hash_insert_u64(eh->fdes, addr, fde);
+
+  return fde;
+}
+
+/* decode the value of table entry idx, field (0 for the initial
+ * location, 1 for the FDE address) */
+static gimli_addr_t eh_hdr_entry(struct dw_eh_hdr *eh, uint64_t idx, int field)
+{
+  const uint8_t *p = eh->table + (idx * eh->entry_size) +
+    (field * eh->entry_size / 2);
+  int64_t v;
+
+  switch (eh->table_enc & 0x0f) {
+    case DW_EH_PE_udata4:
+      {
+        uint32_t u;
+        memcpy(&u, p, sizeof(u));
+        v = u;
+        break;
+      }
+    case DW_EH_PE_sdata4:
+      {
+        int32_t s;
+        memcpy(&s, p, sizeof(s));
+        v = s;
+        break;
+      }
+    default:
+      memcpy(&v, p, sizeof(v));
+  }
+  return eh->hdr_addr + v;
+}
+
+/* Locate the eh_frame_hdr for an object, either from the file or
+ * from the target */
+static struct dw_eh_hdr *load_eh_hdr(struct gimli_object_mapping *m)
+{
+  gimli_mapped_object_t f = m->objfile;
+  struct gimli_section_data *s, *eh_frame = NULL;
+  struct dw_eh_hdr *eh;
+  const uint8_t *hdr, *data;
+  uint8_t *copy = NULL;
+  gimli_addr_t hdr_addr, bias, base = 0;
+  uint64_t size, eh_frame_ptr;
+  uint8_t ver, eh_frame_ptr_enc, fde_count_enc, table_enc;
+  int i;
+
+  if (f->elf) {
+    if (!f->elf->eh_frame_hdr) {
+      return NULL;
+    }
+    s = gimli_get_section_by_name(f->elf, ".eh_frame_hdr");
+    if (!s || !s->data || s->addr != f->elf->eh_frame_hdr) {
+      return NULL;
+    }
+    eh_frame = gimli_get_section_by_name(f->elf, ".eh_frame");
+    if (!eh_frame || !eh_frame->data) {
+      return NULL;
+    }
+    hdr = s->data;
+    size = s->size;
+    hdr_addr = s->addr;
+    bias = f->base_addr;
+  } else {
+    /* no file; we may still be able to find it in memory via the
+     * program headers of the image */
+    for (i = 0; i < m->proc->nmaps; i++) {
+      struct gimli_object_mapping *om = m->proc->mappings[i];
+
+      if (om->objfile == f && om->offset == 0 &&
+          (base == 0 || om->base < base)) {
+        base = om->base;
+      }
+    }
+    if (!base ||
+        !gimli_elf_find_eh_frame_hdr(m->proc, base, &hdr_addr, &size) ||
+        size < 4 || size > 64 * 1024 * 1024) {
+      return NULL;
+    }
+    copy = malloc(size);
+    if (gimli_read_mem(m->proc, hdr_addr, copy, size) != size) {
+      free(copy);
+      return NULL;
+    }
+    hdr = copy;
+    bias = 0;
+  }
+
+  data = hdr;
+  ver = *data++;
+  eh_frame_ptr_enc = *data++;
+  fde_count_enc = *data++;
+  table_enc = *data++;
+
+  /* we can only binary search fixed size, header relative entries */
+  if (ver != 1 || fde_count_enc == DW_EH_PE_omit ||
+      (table_enc & DW_EH_PE_APPL_MASK) != DW_EH_PE_datarel ||
+      ((table_enc & 0x0f) != DW_EH_PE_udata4 &&
+       (table_enc & 0x0f) != DW_EH_PE_sdata4 &&
+       (table_enc & 0x0f) != DW_EH_PE_udata8 &&
+       (table_enc & 0x0f) != DW_EH_PE_sdata8)) {
+    free(copy);
+    return NULL;
+  }
+
+  eh = calloc(1, sizeof(*eh));
+  eh->hdr = hdr;
+  eh->hdr_end = hdr + size;
+  eh->hdr_addr = hdr_addr;
+  eh->hdr_copy = copy;
+  eh->eh_frame = eh_frame;
+  eh->bias = bias;
+  eh->table_enc = table_enc;
+  eh->entry_size = ((table_enc & 0x0f) == DW_EH_PE_udata4 ||
+      (table_enc & 0x0f) == DW_EH_PE_sdata4) ? 8 : 16;
+
+  if (!dw_read_encptr(m->proc, eh_frame_ptr_enc, &data, eh->hdr_end,
+        hdr_addr + (data - hdr), &eh_frame_ptr) ||
+      !dw_read_encptr(m->proc, fde_count_enc, &data, eh->hdr_end,
+        hdr_addr + (data - hdr), &eh->fde_count) ||
+      data + (eh->fde_count * eh->entry_size) > eh->hdr_end) {
+    free(copy);
+    free(eh);
+    return NULL;
+  }
+  eh->table = data;
+  eh->cies = gimli_hash_new_size(cie_delref, GIMLI_HASH_U64_KEYS, 0);
+  eh->fdes = gimli_hash_new_size(fde_free, GIMLI_HASH_U64_KEYS, 0);
+
+  if (debug) {
+    fprintf(stderr, "Using eh_frame_hdr for %s: %" PRIu64 " FDEs\n",
+        f->objname, eh->fde_count);
+  }
+
+  return eh;
+}
+
+/* Find the FDE covering pc via the eh_frame_hdr table */
+static struct dw_fde *eh_hdr_find_fde(gimli_proc_t proc,
+    struct dw_eh_hdr *eh, gimli_addr_t pc)
+{
+  uint64_t lo = 0, hi = eh->fde_count, mid;
+  gimli_addr_t rel = pc - eh->bias;
+  struct dw_fde *fde;
+
+  if (!eh->fde_count || rel < eh_hdr_entry(eh, 0, 0)) {
+    return NULL;
+  }
+
+  /* last entry whose initial location is at or before pc */
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if (eh_hdr_entry(eh, mid, 0) <= rel) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  fde = eh_hdr_get_fde(proc, eh, eh_hdr_entry(eh, lo, 1));
+  if (fde && pc >= fde->initial_loc &&
+      pc < fde->initial_loc + fde->addr_range) {
+    return fde;
+  }
+  return NULL;
+}
+#endif
+
 static int search_compare_fde(const void *PC, const void *FDE)
 {
   intptr_t pc = (intptr_t)*(void**)PC;
@@ -903,22 +1464,48 @@ static int search_compare_fde(const void *PC, const void *FDE)
 static struct dw_fde *find_fde(gimli_proc_t proc, void *pc)
 {
   struct gimli_object_mapping *m;
+  gimli_mapped_object_t f;
   struct dw_fde *fde;
 
   m = gimli_mapping_for_addr(proc, (gimli_addr_t)pc);
   if (!m) {
     return NULL;
   }
+  f = m->objfile;
+
+#ifndef __MACH__
+  /* prefer to locate FDEs on demand, unless we've already had to
+   * load them all */
+  if (!f->fdes) {
+    if (!f->eh_hdr_tried) {
+      f->eh_hdr_tried = 1;
+      f->eh_hdr = load_eh_hdr(m);
+    }
+    if (f->eh_hdr) {
+      fde = eh_hdr_find_fde(proc, f->eh_hdr, (gimli_addr_t)pc);
+      if (fde) {
+        return fde;
+      }
+      /* the table only covers .eh_frame; the pc may be described
+       * by .debug_frame, in which case we need the full parse */
+      if (!f->elf || (!gimli_get_section_by_name(f->elf, ".debug_frame") &&
+            (!f->aux_elf ||
+             !gimli_get_section_by_name(f->aux_elf, ".debug_frame")))) {
+        return NULL;
+      }
+    }
+  }
+#endif
 
-  if (!m->objfile->elf) {
+  if (!f->elf) {
     return NULL;
   }
 
-  if (!m->objfile->fdes && !load_fde(m)) {
+  if (!f->fdes && !load_fde(m)) {
     return NULL;
   }
 
-  fde = bsearch(&pc, m->objfile->fdes, m->objfile->num_fdes, sizeof(*fde), search_compare_fde);
+  fde = bsearch(&pc, f->fdes, f->num_fdes, sizeof(*fde), search_compare_fde);
   if (fde) {
     return fde;
   }
@@ -926,8 +1513,365 @@ static struct dw_fde *find_fde(gimli_proc_t proc, void *pc)
   return NULL;
 }
 
+/* the CFA offset column carries its value with an UNDEF rule */
+#define UNWIND_COL_IS_SET(c) \
+  ((c)->rule != DW_RULE_UNDEF || (c)->value || (c)->ops)
+
+static void save_unwind_row(gimli_mapped_object_t f, gimli_addr_t pc,
+    struct dw_fde *fde, struct gimli_unwind_cursor *cur)
+{
+  struct dw_unwind_row *row;
+  int i, n = 0;
+
+  for (i = 0; i < GIMLI_MAX_DWARF_REGS; i++) {
+    if (UNWIND_COL_IS_SET(&cur->dw.cols[i])) {
+      n++;
+    }
+  }
+
+  row = malloc(sizeof(*row) + (n ? n - 1 : 0) * sizeof(row->cols[0]));
+  row->fde = fde;
+  row->ncols = 0;
+  for (i = 0; i < GIMLI_MAX_DWARF_REGS; i++) {
+    if (UNWIND_COL_IS_SET(&cur->dw.cols[i])) {
+      row->cols[row->ncols].col = i;
+      row->cols[row->ncols].rule = cur->dw.cols[i];
+      row->ncols++;
+    }
+  }
+
+  if (!f->unwind_rows) {
+    f->unwind_rows = gimli_hash_new_size(free, GIMLI_HASH_U64_KEYS, 0);
+  }
+  gimli_hash_insert_u64(f->unwind_rows, pc, row);
+}
+
+/* populates the cursor with the cached rules for pc, returning the
+ * corresponding FDE, or NULL if they are not cached */
+static struct dw_fde *load_unwind_row(gimli_mapped_object_t f,
+    gimli_addr_t pc, struct gimli_unwind_cursor *cur)
+{
+  struct dw_unwind_row *row;
+  int i;
+
+  if (!f->unwind_rows ||
+      !gimli_hash_find_u64(f->unwind_rows, pc, (void**)&row)) {
+    f->unwind_misses++;
+    return NULL;
+  }
+  f->unwind_hits++;
+
+  memset(&cur->dw, 0, sizeof(cur->dw));
+  for (i = 0; i < row->ncols; i++) {
+    cur->dw.cols[row->cols[i].col] = row->cols[i].rule;
+  }
+  return row->fde;
+}
+
+static gimli_iter_status_t sum_unwind_stats(const char *k, int klen,
+    void *item, void *arg)
+{
+  gimli_mapped_object_t f = item;
+  uint64_t *counts = arg;
+
+  counts[0] += f->unwind_hits;
+  counts[1] += f->unwind_misses;
+  return GIMLI_ITER_CONT;
+}
+
+/* Reports how effective the unwind row cache has been */
+void gimli_dwarf_unwind_cache_stats(gimli_proc_t proc,
+    uint64_t *hits, uint64_t *misses)
+{
+  uint64_t counts[2] = { 0, 0 };
+
+  gimli_hash_iter(proc->files, sum_unwind_stats, counts);
+  *hits = counts[0];
+  *misses = counts[1];
+}
+
+#ifdef DW_FP_COL
+/* The compact unwind table is an alternative to interpreting the CFA
+ * programs, generated from the FDEs of an object the first time it is
+ * needed.  It has one entry for each distinct row of the CFA rule
+ * table, sorted by pc.  An entry records the CFA as a register plus
+ * offset and the CFA relative locations of the return address and the
+ * frame pointer.  Unwinding through such a frame is then a handful of
+ * loads and adds.  Rows that can't be expressed this way (CFA or
+ * return address computed by expression, signal frames and so on)
+ * are flagged so that we fall back to the DWARF interpreter.
+ *
+ * Only the pc, CFA and frame pointer are recovered by the compact
+ * form, so other callee saved registers are not available to the
+ * caller frames.  That makes it suitable for sampling and repeated
+ * tracing, but not for rendering variables, and so it is only used
+ * if gimli_compact_unwind is set */
+
+/* the rules can't be expressed compactly */
+#define DW_COMPACT_FULL     1
+/* the frame pointer was saved at fp_off from the CFA */
+#define DW_COMPACT_FP_SAVED 2
+/* no FDE covers this pc */
+#define DW_COMPACT_GAP      4
+
+struct dw_compact_row {
+  /* first pc covered by the row, relative to the table base */
+  uint32_t pc;
+  int32_t cfa_off;
+  int16_t ra_off;
+  int16_t fp_off;
+  uint8_t cfa_reg;
+  uint8_t ra_col;
+  uint8_t flags;
+};
+
+struct dw_compact_table {
+  gimli_addr_t base;
+  struct dw_compact_row *rows;
+  uint32_t nrows, alloc;
+};
+
+struct dw_compact_build {
+  struct dw_compact_table *t;
+  struct dw_cie *cie;
+};
+
+static void compact_add_row(struct dw_compact_table *t,
+    struct dw_compact_row *row)
+{
+  struct dw_compact_row *prev;
+
+  if (t->nrows) {
+    prev = &t->rows[t->nrows - 1];
+    if (prev->pc == row->pc) {
+      /* the later row supersedes it */
+      t->nrows--;
+    } else if (prev->cfa_off == row->cfa_off &&
+        prev->ra_off == row->ra_off && prev->fp_off == row->fp_off &&
+        prev->cfa_reg == row->cfa_reg && prev->ra_col == row->ra_col &&
+        prev->flags == row->flags) {
+      /* no change */
+      return;
+    }
+  }
+
+  if (t->nrows + 1 >= t->alloc) {
+    t->alloc = t->alloc ? t->alloc * 2 : 1024;
+    t->rows = realloc(t->rows, t->alloc * sizeof(*row));
+  }
+  t->rows[t->nrows++] = *row;
+}
+
+static void compact_emit(void *arg, uint64_t loc,
+    struct gimli_unwind_cursor *cur)
+{
+  struct dw_compact_build *b = arg;
+  struct gimli_dwarf_reg_column *cols = cur->dw.cols;
+  struct dw_compact_row row;
+  int64_t off;
+
+  memset(&row, 0, sizeof(row));
+  row.pc = loc - b->t->base;
+
+  off = (int64_t)cols[GIMLI_DWARF_CFA_OFF].value;
+  if (b->cie->is_signal_frame ||
+      cols[GIMLI_DWARF_CFA_REG].rule != DW_RULE_REG ||
+      cols[GIMLI_DWARF_CFA_REG].value >= GIMLI_DWARF_CFA_REG ||
+      off != (int32_t)off) {
+    row.flags = DW_COMPACT_FULL;
+    compact_add_row(b->t, &row);
+    return;
+  }
+  row.cfa_reg = cols[GIMLI_DWARF_CFA_REG].value;
+  row.cfa_off = off;
+
+  off = (int64_t)cols[b->cie->ret_addr].value;
+  if (b->cie->ret_addr >= GIMLI_DWARF_CFA_REG ||
+      cols[b->cie->ret_addr].rule != DW_RULE_OFFSET ||
+      off != (int16_t)off) {
+    row.flags = DW_COMPACT_FULL;
+    compact_add_row(b->t, &row);
+    return;
+  }
+  row.ra_off = off;
+  row.ra_col = b->cie->ret_addr;
+
+  off = (int64_t)cols[DW_FP_COL].value;
+  switch (cols[DW_FP_COL].rule) {
+    case DW_RULE_UNDEF:
+    case DW_RULE_SAME:
+      break;
+    case DW_RULE_OFFSET:
+      if (off == (int16_t)off) {
+        row.flags |= DW_COMPACT_FP_SAVED;
+        row.fp_off = off;
+        break;
+      }
+      /* fall through */
+    default:
+      row.flags = DW_COMPACT_FULL;
+  }
+  compact_add_row(b->t, &row);
+}
+
+/* Generate the compact table from all of the FDEs of an object */
+static struct dw_compact_table *build_compact_table(
+    struct gimli_object_mapping *m)
+{
+  gimli_mapped_object_t f = m->objfile;
+  struct dw_compact_table *t;
+  struct dw_compact_build b;
+  struct gimli_unwind_cursor cur;
+  struct dw_compact_row gap;
+  struct dw_fde *fde;
+  uint32_t i;
+
+  if (!f->fdes && !load_fde(m)) {
+    return NULL;
+  }
+  if (!f->num_fdes) {
+    return NULL;
+  }
+
+  t = calloc(1, sizeof(*t));
+  t->base = f->fdes[0].initial_loc;
+  b.t = t;
+
+  for (i = 0; i < f->num_fdes; i++) {
+    fde = &f->fdes[i];
+
+    if (fde->initial_loc + fde->addr_range - t->base > UINT32_MAX) {
+      break;
+    }
+
+    memset(&cur, 0, sizeof(cur));
+    cur.proc = m->proc;
+    cur.st.pc = (void*)(intptr_t)(fde->initial_loc + fde->addr_range - 1);
+    b.cie = fde->cie;
+
+    fde->cie->rule_stack = NULL;
+    if (!process_dwarf_insns(&cur, fde->cie, fde,
+          fde->cie->init_insns, fde->cie->insn_end, fde->initial_loc,
+          NULL, NULL)) {
+      continue;
+    }
+    memcpy(fde->cie->init_cols, cur.dw.cols, sizeof(fde->cie->init_cols));
+    if (!process_dwarf_insns(&cur, fde->cie, fde, fde->insns, fde->insn_end,
+          fde->initial_loc, compact_emit, &b)) {
+      continue;
+    }
+
+    /* terminate the range covered by this FDE; if the next one
+     * starts here, its first row will replace this one */
+    memset(&gap, 0, sizeof(gap));
+    gap.pc = fde->initial_loc + fde->addr_range - t->base;
+    gap.flags = DW_COMPACT_GAP;
+    compact_add_row(t, &gap);
+  }
+
+  if (debug) {
+    fprintf(stderr, "DWARF: %s: compact unwind table has %u rows for %u FDEs\n",
+        f->objname, t->nrows, f->num_fdes);
+  }
+
+  return t;
+}
+
+static void free_compact_table(gimli_mapped_object_t file)
+{
+  if (file->compact) {
+    free(file->compact->rows);
+    free(file->compact);
+  }
+}
+
+/* Attempt to unwind the frame at cur using the compact table.
+ * Returns 0 if the frame needs the DWARF interpreter */
+static int compact_unwind_next(struct gimli_unwind_cursor *cur)
+{
+  struct gimli_object_mapping *m;
+  gimli_mapped_object_t f;
+  struct dw_compact_table *t;
+  struct dw_compact_row *row;
+  gimli_addr_t pc = (gimli_addr_t)cur->st.pc;
+  gimli_addr_t cfa, ra, fp;
+  uint32_t lo, hi, mid;
+  void *regaddr;
+
+  m = gimli_mapping_for_addr(cur->proc, pc);
+  if (!m) {
+    return 0;
+  }
+  f = m->objfile;
+  if (!f->compact_tried) {
+    f->compact_tried = 1;
+    f->compact = build_compact_table(m);
+  }
+  t = f->compact;
+  if (!t || !t->nrows || pc < t->base ||
+      pc - t->base > UINT32_MAX || pc - t->base < t->rows[0].pc) {
+    return 0;
+  }
+
+  /* last row starting at or before pc */
+  lo = 0;
+  hi = t->nrows;
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if (t->rows[mid].pc <= pc - t->base) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  row = &t->rows[lo];
+  if (row->flags & (DW_COMPACT_FULL|DW_COMPACT_GAP)) {
+    return 0;
+  }
+
+  regaddr = gimli_reg_addr(cur, row->cfa_reg);
+  if (!regaddr) {
+    return 0;
+  }
+  cfa = *(gimli_addr_t*)regaddr + row->cfa_off;
+
+  if (gimli_read_mem(cur->proc, cfa + row->ra_off, &ra, sizeof(ra))
+      != sizeof(ra)) {
+    return 0;
+  }
+  if (row->flags & DW_COMPACT_FP_SAVED) {
+    if (gimli_read_mem(cur->proc, cfa + row->fp_off, &fp, sizeof(fp))
+        != sizeof(fp)) {
+      return 0;
+    }
+  }
+
+  /* a bogus return address is best left for the interpreter, which
+   * needs the registers as we found them */
+  if (!gimli_mapping_for_addr(cur->proc, ra)) {
+    return 0;
+  }
+
+  if (row->flags & DW_COMPACT_FP_SAVED) {
+    *(gimli_addr_t*)gimli_reg_addr(cur, DW_FP_COL) = fp;
+  }
+  regaddr = gimli_reg_addr(cur, row->ra_col);
+  if (regaddr) {
+    *(gimli_addr_t*)regaddr = ra;
+  }
+  cur->st.fp = (void*)(intptr_t)cfa;
+  cur->st.pc = (void*)(intptr_t)ra;
+  /* see the commentary at the end of apply_regs */
+  if (cur->st.pc && !gimli_is_signal_frame(cur)) {
+    cur->st.pc--;
+  }
+  return 1;
+}
+#endif
+
 int gimli_dwarf_unwind_next(struct gimli_unwind_cursor *cur)
 {
+  struct gimli_object_mapping *m;
   struct dw_fde *fde;
 
   /* can't unwind via dwarf if don't have a valid register set */
@@ -940,6 +1884,24 @@ int gimli_dwarf_unwind_next(struct gimli_unwind_cursor *cur)
         cur->st.pc, cur->st.fp);
   }
 
+#ifdef DW_FP_COL
+  if (gimli_compact_unwind && compact_unwind_next(cur)) {
+    cur->method = GIMLI_UNWIND_METHOD_COMPACT;
+    return 1;
+  }
+#endif
+
+  m = gimli_mapping_for_addr(cur->proc, (gimli_addr_t)cur->st.pc);
+  if (!m) {
+    cur->dwarffail = 1;
+    return 0;
+  }
+
+  fde = load_unwind_row(m->objfile, (gimli_addr_t)cur->st.pc, cur);
+  if (fde) {
+    goto apply;
+  }
+
   fde = find_fde(cur->proc, cur->st.pc);
   if (!fde) {
     cur->dwarffail = 1;
@@ -963,7 +1925,8 @@ int gimli_dwarf_unwind_next(struct gimli_unwind_cursor *cur)
   fde->cie->rule_stack = NULL;
 
   if (!process_dwarf_insns(cur, fde->cie, fde,
-        fde->cie->init_insns, fde->cie->insn_end, fde->initial_loc)) {
+        fde->cie->init_insns, fde->cie->insn_end, fde->initial_loc,
+        NULL, NULL)) {
     if (debug) {
       fprintf(stderr, "DWARF: unwind: failed to run init instructions\n");
     }
@@ -975,13 +1938,16 @@ int gimli_dwarf_unwind_next(struct gimli_unwind_cursor *cur)
 
   /* walk up the stack using the fde rules */
   if (!process_dwarf_insns(cur, fde->cie, fde, fde->insns, fde->insn_end,
-        fde->initial_loc)) {
+        fde->initial_loc, NULL, NULL)) {
     if (debug) {
       fprintf(stderr,
           "DWARF: unwind: failed to run unwind instructions\n");
     }
     return 0;
   }
+  save_unwind_row(m->objfile, (gimli_addr_t)cur->st.pc, fde, cur);
+
+apply:
   /* map the regs back into the cursor */
   if (!apply_regs(cur, fde->cie)) {
     if (debug) {
@@ -1004,6 +1970,7 @@ int gimli_dwarf_unwind_next(struct gimli_unwind_cursor *cur)
   }
 
   cur->dwarffail = 0;
+  cur->method = GIMLI_UNWIND_METHOD_DWARF;
 
   return 1;
 }
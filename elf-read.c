@@ -138,6 +138,22 @@ static struct gimli_elf_shdr *gimli_get_elf_section_by_name(struct gimli_elf_ehd
   return NULL;
 }
 
+/* Reads len bytes at offset off in the object, which is either backed
+ * by a file or by an image that was copied out of the target */
+static int elf_read_at(struct gimli_elf_ehdr *elf, uint64_t off,
+  void *buf, uint64_t len)
+{
+  if (elf->image) {
+    if (off > elf->image_size || len > elf->image_size - off) {
+      errno = EINVAL;
+      return 0;
+    }
+    memcpy(buf, elf->image + off, len);
+    return 1;
+  }
+  return pread(elf->fd, buf, len, off) == len;
+}
+
 static const char *gimli_get_section_data(struct gimli_elf_ehdr *elf, int section)
 {
   struct gimli_elf_shdr *s;
@@ -148,13 +164,7 @@ static const char *gimli_get_section_data(struct gimli_elf_ehdr *elf, int sectio
   if (!s->data) {
     s->data = malloc(s->sh_size);
     if (!s->data) return NULL;
-    if (lseek(s->elf->fd, s->sh_offset, SEEK_SET) != s->sh_offset) {
-      fprintf(stderr, "ELF: failed to seek: %s\n", strerror(errno));
-      free(s->data);
-      s->data = NULL;
-      return NULL;
-    }
-    if (read(s->elf->fd, s->data, s->sh_size) != s->sh_size) {
+    if (!elf_read_at(s->elf, s->sh_offset, s->data, s->sh_size)) {
       fprintf(stderr, "ELF: failed to read: %s\n", strerror(errno));
       free(s->data);
       s->data = NULL;
@@ -212,30 +222,57 @@ void gimli_object_file_destroy(struct gimli_elf_ehdr *elf)
   if (elf->fd >= 0) {
     close(elf->fd);
   }
+  free(elf->image);
   free(elf->objname);
   free(elf);
 }
 
+static struct gimli_elf_ehdr *elf_load(struct gimli_elf_ehdr *elf,
+  const char *filename);
+
 struct gimli_elf_ehdr *gimli_elf_open(const char *filename)
 {
   struct gimli_elf_ehdr *elf = calloc(1, sizeof(*elf));
-  unsigned char ident[16];
-  int i;
-  struct gimli_elf_shdr *s;
 
   elf->fd = open(filename, O_RDONLY);
   if (elf->fd == -1) {
     free(elf);
     return 0;
   }
+  return elf_load(elf, filename);
+}
 
-  STAILQ_INIT(&elf->sections);
+/* Opens an ELF image that is held in memory, such as the vDSO copied
+ * out of the target.  Takes ownership of image */
+struct gimli_elf_ehdr *gimli_elf_open_image(const char *name,
+  uint8_t *image, uint64_t size)
+{
+  struct gimli_elf_ehdr *elf = calloc(1, sizeof(*elf));
+
+  elf->fd = -1;
+  elf->image = image;
+  elf->image_size = size;
+  return elf_load(elf, name);
+}
+
+static struct gimli_elf_ehdr *elf_load(struct gimli_elf_ehdr *elf,
+  const char *filename)
+{
+  unsigned char ident[16];
+  int i;
+  int seen_load = 0;
+  struct gimli_elf_shdr *s;
 
-  read(elf->fd, ident, sizeof(ident));
+  STAILQ_INIT(&elf->sections);
 
-  if (memcmp(ident, GIMLI_EI_ELF_MAGIC, 4)) {
+  if (!elf_read_at(elf, 0, ident, sizeof(ident)) ||
+      memcmp(ident, GIMLI_EI_ELF_MAGIC, 4)) {
 closeout:
-    close(elf->fd);
+    if (elf->fd >= 0) {
+      close(elf->fd);
+    }
+    free(elf->image);
+    free(elf->objname);
     free(elf);
     return 0;
   }
@@ -273,7 +310,7 @@ closeout:
   if (elf->ei_class == GIMLI_ELFCLASS32) {
     struct elf32_ehdr hdr;
 
-    if (read(elf->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+    if (!elf_read_at(elf, sizeof(ident), &hdr, sizeof(hdr))) {
       fprintf(stderr, "ELF: %s: error reading EHDR: %s\n",
         filename, strerror(errno));
       goto closeout;
@@ -294,7 +331,7 @@ closeout:
   } else {
     struct elf64_ehdr hdr;
 
-    if (read(elf->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+    if (!elf_read_at(elf, sizeof(ident), &hdr, sizeof(hdr))) {
       fprintf(stderr, "ELF: %s: error reading EHDR: %s\n",
           filename, strerror(errno));
       goto closeout;
@@ -337,16 +374,10 @@ closeout:
     s->elf = elf;
     off_t target = elf->e_shoff + (i * elf->e_shentsize);
 
-    if (lseek(elf->fd, target, SEEK_SET) != target) {
-      fprintf(stderr,
-        "ELF: %s: failed to seek for section header %d: offset %" PRId64 ": %s\n",
-        filename, i, (int64_t)target, strerror(errno));
-      return 0;
-    }
     if (elf->ei_class == GIMLI_ELFCLASS32) {
       struct elf32_shdr hdr;
 
-      if (read(elf->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+      if (!elf_read_at(elf, target, &hdr, sizeof(hdr))) {
         fprintf(stderr,
           "ELF: %s: failed to read section header %d: %s\n",
             filename, i, strerror(errno));
@@ -367,7 +398,7 @@ closeout:
     } else {
       struct elf64_shdr hdr;
 
-      if (read(elf->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+      if (!elf_read_at(elf, target, &hdr, sizeof(hdr))) {
         fprintf(stderr,
           "ELF: %s: failed to read section header %d: %s\n",
             filename, i, strerror(errno));
@@ -404,16 +435,16 @@ closeout:
   }
 
   /* now we need to locate the LOAD Program Header, and from that
-   * we can deduce the base_address */
+   * we can deduce the base_address.  We also want to know where
+   * the eh_frame_hdr lives, if present */
   for (i = 0; i < elf->e_phnum; i++) {
     struct elf64_phdr hdr;
-
-    lseek(elf->fd, elf->e_phoff + (i * elf->e_phentsize), SEEK_SET);
+    off_t target = elf->e_phoff + (i * elf->e_phentsize);
 
     if (elf->ei_class == GIMLI_ELFCLASS32) {
       struct elf32_phdr hdr32;
 
-      if (read(elf->fd, &hdr32, sizeof(hdr32)) != sizeof(hdr32)) {
+      if (!elf_read_at(elf, target, &hdr32, sizeof(hdr32))) {
         fprintf(stderr, "ELF: %s: error reading EHDR: %s\n",
             filename, strerror(errno));
         return 0;
@@ -424,25 +455,104 @@ closeout:
       hdr.p_vaddr = hdr32.p_vaddr;
       hdr.p_paddr = hdr32.p_paddr;
       hdr.p_filesz = hdr32.p_filesz;
-      hdr.p_memsz = hdr32.p_align;
+      hdr.p_memsz = hdr32.p_memsz;
+      hdr.p_align = hdr32.p_align;
 
     } else {
-      if (read(elf->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+      if (!elf_read_at(elf, target, &hdr, sizeof(hdr))) {
         fprintf(stderr, "ELF: %s: error reading EHDR: %s\n",
             filename, strerror(errno));
         return 0;
       }
     }
 
-    if (hdr.p_type == GIMLI_PT_LOAD) {
+    if (hdr.p_type == GIMLI_PT_LOAD && !seen_load) {
       elf->vaddr = hdr.p_vaddr;
-      break;
+      seen_load = 1;
+    } else if (hdr.p_type == GIMLI_PT_GNU_EH_FRAME) {
+      elf->eh_frame_hdr = hdr.p_vaddr;
+      elf->eh_frame_hdr_size = hdr.p_memsz;
     }
   }
 
   return elf;
 }
 
+/* Locate the eh_frame_hdr of the ELF image mapped at base in the
+ * target by reading its program headers from memory.  This is used
+ * when the file backing the mapping is not available to us.
+ * Returns the run-time address of the eh_frame_hdr */
+int gimli_elf_find_eh_frame_hdr(gimli_proc_t proc, gimli_addr_t base,
+  gimli_addr_t *hdr_addr, uint64_t *hdr_size)
+{
+  uint8_t ident[16];
+  struct elf64_ehdr ehdr;
+  struct elf64_phdr phdr;
+  uint64_t vaddr = 0, eh_vaddr = 0, eh_size = 0;
+  int seen_load = 0, seen_eh = 0;
+  int i;
+
+  if (gimli_read_mem(proc, base, ident, sizeof(ident)) != sizeof(ident) ||
+      memcmp(ident, GIMLI_EI_ELF_MAGIC, 4)) {
+    return 0;
+  }
+
+  if (ident[GIMLI_EI_CLASS] == GIMLI_ELFCLASS32) {
+    struct elf32_ehdr hdr32;
+
+    if (gimli_read_mem(proc, base + sizeof(ident), &hdr32, sizeof(hdr32))
+        != sizeof(hdr32)) {
+      return 0;
+    }
+    ehdr.e_phoff = hdr32.e_phoff;
+    ehdr.e_phentsize = hdr32.e_phentsize;
+    ehdr.e_phnum = hdr32.e_phnum;
+  } else {
+    if (gimli_read_mem(proc, base + sizeof(ident), &ehdr, sizeof(ehdr))
+        != sizeof(ehdr)) {
+      return 0;
+    }
+  }
+
+  for (i = 0; i < ehdr.e_phnum; i++) {
+    gimli_addr_t addr = base + ehdr.e_phoff + (i * ehdr.e_phentsize);
+
+    if (ident[GIMLI_EI_CLASS] == GIMLI_ELFCLASS32) {
+      struct elf32_phdr hdr32;
+
+      if (gimli_read_mem(proc, addr, &hdr32, sizeof(hdr32))
+          != sizeof(hdr32)) {
+        return 0;
+      }
+      phdr.p_type = hdr32.p_type;
+      phdr.p_vaddr = hdr32.p_vaddr;
+      phdr.p_memsz = hdr32.p_memsz;
+    } else {
+      if (gimli_read_mem(proc, addr, &phdr, sizeof(phdr)) != sizeof(phdr)) {
+        return 0;
+      }
+    }
+
+    if (phdr.p_type == GIMLI_PT_LOAD && !seen_load) {
+      vaddr = phdr.p_vaddr;
+      seen_load = 1;
+    } else if (phdr.p_type == GIMLI_PT_GNU_EH_FRAME) {
+      eh_vaddr = phdr.p_vaddr;
+      eh_size = phdr.p_memsz;
+      seen_eh = 1;
+    }
+  }
+
+  if (!seen_load || !seen_eh) {
+    return 0;
+  }
+
+  /* the first LOAD segment is the one mapped at base */
+  *hdr_addr = base - vaddr + eh_vaddr;
+  *hdr_size = eh_size;
+  return 1;
+}
+
 int gimli_elf_enum_symbols(struct gimli_elf_ehdr *elf,
   gimli_elf_sym_iter_func func, void *arg)
 {
@@ -61,7 +61,7 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
 
   c = *cur;
 
-  if (gimli_dwarf_unwind_next(cur)) {
+  if (cur->strategy != GIMLI_UNWIND_FP && gimli_dwarf_unwind_next(cur)) {
 //    printf("dwarf unwound to fp=%p sp=%p pc=%p\n", cur->st.fp, cur->st.sp, cur->st.pc);
 #if defined(__x86_64__)
     cur->st.regs.r_rbp = (intptr_t)cur->st.fp;
@@ -70,6 +70,9 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
 #endif
     return 1;
   }
+  if (cur->strategy == GIMLI_UNWIND_DWARF) {
+    return 0;
+  }
 //printf("dwarf unwind didn't succeed, doing it the hard way\n");
 //printf("fp=%p sp=%p pc=%p\n", c.st.fp, c.st.sp, c.st.pc);
 
@@ -82,6 +85,10 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
     if (c.st.fp == frame.next || frame.next == 0 || frame.retpc < 1024) {
       return 0;
     }
+    if (cur->strategy == GIMLI_UNWIND_FP &&
+        !gimli_fp_frame_is_sane(cur->proc, c.st.fp, frame.next, frame.retpc)) {
+      return 0;
+    }
     cur->st.fp = frame.next;
     cur->st.pc = frame.retpc;
     if (cur->st.pc > 0 && !gimli_is_signal_frame(cur)) {
@@ -94,6 +101,7 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
     cur->st.regs.r_rip = (intptr_t)cur->st.pc;
     cur->st.regs.r_rsp = (intptr_t)cur->st.sp;
 #endif
+    cur->method = GIMLI_UNWIND_METHOD_FP;
     return 1;
   }
 
@@ -272,7 +272,11 @@ extern "C" {
 #define DW_FORM_ref4 0x13 // reference  
 #define DW_FORM_ref8 0x14 // reference  
 #define DW_FORM_ref_udata 0x15 // reference  
-#define DW_FORM_indirect 0x16 // (see Section 7.5.3)  
+#define DW_FORM_indirect 0x16 // (see Section 7.5.3)
+#define DW_FORM_sec_offset 0x17 // lineptr, loclistptr, macptr, rangelistptr
+#define DW_FORM_exprloc 0x18 // exprloc
+#define DW_FORM_flag_present 0x19 // flag
+#define DW_FORM_ref_sig8 0x20 // reference  
 
 /* operation, code, no. operands, notes */
 #define DW_OP_addr 0x03 // 1 constant address  (size target specific)  
@@ -394,6 +398,9 @@ struct gimli_dwarf_cu {
   uint64_t offset, end;
   /** offset into abbrev */
   uint64_t da_offset;
+  uint8_t addr_size;
+  /** set once the subprograms of this CU are in the pc index */
+  uint8_t pc_indexed;
   struct gimli_dwarf_cu *left, *right;
   STAILQ_HEAD(cudielist, gimli_dwarf_die) dies;
 };
@@ -63,6 +63,11 @@ struct gimli_elf_ehdr {
   char *objname;
   gimli_mapped_object_t gobject;
   uint64_t vaddr;
+  /* from PT_GNU_EH_FRAME, if present */
+  uint64_t eh_frame_hdr, eh_frame_hdr_size;
+  /* when the object was read from memory rather than a file */
+  uint8_t *image;
+  uint64_t image_size;
 };
 
 typedef int (*gimli_elf_sym_iter_func)(struct gimli_elf_ehdr *elf,
@@ -71,6 +76,8 @@ typedef int (*gimli_elf_sym_iter_func)(struct gimli_elf_ehdr *elf,
 int gimli_elf_enum_symbols(struct gimli_elf_ehdr *elf,
   gimli_elf_sym_iter_func func, void *arg);
 struct gimli_elf_ehdr *gimli_elf_open(const char *filename);
+struct gimli_elf_ehdr *gimli_elf_open_image(const char *name,
+  uint8_t *image, uint64_t size);
 #if 0
 struct gimli_elf_shdr *gimli_get_elf_section_by_name(gimli_object_file_t *elf,
   const char *name);
@@ -149,6 +156,7 @@ const char *gimli_get_section_data(gimli_object_file_t *elf, int section);
 #define GIMLI_PT_LOAD 1
 #define GIMLI_PT_DYNAMIC 2
 #define GIMLI_PT_INTERP 3
+#define GIMLI_PT_GNU_EH_FRAME 0x6474e550
 
 #define gimli_object_is_executable(obj)  ((obj)->e_type == GIMLI_ET_EXEC)
 
@@ -4,6 +4,7 @@
  * https://bitbucket.org/wez/gimli/src/tip/LICENSE
  */
 #include "impl.h"
+#include <limits.h>
 
 struct glider_args {
   int nthread;
@@ -14,6 +15,9 @@ struct glider_args {
   gimli_thread_t thread;
   gimli_stack_trace_t trace;
   int suppress;
+  /* when aggregating, the threads that share this stack */
+  gimli_thread_t *shared;
+  int nshared;
 };
 
 static gimli_iter_status_t collect_frame(
@@ -106,18 +110,30 @@ static void render_thread(gimli_proc_t proc,
 
   if (args->suppress) return;
 
-  printf("Thread %d (LWP %d)\n", args->nthread, thread->lwpid);
+  gimli_budget_begin_thread();
+  gimli_output->begin_thread(args->nthread, args->trace,
+      args->shared, args->nshared);
   for (args->nframe = 0; args->nframe < num_frames; args->nframe++) {
     args->suppress = 0;
     gimli_visit_modules(should_suppress_frame, args);
     if (args->suppress) continue;
 
-    gimli_render_frame(args->nthread, args->nframe, args->frames[args->nframe]);
-
-    gimli_visit_modules(after_print_frame, args);
-    gimli_visit_modules(after_print_thread, args);
+    gimli_budget_sample();
+    gimli_output->render_frame(args->nthread, args->frames[args->nframe]);
+
+    /* modules annotate in free-form text; in a structured stream that
+     * is captured into records of its own */
+    if (gimli_have_modules()) {
+      gimli_out_capture_begin();
+      gimli_visit_modules(after_print_frame, args);
+      gimli_out_capture_end(args->nthread,
+          args->frames[args->nframe]->depth, "after_print_frame");
+      gimli_out_capture_begin();
+      gimli_visit_modules(after_print_thread, args);
+      gimli_out_capture_end(args->nthread, -1, "on_end_thread_trace");
+    }
   }
-  printf("\n");
+  gimli_output->end_thread(args->nthread, args->trace);
 }
 
 static gimli_iter_status_t trace_thread(
@@ -146,6 +162,277 @@ static gimli_iter_status_t trace_thread(
   return GIMLI_ITER_CONT;
 }
 
+/* The traces of the threads, as captured ahead of rendering them */
+struct capture {
+  gimli_thread_t *threads;
+  gimli_stack_trace_t *traces;
+  int n;
+  int alloc;
+};
+
+static gimli_iter_status_t capture_thread(
+    gimli_proc_t proc,
+    gimli_thread_t thread,
+    void *arg)
+{
+  struct capture *cap = arg;
+  gimli_stack_trace_t trace;
+
+  trace = gimli_thread_stack_trace(thread, max_frames);
+  if (!trace) {
+    return GIMLI_ITER_CONT;
+  }
+
+  if (cap->n + 1 >= cap->alloc) {
+    cap->alloc = cap->alloc ? cap->alloc * 2 : 64;
+    cap->threads = realloc(cap->threads, cap->alloc * sizeof(thread));
+    cap->traces = realloc(cap->traces, cap->alloc * sizeof(trace));
+  }
+  cap->threads[cap->n] = thread;
+  cap->traces[cap->n] = trace;
+  cap->n++;
+
+  return GIMLI_ITER_CONT;
+}
+
+/* The trace is written in two passes.  The first is quick: just the
+ * frames of every thread, from the unwinder and the symbol tables.  We
+ * flush that out before starting on the second pass, which adds the
+ * variables and the output of the modules, so that if we're killed
+ * for taking too long the trace still has every stack in it */
+static void begin_quick_pass(void)
+{
+  if (!gimli_output->structured) {
+    gimli_out_printf("STACKS: (all threads; variables follow below)\n");
+  }
+}
+
+static void end_quick_pass(void)
+{
+  gimli_out_flush();
+  fflush(stdout);
+}
+
+static void render_captured(gimli_proc_t proc, struct glider_args *args)
+{
+  struct capture cap;
+  int i;
+
+  memset(&cap, 0, sizeof(cap));
+  gimli_proc_visit_threads(proc, capture_thread, &cap);
+
+  begin_quick_pass();
+  for (i = 0; i < cap.n; i++) {
+    gimli_output->render_stack(i, cap.traces[i], NULL, 0);
+  }
+  end_quick_pass();
+
+  for (i = 0; i < cap.n; i++) {
+    args->thread = cap.threads[i];
+    args->trace = cap.traces[i];
+    gimli_stack_trace_visit(args->trace, collect_frame, args);
+    render_thread(proc, args->thread, args);
+    args->nthread++;
+    gimli_stack_trace_delete(args->trace);
+    args->trace = NULL;
+  }
+
+  free(cap.threads);
+  free(cap.traces);
+}
+
+/* -a collapses threads whose stacks are identical, rendering each
+ * distinct stack once along with the LWPs that share it.  Given twice,
+ * the other members of each group are rendered in full beneath it */
+static int aggregate = 0;
+
+struct stack_group {
+  /* next group with the same hash */
+  struct stack_group *next;
+  uint64_t hash;
+  /* pc and depth of each frame */
+  gimli_addr_t *key;
+  int keylen;
+  /* the first thread seen with this stack, and its trace */
+  gimli_stack_trace_t trace;
+  /* all of the threads with this stack, in the order we saw them */
+  gimli_thread_t *threads;
+  int nthreads;
+  int alloc_threads;
+  int order;
+};
+
+struct aggregate_args {
+  /* hash of the key => stack_group */
+  gimli_hash_t groups;
+  struct stack_group **list;
+  int ngroups;
+  int alloc_groups;
+  /* scratch space for computing keys */
+  gimli_addr_t *key;
+  int keylen;
+};
+
+static gimli_iter_status_t collect_key(
+      gimli_proc_t proc,
+      gimli_thread_t thread,
+      gimli_stack_frame_t frame,
+      void *arg)
+{
+  struct aggregate_args *agg = arg;
+
+  agg->key[agg->keylen++] = gimli_stack_frame_pcaddr(frame);
+  agg->key[agg->keylen++] = gimli_stack_frame_depth(frame);
+  /* a folded cycle at the end of a truncated trace leaves nothing
+   * after it whose depth would tell two recursion counts apart */
+  agg->key[agg->keylen++] = ((gimli_addr_t)frame->cycle_len << 32) |
+    frame->cycle_count;
+
+  return GIMLI_ITER_CONT;
+}
+
+static gimli_iter_status_t aggregate_thread(
+    gimli_proc_t proc,
+    gimli_thread_t thread,
+    void *arg)
+{
+  struct aggregate_args *agg = arg;
+  gimli_stack_trace_t trace;
+  struct stack_group *g, *first = NULL;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  int i;
+
+  trace = gimli_thread_stack_trace(thread, max_frames);
+  if (!trace) {
+    return GIMLI_ITER_CONT;
+  }
+
+  agg->keylen = 0;
+  gimli_stack_trace_visit(trace, collect_key, agg);
+  agg->key[agg->keylen++] = trace->truncated;
+  /* FNV-1a */
+  for (i = 0; i < agg->keylen; i++) {
+    hash ^= agg->key[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  if (gimli_hash_find_u64(agg->groups, hash, (void**)&first)) {
+    for (g = first; g; g = g->next) {
+      if (g->keylen == agg->keylen &&
+          !memcmp(g->key, agg->key, agg->keylen * sizeof(*agg->key))) {
+        break;
+      }
+    }
+  } else {
+    g = NULL;
+  }
+
+  if (g) {
+    /* we already have this one; its variables are of no interest
+     * unless we are asked for them, so let it go now */
+    gimli_stack_trace_delete(trace);
+  } else {
+    g = calloc(1, sizeof(*g));
+    g->hash = hash;
+    g->keylen = agg->keylen;
+    g->key = malloc(g->keylen * sizeof(*g->key));
+    memcpy(g->key, agg->key, g->keylen * sizeof(*g->key));
+    g->trace = trace;
+    g->order = agg->ngroups;
+
+    if (first) {
+      g->next = first->next;
+      first->next = g;
+    } else {
+      gimli_hash_insert_u64(agg->groups, hash, g);
+    }
+
+    if (agg->ngroups + 1 >= agg->alloc_groups) {
+      agg->alloc_groups = agg->alloc_groups ? agg->alloc_groups * 2 : 64;
+      agg->list = realloc(agg->list, agg->alloc_groups * sizeof(g));
+    }
+    agg->list[agg->ngroups++] = g;
+  }
+
+  if (g->nthreads + 1 >= g->alloc_threads) {
+    g->alloc_threads = g->alloc_threads ? g->alloc_threads * 2 : 16;
+    g->threads = realloc(g->threads, g->alloc_threads * sizeof(thread));
+  }
+  g->threads[g->nthreads++] = thread;
+
+  return GIMLI_ITER_CONT;
+}
+
+/* largest groups first; otherwise in the order that we found them */
+static int sort_compare_group(const void *A, const void *B)
+{
+  struct stack_group *a = *(struct stack_group**)A;
+  struct stack_group *b = *(struct stack_group**)B;
+
+  if (a->nthreads != b->nthreads) {
+    return b->nthreads - a->nthreads;
+  }
+  return a->order - b->order;
+}
+
+static void render_aggregated(gimli_proc_t proc, struct glider_args *args)
+{
+  struct aggregate_args agg;
+  struct stack_group *g;
+  int i, j;
+
+  memset(&agg, 0, sizeof(agg));
+  agg.groups = gimli_hash_new_size(NULL, GIMLI_HASH_U64_KEYS, 0);
+  /* a pc and a depth per frame */
+  agg.key = calloc(max_frames * 3 + 1, sizeof(*agg.key));
+
+  gimli_proc_visit_threads(proc, aggregate_thread, &agg);
+
+  qsort(agg.list, agg.ngroups, sizeof(*agg.list), sort_compare_group);
+  if (aggregate == 1) {
+    gimli_budget_threads(agg.ngroups);
+  }
+
+  /* number them as the second pass will */
+  begin_quick_pass();
+  for (i = 0, j = args->nthread; i < agg.ngroups; i++) {
+    g = agg.list[i];
+    gimli_output->render_stack(j, g->trace, g->threads, g->nthreads);
+    j += aggregate > 1 ? g->nthreads : 1;
+  }
+  end_quick_pass();
+
+  for (i = 0; i < agg.ngroups; i++) {
+    g = agg.list[i];
+
+    args->thread = g->threads[0];
+    args->trace = g->trace;
+    args->shared = g->threads;
+    args->nshared = g->nthreads;
+    gimli_stack_trace_visit(args->trace, collect_frame, args);
+    render_thread(proc, args->thread, args);
+    args->nthread++;
+    args->shared = NULL;
+    args->nshared = 0;
+    gimli_stack_trace_delete(args->trace);
+    args->trace = NULL;
+
+    if (aggregate > 1) {
+      for (j = 1; j < g->nthreads; j++) {
+        trace_thread(proc, g->threads[j], args);
+      }
+    }
+
+    free(g->threads);
+    free(g->key);
+    free(g);
+  }
+
+  free(agg.list);
+  free(agg.key);
+  gimli_hash_destroy(agg.groups);
+}
+
 static gimli_iter_status_t print_siginfo(gimli_proc_t proc,
     gimli_stack_frame_t frame,
     const char *varname, gimli_type_t t, gimli_addr_t addr,
@@ -153,19 +440,27 @@ static gimli_iter_status_t print_siginfo(gimli_proc_t proc,
 {
   siginfo_t si;
   char buf[1024];
-  int i;
 
   if (gimli_read_mem(proc, addr, &si, sizeof(si)) != sizeof(si)) {
     return GIMLI_ITER_CONT;
   }
 
   gimli_render_siginfo(proc, &si, buf, sizeof(buf));
-  for (i = 0; i < (depth + 1) * 4; i++) putchar(' ');
-  printf("%s\n", buf);
+  gimli_out_spaces((depth + 1) * 4);
+  gimli_out_printf("%s\n", buf);
 
   return GIMLI_ITER_STOP;
 }
 
+static gimli_iter_status_t count_thread(
+    gimli_proc_t proc,
+    gimli_thread_t thread,
+    void *arg)
+{
+  (*(int*)arg)++;
+  return GIMLI_ITER_CONT;
+}
+
 static const char *siginfo_names[] = {
   "siginfo_t",
   "struct siginfo",
@@ -174,6 +469,7 @@ static const char *siginfo_names[] = {
 static void trace_process(int pid)
 {
   int i;
+  int nthreads = 0;
   struct glider_args args;
 
   if (!tracer_attach(pid)) {
@@ -187,6 +483,8 @@ static void trace_process(int pid)
   args.proc = the_proc;
   args.frames = calloc(max_frames, sizeof(*args.frames));
   args.nthread = 0;
+  args.shared = NULL;
+  args.nshared = 0;
   if (!args.frames) {
     fprintf(stderr, "Not enough memory to trace %d frames\n", max_frames);
     return;
@@ -197,25 +495,91 @@ static void trace_process(int pid)
     return;
   }
 
+  gimli_proc_visit_threads(the_proc, count_thread, &nthreads);
+  gimli_budget_threads(nthreads);
+
   gimli_load_modules(the_proc);
-  gimli_show_memory_map(the_proc);
-  gimli_proc_visit_threads(the_proc, trace_thread, &args);
+  gimli_output->begin_process(the_proc);
+  if (aggregate) {
+    render_aggregated(the_proc, &args);
+  } else {
+    render_captured(the_proc, &args);
+  }
 
-  printf("\n");
+  gimli_output->end_process(the_proc);
+
+  /* tracers run arbitrary module code; only start them if some of the
+   * overall budget remains */
+  gimli_budget_sample();
+  if (gimli_budget_allows(GIMLI_TIER_SYMBOLS)) {
+    gimli_out_capture_begin();
+    gimli_module_call_tracers(the_proc);
+    gimli_out_capture_end(-1, -1, "tracer");
+  } else {
+    gimli_output->omitted(-1, -1, 0, "module tracers");
+  }
+
+  if (debug) {
+    uint64_t hits, misses;
 
-  gimli_module_call_tracers(the_proc);
+    gimli_dwarf_unwind_cache_stats(the_proc, &hits, &misses);
+    fprintf(stderr, "DWARF: unwind cache: %" PRIu64 " hits, %" PRIu64
+        " misses (%.1f%% hit rate)\n", hits, misses,
+        hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+  }
 
   free(args.frames);
   free(args.pcaddrs);
 }
 
+static int set_unwind_strategy(const char *name)
+{
+  if (!strcmp(name, "auto")) {
+    gimli_set_unwind_strategy(GIMLI_UNWIND_AUTO);
+  } else if (!strcmp(name, "dwarf")) {
+    gimli_set_unwind_strategy(GIMLI_UNWIND_DWARF);
+  } else if (!strcmp(name, "fp")) {
+    gimli_set_unwind_strategy(GIMLI_UNWIND_FP);
+  } else if (!strcmp(name, "compact")) {
+    /* as auto, but DWARF steps go via the compact unwind tables where
+     * they can; quicker, but callee saved registers other than the
+     * frame pointer are lost, so variables may show wrong values */
+    gimli_set_unwind_strategy(GIMLI_UNWIND_AUTO);
+    gimli_compact_unwind = 1;
+  } else {
+    fprintf(stderr, "invalid unwind strategy %s\n", name);
+    return 0;
+  }
+  return 1;
+}
+
+static int parse_budget(const char *what, const char *value, int *valp)
+{
+  char *end;
+  long v;
+
+  errno = 0;
+  v = strtol(value, &end, 10);
+  if (errno || *end || v < 0 || v > INT_MAX / 1000) {
+    fprintf(stderr, "invalid %s budget %s\n", what, value);
+    return 0;
+  }
+  *valp = v;
+  return 1;
+}
+
 int main(int argc, char *argv[])
 {
   int pid;
   int c;
+  /* -t seconds overall, -T milliseconds per thread, -M MB of memory */
+  int total_secs = 0, thread_ms = 0, mem_mb = 0;
+
+  /* the monitor's watchdog is already running */
+  gimli_budget_begin();
 
   while (1) {
-    c = getopt(argc, argv, "d");
+    c = getopt(argc, argv, "du:mao:t:T:M:");
     if (c == -1) {
       break;
     }
@@ -224,6 +588,45 @@ int main(int argc, char *argv[])
       case 'd':
         debug = 1;
         break;
+      /* -u selects the unwinder: auto, dwarf, fp or compact */
+      case 'u':
+        if (!set_unwind_strategy(optarg)) {
+          return 1;
+        }
+        break;
+      /* -m shows which unwinder produced each frame */
+      case 'm':
+        gimli_show_unwind_method = 1;
+        break;
+      /* -a collapses threads with identical stacks; -aa also renders
+       * the variables of the collapsed threads */
+      case 'a':
+        aggregate++;
+        break;
+      /* -o selects the output format: text or json */
+      case 'o':
+        if (!gimli_set_output_format(optarg)) {
+          fprintf(stderr, "invalid output format %s\n", optarg);
+          return 1;
+        }
+        break;
+      /* -t, -T and -M budget the trace; work that doesn't fit is
+       * skipped, least vital first, and noted in the output */
+      case 't':
+        if (!parse_budget("time", optarg, &total_secs)) {
+          return 1;
+        }
+        break;
+      case 'T':
+        if (!parse_budget("thread time", optarg, &thread_ms)) {
+          return 1;
+        }
+        break;
+      case 'M':
+        if (!parse_budget("memory", optarg, &mem_mb)) {
+          return 1;
+        }
+        break;
       default:
         fprintf(stderr, "invalid option %c\n", c);
         return 1;
@@ -233,13 +636,39 @@ int main(int argc, char *argv[])
   if (getenv("GIMLI_DWARF_DEBUG")) {
     debug = 1;
   }
+  if (getenv("GIMLI_COMPACT_UNWIND")) {
+    gimli_compact_unwind = 1;
+  }
+  if (getenv("GIMLI_UNWIND") && !set_unwind_strategy(getenv("GIMLI_UNWIND"))) {
+    return 1;
+  }
+  if (getenv("GIMLI_OUTPUT") && !gimli_set_output_format(getenv("GIMLI_OUTPUT"))) {
+    fprintf(stderr, "invalid output format %s\n", getenv("GIMLI_OUTPUT"));
+    return 1;
+  }
+
+  if (!total_secs && getenv("GIMLI_TRACE_BUDGET") &&
+      !parse_budget("time", getenv("GIMLI_TRACE_BUDGET"), &total_secs)) {
+    return 1;
+  }
+  if (!thread_ms && getenv("GIMLI_THREAD_BUDGET") &&
+      !parse_budget("thread time", getenv("GIMLI_THREAD_BUDGET"),
+        &thread_ms)) {
+    return 1;
+  }
+  if (!mem_mb && getenv("GIMLI_MEMORY_BUDGET") &&
+      !parse_budget("memory", getenv("GIMLI_MEMORY_BUDGET"), &mem_mb)) {
+    return 1;
+  }
+  gimli_budget_set(total_secs * 1000, thread_ms, mem_mb);
 
   if (optind < argc) {
     pid = atoi(argv[optind]);
     trace_process(pid);
     return 0;
   }
-  fprintf(stderr, "usage: %s <pid>\n", argv[0]);
+  fprintf(stderr, "usage: %s [-d] [-m] [-a[a]] [-u auto|dwarf|fp|compact] "
+      "[-o text|json] [-t secs] [-T thread-ms] [-M mb] <pid>\n", argv[0]);
   return 1;
 }
 
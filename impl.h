@@ -121,6 +121,9 @@ struct gimli_thread_state {
   int lwpid;
 
   int valid;
+  /* bounds of the stack the thread was running on when we attached;
+   * both are zero if we couldn't tell */
+  gimli_addr_t stack_lo, stack_hi;
 #if defined(__linux__)
   struct user_regs_struct regs;
   //prgregset_t regs;
@@ -145,6 +148,11 @@ struct gimli_unwind_cursor {
   int frameno;
   int tid;
   int dwarffail;
+  /* which unwinders we may use, and which one produced this frame */
+  gimli_unwind_strategy_t strategy;
+  gimli_unwind_method_t method;
+  /* the stack that the CFA must lie within, if known */
+  gimli_addr_t stack_lo, stack_hi;
 };
 
 struct dw_secinfo {
@@ -164,33 +172,6 @@ struct gimli_variable {
   int is_param;
 };
 
-struct gimli_stack_frame {
-  STAILQ_ENTRY(gimli_stack_frame) frames;
-
-  struct gimli_unwind_cursor cur;
-
-  STAILQ_HEAD(vars, gimli_variable) vars;
-  int loaded_vars;
-};
-
-struct gimli_stack_trace {
-  int refcnt;
-
-  /** associated thread */
-  gimli_thread_t thr;
-
-  /** number of frames */
-  int num_frames;
-
-  STAILQ_HEAD(frames, gimli_stack_frame) frames;
-};
-
-
-struct gimli_line_info {
-  const char *filename;
-  uint64_t lineno;
-  gimli_addr_t addr, end;
-};
 
 #ifdef __MACH__
 typedef struct gimli_macho_object *gimli_object_file_t;
@@ -218,6 +199,49 @@ struct gimli_object_mapping {
   gimli_mapped_object_t objfile;
 };
 
+struct gimli_addr_range {
+  gimli_addr_t start, end;
+};
+
+/* an entry of the address index; start and end are copied from the
+ * mapping so that a lookup touches only this array */
+struct gimli_mapping_index {
+  gimli_addr_t start, end;
+  struct gimli_object_mapping *map;
+};
+
+/* a region of the target address space, as reported by the OS.
+ * Unlike gimli_object_mapping, these cover anonymous memory too */
+struct gimli_vm_region {
+  gimli_addr_t start, end;
+  /* PROT_READ, PROT_WRITE, PROT_EXEC */
+  int prot;
+  enum {
+    gimli_vm_region_is_file,
+    gimli_vm_region_is_anon,
+    /* heap, vdso and the like */
+    gimli_vm_region_is_special,
+    /* the stack of the initial thread */
+    gimli_vm_region_is_stack,
+    /* memory known to be in use as the stack of some other thread */
+    gimli_vm_region_is_thread_stack,
+    /* the brk heap */
+    gimli_vm_region_is_heap
+  } kind;
+  /* for a stack, the thread whose stack it is, if we know */
+  int lwpid;
+};
+
+/* Regions are looked up page by page; the most recent lookups are
+ * remembered in a direct mapped cache, indexed by page number */
+#define GIMLI_REGION_PAGE_SHIFT 12
+#define GIMLI_REGION_CACHE_SIZE 256
+struct gimli_vm_region_cache {
+  gimli_addr_t page;
+  /* 1-based index into proc->regions, or 0 */
+  int region;
+};
+
 struct gimli_slab_page {
   LIST_ENTRY(gimli_slab_page) list;
 };
@@ -232,6 +256,57 @@ struct gimli_slab {
 int gimli_slab_init(struct gimli_slab *slab, uint32_t size, const char *name);
 void *gimli_slab_alloc(struct gimli_slab *slab);
 void gimli_slab_destroy(struct gimli_slab *slab);
+void gimli_slab_merge(struct gimli_slab *dest, struct gimli_slab *src);
+
+/* A frame is kept small; the full register state is only needed to
+ * evaluate variables, so it lives in the trace's side table and is
+ * only filled in for the frames that ask for it.
+ * See gimli_stack_frame_cursor */
+struct gimli_stack_frame {
+  STAILQ_ENTRY(gimli_stack_frame) frames;
+  gimli_stack_trace_t trace;
+
+  gimli_addr_t pc;
+  gimli_addr_t cfa;
+  gimli_addr_t sp;
+  /* position in the frames list, and how deep in the stack we really
+   * are; these differ once recursion has been folded */
+  int frameno;
+  int depth;
+  uint8_t method;
+  uint8_t flags;
+  /* if this frame starts a folded cycle, the number of frames in the
+   * cycle, and how many times it repeats from here */
+  uint16_t cycle_len;
+  uint32_t cycle_count;
+  /* full unwind state, from trace->cursorslab, or NULL */
+  struct gimli_unwind_cursor *cursor;
+
+  STAILQ_HEAD(vars, gimli_variable) vars;
+  int loaded_vars;
+};
+#define GIMLI_FRAME_SIGNAL 1
+
+struct gimli_stack_trace {
+  int refcnt;
+
+  /** associated thread */
+  gimli_thread_t thr;
+
+  /** number of frames */
+  int num_frames;
+  /** set if we gave up before reaching the end of the stack */
+  int truncated;
+
+  STAILQ_HEAD(frames, gimli_stack_frame) frames;
+  /** the frames themselves */
+  struct gimli_slab frameslab;
+
+  /** full unwind state for selected frames */
+  struct gimli_slab cursorslab;
+};
+
+struct gimli_unwind_cursor *gimli_stack_frame_cursor(gimli_stack_frame_t frame);
 
 struct gimli_mapped_object {
   char *objname;
@@ -250,18 +325,45 @@ struct gimli_mapped_object {
 
   uint64_t base_addr;
 
-  struct gimli_line_info *lines;
-  uint32_t linecount;
-  uint32_t linealloc;
+  /* decoded line programs: .debug_line offset => dw_line_table */
+  gimli_hash_t line_tables;
+  /* sequences from all decoded line programs, sorted by address */
+  struct dw_line_seq **line_seqs;
+  uint32_t num_line_seqs;
+  uint32_t alloc_line_seqs;
+  int lines_complete;
 
   struct dw_fde *fdes;
   uint32_t num_fdes;
   uint32_t alloc_fdes;
+  /* FDEs located on demand via .eh_frame_hdr */
+  struct dw_eh_hdr *eh_hdr;
+  int eh_hdr_tried;
+  /* pc => computed unwind rules */
+  gimli_hash_t unwind_rows;
+  uint64_t unwind_hits, unwind_misses;
+  /* compact unwind table; see gimli_compact_unwind */
+  struct dw_compact_table *compact;
+  int compact_tried;
+  /* set for the synthetic objects that hold JIT code */
+  struct gimli_perf_map *perf_map;
 
   struct dw_die_arange *arange;
   uint32_t num_arange;
   uint32_t alloc_arange;
 
+  /* pc => innermost subprogram, populated per CU on demand */
+  struct dw_pc_range *pcranges;
+  uint32_t num_pcranges;
+  uint32_t alloc_pcranges;
+  /* set once every CU has been indexed */
+  int pcindex_complete;
+
+  /* data address => static/global variable, sorted by address */
+  struct dw_var_addr *varaddrs;
+  uint32_t num_varaddrs;
+  int varaddrs_loaded;
+
   /* .debug_info */
   struct {
     const uint8_t *start, *end;
@@ -274,6 +376,8 @@ struct gimli_mapped_object {
     gimli_hash_t map; /* u64 code => offset to abbr section */
     gimli_object_file_t elf;
     const uint8_t *start, *end;
+    /* set while CUs are decoded in parallel; map must not change */
+    int frozen;
   } abbr;
 //  struct gimli_dwarf_die *first_die;
   struct gimli_slab dieslab, attrslab;
@@ -286,7 +390,11 @@ struct gimli_mapped_object {
 
 #ifdef __linux__
 struct gimli_proc_linux {
-  int nothing;
+  /* pc ranges of the signal restorer trampolines, resolved on
+   * first use; see gimli_is_signal_frame */
+  struct gimli_addr_range *sigtramps;
+  int num_sigtramps;
+  int sigtramps_resolved;
 };
 #endif
 #ifdef sun
@@ -329,11 +437,25 @@ struct gimli_proc {
   gimli_hash_t files;
   /** the primary object for the process */
   gimli_mapped_object_t first_file;
+  /** symbols for JIT code, if the process publishes a perf map */
+  struct gimli_perf_map *perf_map;
   /** address space mappings; maintained in sorted
    * order so that we can bsearch it */
   struct gimli_object_mapping **mappings;
   int nmaps;
+  int alloc_maps;
   int maps_changed;
+  /** the mappings again, flattened for lookups; see
+   * gimli_mapping_for_addr() */
+  struct gimli_mapping_index *map_index;
+  int alloc_map_index;
+  /** bumped whenever map_index is rebuilt */
+  uint32_t map_generation;
+  /** every region of the address space, in address order */
+  struct gimli_vm_region *regions;
+  int nregions;
+  int alloc_regions;
+  struct gimli_vm_region_cache region_cache[GIMLI_REGION_CACHE_SIZE];
 
   /* TODO: bits here to track page-by-page ref mappings in the target */
 };
@@ -382,7 +504,10 @@ extern int immortal_child;
 extern int run_as_uid, run_as_gid;
 extern char *glider_path, *trace_dir, *gimli_progname, *pidfile, *arg0;
 extern char *log_file;
-extern int max_frames;
+extern int max_frames, max_unwind_depth;
+extern int gimli_compact_unwind;
+extern gimli_unwind_strategy_t gimli_unwind_strategy;
+extern int gimli_show_unwind_method;
 
 extern void logprint(const char *fmt, ...);
 
@@ -405,16 +530,36 @@ struct gimli_object_mapping *gimli_add_mapping(
   const char *objname, gimli_addr_t base, unsigned long len,
   unsigned long offset);
 struct gimli_object_mapping *gimli_mapping_for_addr(gimli_proc_t proc, gimli_addr_t addr);
+void gimli_forget_mappings(gimli_proc_t proc);
+void gimli_add_region(gimli_proc_t proc, gimli_addr_t start,
+  gimli_addr_t end, int prot, int kind);
+struct gimli_vm_region *gimli_region_for_addr(gimli_proc_t proc,
+  gimli_addr_t addr);
+int gimli_stack_region_for_addr(gimli_proc_t proc, gimli_addr_t addr,
+  gimli_addr_t *lo, gimli_addr_t *hi);
+void gimli_set_thread_stack(gimli_proc_t proc,
+  struct gimli_thread_state *thr, gimli_addr_t base, size_t size);
+int gimli_unwind_cfa_in_stack(struct gimli_unwind_cursor *cur, void *cfa);
 
 gimli_mapped_object_t gimli_add_object(
   gimli_proc_t proc,
   const char *objname, gimli_addr_t base);
+gimli_mapped_object_t gimli_add_object_with_elf(
+  gimli_proc_t proc,
+  const char *objname, gimli_addr_t base,
+  gimli_object_file_t elf);
 struct gimli_symbol *gimli_add_symbol(gimli_mapped_object_t f,
   const char *name, gimli_addr_t addr, uint32_t size);
 gimli_mapped_object_t gimli_find_object(
   gimli_proc_t proc,
   const char *objname);
 
+struct gimli_perf_map *gimli_perf_map_open(gimli_proc_t proc);
+void gimli_perf_map_add_region(struct gimli_perf_map *map,
+  gimli_addr_t base, unsigned long len);
+void gimli_perf_map_refresh(struct gimli_perf_map *map);
+void gimli_perf_map_destroy(struct gimli_perf_map *map);
+
 #if SIZEOF_VOIDP == 8
 # define PTRFMT "0x%" PRIx64
 # define PTRFMT_T uint64_t
@@ -424,9 +569,15 @@ gimli_mapped_object_t gimli_find_object(
 #endif
 
 int gimli_process_elf(gimli_mapped_object_t f);
+#ifndef __MACH__
+int gimli_elf_find_eh_frame_hdr(gimli_proc_t proc, gimli_addr_t base,
+  gimli_addr_t *hdr_addr, uint64_t *hdr_size);
+#endif
 int gimli_process_dwarf(gimli_mapped_object_t f);
 int gimli_unwind_next(struct gimli_unwind_cursor *cur);
 int gimli_dwarf_unwind_next(struct gimli_unwind_cursor *cur);
+int gimli_dwarf_visit_signal_fdes(struct gimli_object_mapping *m,
+  void (*func)(void *arg, gimli_addr_t start, gimli_addr_t end), void *arg);
 int gimli_dwarf_regs_to_thread(struct gimli_unwind_cursor *cur);
 int gimli_thread_regs_to_dwarf(struct gimli_unwind_cursor *cur);
 void *gimli_reg_addr(struct gimli_unwind_cursor *cur, int col);
@@ -479,6 +630,22 @@ struct gimli_dwarf_die *gimli_dwarf_get_die(gimli_mapped_object_t f,
   uint64_t offset);
 
 struct gimli_dwarf_die *gimli_dwarf_get_die_for_pc(gimli_proc_t proc, gimli_addr_t pc);
+int gimli_dwarf_get_die_chain_for_pc(gimli_proc_t proc, gimli_addr_t pc,
+    struct gimli_dwarf_die **chain, int nchain);
+int gimli_dwarf_load_all_lines(gimli_mapped_object_t f);
+/* remembers where the last source lookup landed, for the next one */
+struct dw_line_seq;
+struct gimli_line_hint {
+  gimli_mapped_object_t file;
+  struct dw_line_seq *seq;
+};
+int gimli_source_location_near(gimli_proc_t proc,
+  struct gimli_object_mapping *m, gimli_addr_t pc,
+  struct gimli_line_hint *hint, struct gimli_source_location *loc);
+const char *gimli_dwarf_die_name(gimli_mapped_object_t file,
+    struct gimli_dwarf_die *die);
+const char *gimli_dwarf_data_var_name(gimli_proc_t proc,
+    gimli_addr_t addr, uint64_t *offset);
 struct gimli_dwarf_attr *gimli_dwarf_die_get_attr(
   struct gimli_dwarf_die *die, uint64_t attrcode);
 const char *gimli_dwarf_resolve_type_name(gimli_mapped_object_t f,
@@ -497,6 +664,8 @@ long gimli_ptrace(int cmd, pid_t pid, void *addr, void *data);
 int gimli_init_unwind(struct gimli_unwind_cursor *cur,
   struct gimli_thread_state *st);
 int gimli_is_signal_frame(struct gimli_unwind_cursor *cur);
+int gimli_fp_frame_is_sane(gimli_proc_t proc, void *fp,
+  void *next_fp, void *retpc);
 void gimli_render_frame(int tid, int nframe, gimli_stack_frame_t frame);
 
 int dw_calc_location(struct gimli_unwind_cursor *cur,
@@ -508,9 +677,12 @@ void gimli_dwarf_load_all_types(gimli_mapped_object_t file);
 void gimli_object_file_destroy(gimli_object_file_t obj);
 void gimli_hash_diagnose(gimli_hash_t h);
 void gimli_dw_fde_destroy(gimli_mapped_object_t file);
+void gimli_dwarf_unwind_cache_stats(gimli_proc_t proc,
+    uint64_t *hits, uint64_t *misses);
 
 void gimli_load_modules(gimli_proc_t proc);
 
+int gimli_have_modules(void);
 gimli_iter_status_t gimli_visit_modules(gimli_module_visit_f func, void *arg);
 void gimli_module_call_tracers(gimli_proc_t proc);
 
@@ -525,6 +697,74 @@ gimli_iter_status_t gimli_module_call_var_printer(
     gimli_addr_t addr, int depth);
 void gimli_show_memory_map(gimli_proc_t proc);
 
+/* rendering of traces; see output.c */
+struct gimli_output_backend {
+  const char *name;
+  /* set if free-form output from modules would spoil the stream */
+  int structured;
+  void (*begin_process)(gimli_proc_t proc);
+  /* shared is set when threads with identical stacks are collapsed,
+   * and lists the threads whose stack this is */
+  void (*begin_thread)(int tid, gimli_stack_trace_t trace,
+      gimli_thread_t *shared, int nshared);
+  void (*render_frame)(int tid, gimli_stack_frame_t frame);
+  /* renders the frames of a thread without their variables, for a
+   * quick first look at every thread */
+  void (*render_stack)(int tid, gimli_stack_trace_t trace,
+      gimli_thread_t *shared, int nshared);
+  void (*end_thread)(int tid, gimli_stack_trace_t trace);
+  void (*end_process)(gimli_proc_t proc);
+  /* notes that count items of what were skipped for want of budget;
+   * depth is the frame, or -1 if it applies to the whole thread; tid
+   * is -1 if it applies to the whole process */
+  void (*omitted)(int tid, int depth, int count, const char *what);
+  /* what a module printed while running the named hook; tid and depth
+   * are -1 if it didn't concern a particular thread or frame */
+  void (*module_output)(int tid, int depth, const char *hook,
+      const char *text, size_t len);
+};
+extern struct gimli_output_backend *gimli_output;
+int gimli_set_output_format(const char *name);
+void gimli_json_render_frame(int tid, gimli_stack_frame_t frame);
+void gimli_render_stack(int tid, gimli_stack_trace_t trace);
+void gimli_json_render_stack(int tid, gimli_stack_trace_t trace);
+
+/* budgets for a trace; see budget.c */
+enum gimli_budget_tier {
+  /* unwinding to capture the registers and pc of each frame */
+  GIMLI_TIER_PCS,
+  /* resolving frames to symbols and source lines */
+  GIMLI_TIER_SYMBOLS,
+  GIMLI_TIER_PARAMS,
+  /* locals, and following pointers */
+  GIMLI_TIER_LOCALS,
+};
+void gimli_budget_set(int total_ms, int thread_ms, int mem_mb);
+int gimli_budget_enabled(void);
+void gimli_budget_begin(void);
+void gimli_budget_threads(int nthreads);
+void gimli_budget_begin_thread(void);
+void gimli_budget_sample(void);
+int gimli_budget_allows(enum gimli_budget_tier tier);
+const char *gimli_budget_reason(void);
+
+struct gimli_outbuf;
+struct gimli_outbuf *gimli_outbuf_new(void);
+void gimli_outbuf_delete(struct gimli_outbuf *b);
+struct gimli_outbuf *gimli_out_target(struct gimli_outbuf *b);
+void gimli_out_append(struct gimli_outbuf *b);
+void gimli_out_flush(void);
+void gimli_out_capture_begin(void);
+void gimli_out_capture_end(int tid, int depth, const char *hook);
+void gimli_out_write(const char *buf, size_t len);
+void gimli_out_puts(const char *str);
+void gimli_out_putc(int c);
+void gimli_out_spaces(int n);
+void gimli_out_printf(const char *fmt, ...);
+size_t gimli_out_printable_run(const char *buf, size_t len, int json);
+void gimli_out_json_chars(const char *buf, size_t len);
+void gimli_out_json_string(const char *str);
+
 /* ensure that the table size is a power of 2 */
 static inline uint32_t power_2(uint32_t x)
 {
@@ -319,6 +319,12 @@ gimli_iter_status_t gimli_proc_visit_threads(
 /** Obtain a stack trace from a thread */
 gimli_stack_trace_t gimli_thread_stack_trace(gimli_thread_t thr, int max_frames);
 
+/** Determine the bounds of the stack that a thread was running on when
+ * we attached.  Returns 1 and fills in lo and hi (exclusive) if they are
+ * known, 0 otherwise */
+int gimli_thread_stack_range(gimli_thread_t thr,
+  gimli_addr_t *lo, gimli_addr_t *hi);
+
 void gimli_stack_trace_addref(gimli_stack_trace_t trace);
 void gimli_stack_trace_delete(gimli_stack_trace_t trace);
 
@@ -340,6 +346,43 @@ gimli_iter_status_t gimli_stack_trace_visit(
 
 gimli_addr_t gimli_stack_frame_pcaddr(gimli_stack_frame_t frame);
 int gimli_stack_frame_number(gimli_stack_frame_t frame);
+/** How deep in the stack the frame is.  This is the same as the frame
+ * number unless recursion has been folded ahead of it */
+int gimli_stack_frame_depth(gimli_stack_frame_t frame);
+/** Deep recursion is folded: if this frame starts a cycle of len frames
+ * that repeats count times, only the first repetition is present in
+ * the trace.  Returns 1 and fills in len and count if that is the case */
+int gimli_stack_frame_cycle(gimli_stack_frame_t frame,
+  int *len, int *count);
+
+/** which unwinders may be used to walk a stack.
+ * AUTO uses the DWARF CFI where available and falls back to the frame
+ * pointer chain; FP walks only the frame pointer chain, which is much
+ * cheaper and suits high frequency sampling of code built with frame
+ * pointers */
+typedef enum {
+  GIMLI_UNWIND_AUTO = 0,
+  GIMLI_UNWIND_DWARF,
+  GIMLI_UNWIND_FP,
+} gimli_unwind_strategy_t;
+
+/** how a given frame was recovered */
+typedef enum {
+  /* the thread registers; the innermost frame */
+  GIMLI_UNWIND_METHOD_REGS = 0,
+  GIMLI_UNWIND_METHOD_DWARF,
+  GIMLI_UNWIND_METHOD_COMPACT,
+  GIMLI_UNWIND_METHOD_FP,
+  /* registers restored from a signal trampoline context */
+  GIMLI_UNWIND_METHOD_SIGNAL,
+} gimli_unwind_method_t;
+
+/** selects the strategy used by subsequent stack traces */
+void gimli_set_unwind_strategy(gimli_unwind_strategy_t strategy);
+gimli_unwind_method_t gimli_stack_frame_unwind_method(
+    gimli_stack_frame_t frame);
+/** returns a short name for an unwind method, such as "dwarf" */
+const char *gimli_unwind_method_name(gimli_unwind_method_t method);
 
 int gimli_stack_frame_resolve_var(gimli_stack_frame_t frame,
     int filter,
@@ -388,6 +431,54 @@ int gimli_determine_source_line_number(gimli_proc_t proc,
   gimli_addr_t pc, char *src, int srclen,
   uint64_t *lineno);
 
+/** Describes the source location of a code address */
+struct gimli_source_location {
+  /** source file name, as recorded in the debug info */
+  const char *filename;
+  uint64_t lineno;
+  /** column number; 0 if not recorded */
+  uint32_t column;
+  /** non-zero if the address is a recommended breakpoint location
+   * for the line, which is usually the start of a statement */
+  int is_stmt;
+};
+
+/** Determine the source location of PC.  Returns 1 and populates
+ * LOC if it is known, 0 otherwise.  The filename remains valid for
+ * as long as the object containing PC is mapped */
+int gimli_determine_source_location(gimli_proc_t proc,
+  gimli_addr_t pc, struct gimli_source_location *loc);
+
+/** Describes an address symbolically; see gimli_symbolize_batch().
+ * The strings belong to gimli, and remain valid for as long as the
+ * object containing the address is mapped.  Equal strings from the same
+ * object are the same pointer */
+struct gimli_symbolized {
+  gimli_addr_t addr;
+  /** the object containing addr, or NULL if it isn't mapped */
+  const char *objname;
+  /** the symbol containing addr, or NULL */
+  const char *symname;
+  /** offset of addr from the start of the symbol */
+  uint64_t offset;
+  /** source file and line, or NULL and 0 if not known */
+  const char *filename;
+  uint64_t lineno;
+};
+
+/** Symbolizes the N addresses in ADDRS, storing a description of
+ * ADDRS[i] in RESULTS[i].  This gives the same answers as calling
+ * gimli_pc_sym_name() and gimli_determine_source_location() for each
+ * address (save that where several symbols share a range, all of the
+ * addresses in it are given the same one), but is much cheaper for
+ * large numbers of addresses, such as the samples of a profile: they
+ * are looked up in address order, so that each lookup can start from
+ * where the last one left off, and repeated addresses are looked up
+ * only once.
+ * Returns 1 on success, 0 if there wasn't enough memory */
+int gimli_symbolize_batch(gimli_proc_t proc, const gimli_addr_t *addrs,
+  int n, struct gimli_symbolized *results);
+
 /* {{{ Reading and writing memory */
 
 /** Read memory from SRC address in the target and copy it into the
@@ -408,6 +499,19 @@ int gimli_write_mem(gimli_proc_t proc, gimli_addr_t dest, const void *src, int l
  * gimli and the target process */
 int gimli_read_pointer(gimli_proc_t proc, gimli_addr_t addr, gimli_addr_t *val);
 
+/** Returns 1 if all LEN bytes at ADDR are mapped readable in the
+ * target, 0 otherwise.  Where the OS describes the address space this
+ * is answered without touching the target, so it is cheap enough to
+ * call before following each pointer */
+int gimli_addr_readable(gimli_proc_t proc, gimli_addr_t addr, size_t len);
+
+/** Describes the anonymous memory holding ADDR: "heap", "stack",
+ * "stack of LWP N" or "anon mmap".  BUF, of size BUFLEN, may be used
+ * to hold the result.  Returns NULL for file backed memory (look for a
+ * symbol instead) and for addresses that are not mapped */
+const char *gimli_region_describe(gimli_proc_t proc, gimli_addr_t addr,
+  char *buf, int buflen);
+
 /** read a NUL terminated string from target process.
  * The caller must free() the memory when it is no longer required.  */
 char *gimli_read_string(gimli_proc_t proc, gimli_addr_t addr);
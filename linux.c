@@ -64,6 +64,25 @@ long gimli_ptrace(int cmd, int pid, void *addr, void *data)
 }
 
 
+/* The vDSO has no backing file; it is a complete ELF image that the
+ * kernel maps into every process, so we copy it out of the target */
+static gimli_object_file_t read_vdso(gimli_proc_t proc,
+  gimli_addr_t base, unsigned long len)
+{
+  uint8_t *image = malloc(len);
+
+  if (!image) {
+    return NULL;
+  }
+  if (gimli_read_mem(proc, base, image, len) != len) {
+    fprintf(stderr, "read_maps: unable to read vdso at " PTRFMT "\n",
+        (PTRFMT_T)base);
+    free(image);
+    return NULL;
+  }
+  return gimli_elf_open_image("[vdso]", image, len);
+}
+
 static void read_maps(gimli_proc_t proc)
 {
   char maps[1024];
@@ -78,8 +97,11 @@ static void read_maps(gimli_proc_t proc)
     return;
   }
 
+  proc->perf_map = gimli_perf_map_open(proc);
+
   while (fgets(line, sizeof(line)-1, fp)) {
-    int i;
+    int i, prot, kind;
+    gimli_addr_t start, end;
     char *tok = line;
 
     i = strlen(line);
@@ -94,23 +116,71 @@ static void read_maps(gimli_proc_t proc)
 
     *tok = '\0';
     tok++;
-
+    while (isspace(*tok)) tok++;
+    /* perms are "rwxp" */
+    prot = 0;
+    if (tok[0] == 'r') prot |= PROT_READ;
+    if (tok[0] && tok[1] == 'w') prot |= PROT_WRITE;
+    if (tok[0] && tok[1] && tok[2] == 'x') prot |= PROT_EXEC;
+
+    /* anonymous mappings have no name; take care not to run off
+     * the end of the line into whatever the previous one left */
     for (i = 0; i < 4; i++) {
       while (isspace(*tok)) tok++;
-      while (!isspace(*tok)) tok++;
+      while (*tok && !isspace(*tok)) tok++;
       while (isspace(*tok)) tok++;
     }
-    if (tok && *tok) {
-      unsigned long long v;
-      gimli_addr_t base;
-      unsigned long len;
-      char *objname = tok;
 
-      if (*tok != '/') continue;
-
-      base = strtoull(line, &tok, 16);
-      v = strtoull(tok + 1, NULL, 16);
-      len = v - base;
+    start = strtoull(line, NULL, 16);
+    end = strtoull(strchr(line, '-') + 1, NULL, 16);
+    if (!*tok) {
+      kind = gimli_vm_region_is_anon;
+    } else if (!strcmp(tok, "[stack]")) {
+      kind = gimli_vm_region_is_stack;
+    } else if (!strncmp(tok, "[stack:", 7)) {
+      /* older kernels label the stacks of other threads, too */
+      kind = gimli_vm_region_is_thread_stack;
+    } else if (!strcmp(tok, "[heap]")) {
+      kind = gimli_vm_region_is_heap;
+    } else if (*tok == '[') {
+      kind = gimli_vm_region_is_special;
+    } else {
+      kind = gimli_vm_region_is_file;
+    }
+    gimli_add_region(proc, start, end, prot, kind);
+
+    if (!*tok && (prot & PROT_EXEC) && proc->perf_map) {
+      /* anonymous executable memory; JIT code may live here */
+      gimli_perf_map_add_region(proc->perf_map, start, end - start);
+    } else if (tok && *tok) {
+      gimli_addr_t base = start;
+      unsigned long len = end - start;
+      char *objname = tok;
+      int is_vdso = !strcmp(objname, "[vdso]");
+
+      if (*tok != '/' && !is_vdso) continue;
+
+      if (!gimli_find_object(proc, objname)) {
+        gimli_object_file_t elf = NULL;
+
+        if (is_vdso) {
+          elf = read_vdso(proc, base, len);
+        } else if (!strncmp(objname, "/memfd:", 7) ||
+            ((i = strlen(objname)) > 10 &&
+             !strcmp(objname + i - 10, " (deleted)"))) {
+          /* there's no file by this name (any more), but the
+           * mapping still references it, and we can open it from
+           * there.  line is NUL terminated after the address range */
+          char path[sizeof(line) + 32];
+
+          snprintf(path, sizeof(path), "/proc/%d/map_files/%s",
+              proc->pid, line);
+          elf = gimli_elf_open(path);
+        }
+        if (elf) {
+          gimli_add_object_with_elf(proc, objname, base, elf);
+        }
+      }
       gimli_add_mapping(proc, objname, base, len, 0);
     }
   }
@@ -196,36 +266,124 @@ static void hexdump(gimli_proc_t proc, void *addr, int p, int n)
   }
 }
 
+static void add_sigtramp(void *arg, gimli_addr_t start, gimli_addr_t end)
+{
+  gimli_proc_t proc = arg;
+  struct gimli_proc_linux *t = &proc->tdep;
+
+  t->sigtramps = realloc(t->sigtramps,
+      (t->num_sigtramps + 1) * sizeof(*t->sigtramps));
+  t->sigtramps[t->num_sigtramps].start = start;
+  t->sigtramps[t->num_sigtramps].end = end;
+  t->num_sigtramps++;
+
+  if (debug) {
+    fprintf(stderr, "SIGTRAMP: " PTRFMT " - " PTRFMT "\n",
+        (PTRFMT_T)start, (PTRFMT_T)end);
+  }
+}
+
+/* Works out where the signal restorer trampolines live, once per
+ * process.  The restorers are local symbols, so they are usually only
+ * visible by name when debug symbols are available; glibc and the
+ * kernel also describe them with FDEs that carry the 'S' augmentation,
+ * so we look for those in the object providing sigaction and in the
+ * vDSO */
+static void resolve_sigtramps(gimli_proc_t proc)
+{
+  static const char *names[] = {
+    "__restore_rt",
+    "__restore",
+    "__kernel_rt_sigreturn",
+    "__kernel_sigreturn",
+    NULL
+  };
+  struct gimli_symbol *sym;
+  struct gimli_object_mapping *m;
+  int i;
+
+  proc->tdep.sigtramps_resolved = 1;
+
+  for (i = 0; names[i]; i++) {
+    sym = gimli_sym_lookup(proc, NULL, names[i]);
+    if (sym) {
+      /* these are hand written and may not have a size */
+      add_sigtramp(proc, sym->addr, sym->addr + (sym->size ? sym->size : 16));
+    }
+  }
+
+  sym = gimli_sym_lookup(proc, NULL, "sigaction");
+  for (i = 0; i < proc->nmaps; i++) {
+    m = proc->mappings[i];
+
+    if ((sym && sym->addr >= m->base && sym->addr < m->base + m->len) ||
+        strstr(m->objfile->objname, "[vdso]")) {
+      gimli_dwarf_visit_signal_fdes(m, add_sigtramp, proc);
+    }
+  }
+}
+
+/* Returns 1 if pc lies in a known signal trampoline, 0 if it does not,
+ * or -1 if we don't know where the trampolines are and the caller
+ * needs to look at the code */
+static int sigtramp_lookup(gimli_proc_t proc, gimli_addr_t pc)
+{
+  int i;
+
+  if (!proc->tdep.sigtramps_resolved) {
+    resolve_sigtramps(proc);
+  }
+  if (proc->tdep.num_sigtramps == 0) {
+    return -1;
+  }
+  for (i = 0; i < proc->tdep.num_sigtramps; i++) {
+    if (pc >= proc->tdep.sigtramps[i].start &&
+        pc < proc->tdep.sigtramps[i].end) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 int gimli_is_signal_frame(struct gimli_unwind_cursor *cur)
 {
-  /* these magic numbers correspond to the machine code instructions
-   * used for the sigreturn handling in glibc */
+  int tramp = sigtramp_lookup(cur->proc, (gimli_addr_t)cur->st.pc);
 #ifdef __x86_64__
   uint64_t a, b;
-  if (gimli_read_mem(cur->proc, (gimli_addr_t)cur->st.pc, &a,
-        sizeof(a)) == sizeof(a) &&
+#else
+  uint32_t a, b;
+#endif
+
+  if (tramp == 0) {
+    return 0;
+  }
+
+#ifdef __x86_64__
+  /* if we couldn't find the trampolines, look for the machine code
+   * instructions used for the sigreturn handling in glibc */
+  if (tramp < 0 && (
+      gimli_read_mem(cur->proc, (gimli_addr_t)cur->st.pc, &a,
+        sizeof(a)) != sizeof(a) ||
       gimli_read_mem(cur->proc, (gimli_addr_t)cur->st.pc + sizeof(a),
-        &b, sizeof(b)) == sizeof(b)) {
-    if ((a == 0x0f0000000fc0c748) && ((b & 0xff) == 5)) {
-      void *siptr;
-      int signo;
-
-      /* this only really works for SA_SIGINFO handlers.
-       * to make it work for non-SA_SIGINFO handlers, we'd need
-       * to down down one level and look at the args passed to the
-       * signal handler itself. */
-
-      if (gimli_read_mem(cur->proc,
-            (gimli_addr_t)cur->st.fp + sizeof(struct gimli_kernel_ucontext),
-            &cur->si, sizeof(cur->si)) != sizeof(cur->si)) {
-        /* can't tell the user anything useful */
-        memset(&cur->si, 0, sizeof(cur->si));
-      }
-      return 1;
-    }
+        &b, sizeof(b)) != sizeof(b) ||
+      a != 0x0f0000000fc0c748 || (b & 0xff) != 5)) {
+    return 0;
+  }
+
+  /* this only really works for SA_SIGINFO handlers.
+   * to make it work for non-SA_SIGINFO handlers, we'd need
+   * to down down one level and look at the args passed to the
+   * signal handler itself. */
+  if (gimli_read_mem(cur->proc,
+        (gimli_addr_t)cur->st.fp + sizeof(struct gimli_kernel_ucontext),
+        &cur->si, sizeof(cur->si)) != sizeof(cur->si)) {
+    /* can't tell the user anything useful */
+    memset(&cur->si, 0, sizeof(cur->si));
   }
+  return 1;
 #elif defined(__i386__)
-  uint32_t a, b;
+  /* the flavour of trampoline tells us whether we have siginfo, so
+   * we still need to look at the code */
   if (gimli_read_mem(cur->proc, cur->st.pc, &a, sizeof(a)) == sizeof(a) &&
       gimli_read_mem(cur->proc, cur->st.pc + sizeof(a), &b, sizeof(b)) == sizeof(b)) {
     /* pull out the signal number */
@@ -272,18 +430,92 @@ int gimli_is_signal_frame(struct gimli_unwind_cursor *cur)
   return 0;
 }
 
+/* generic x86 backtrace */
+struct x86_frame {
+  struct x86_frame *next;
+  void *retpc;
+};
+
+/* Walks one link of the frame pointer chain; used when the strategy is
+ * GIMLI_UNWIND_FP.  This never consults the DWARF CFI, so it is cheap,
+ * but it relies on the code having been built with frame pointers.
+ * On x86_64 st.fp tracks the stack pointer (as the DWARF unwinder
+ * expects), so the chain itself is followed via rbp, and the registers
+ * are updated as a standard prologue would have left them */
+static int fp_unwind_next(struct gimli_unwind_cursor *cur)
+{
+  struct x86_frame frame;
+  void *fp;
+
+#ifdef __x86_64__
+  fp = (void*)cur->st.regs.rbp;
+#else
+  fp = cur->st.fp;
+#endif
+  if (!fp || !gimli_unwind_cfa_in_stack(cur, fp)) {
+    return 0;
+  }
+  if (gimli_read_mem(cur->proc, (gimli_addr_t)fp,
+        &frame, sizeof(frame)) != sizeof(frame)) {
+    return 0;
+  }
+  if (frame.next && !gimli_unwind_cfa_in_stack(cur, frame.next)) {
+    return 0;
+  }
+  if (!gimli_fp_frame_is_sane(cur->proc, fp, frame.next, frame.retpc)) {
+    if (debug) {
+      fprintf(stderr, "FP: implausible frame at %p: next=%p pc=%p\n",
+          fp, frame.next, frame.retpc);
+    }
+    return 0;
+  }
+
+#ifdef __x86_64__
+  cur->st.regs.rsp = (intptr_t)fp + sizeof(frame);
+  cur->st.regs.rbp = (intptr_t)frame.next;
+  cur->st.fp = (void*)cur->st.regs.rsp;
+  cur->st.sp = (void*)cur->st.regs.rsp;
+#else
+  cur->st.regs.esp = (intptr_t)fp + sizeof(frame);
+  cur->st.regs.ebp = (intptr_t)frame.next;
+  cur->st.fp = frame.next;
+  cur->st.sp = (void*)cur->st.regs.esp;
+#endif
+  cur->st.pc = frame.retpc;
+  if (!gimli_is_signal_frame(cur)) {
+    cur->st.pc--;
+  }
+  cur->method = GIMLI_UNWIND_METHOD_FP;
+  return 1;
+}
+
+/* A signal handler may have run on an alternate stack; once we have
+ * unwound through the signal frame, the interrupted code tells us
+ * which stack we are on */
+static void follow_stack(struct gimli_unwind_cursor *cur)
+{
+  gimli_addr_t sp = (gimli_addr_t)cur->st.sp;
+
+  if (sp >= cur->stack_lo && sp < cur->stack_hi) {
+    return;
+  }
+  if (!gimli_stack_region_for_addr(cur->proc, sp,
+        &cur->stack_lo, &cur->stack_hi)) {
+    cur->stack_lo = 0;
+    cur->stack_hi = 0;
+  }
+}
+
 int gimli_unwind_next(struct gimli_unwind_cursor *cur)
 {
-  /* generic x86 backtrace */
-  struct x86_frame {
-    struct x86_frame *next;
-    void *retpc;
-  } frame;
-  struct gimli_unwind_cursor c;
-
-  c = *cur;
+  struct x86_frame frame;
+  /* all that we need to remember about the frame we started from;
+   * the cursor is large enough that we don't want to copy it */
+  void *prev_pc = cur->st.pc, *prev_fp = cur->st.fp;
+
   if (gimli_is_signal_frame(cur)) {
     /* extract the next step from the data in the trampoline */
+    cur->method = GIMLI_UNWIND_METHOD_SIGNAL;
 
 #ifdef __x86_64__
     struct gimli_kernel_ucontext uc;
@@ -313,6 +545,7 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
     cur->st.fp = (void*)cur->st.regs.rsp;
     cur->st.pc = (void*)cur->st.regs.rip;
     cur->st.sp = (void*)cur->st.regs.rsp;
+    follow_stack(cur);
 
     return 1;
 #else
@@ -355,6 +588,7 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
       cur->st.fp = (void*)cur->st.regs.ebp;
       cur->st.sp = (void*)cur->st.regs.esp;
       cur->st.pc = (void*)cur->st.regs.eip;
+      follow_stack(cur);
       return 1;
 
     } else {
@@ -390,14 +624,22 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
       cur->st.fp = (void*)cur->st.regs.ebp;
       cur->st.sp = (void*)cur->st.regs.esp;
       cur->st.pc = (void*)cur->st.regs.eip;
+      follow_stack(cur);
 
       return 1;
     }
 #endif
   }
 
-  /* sanity check that dwarf made progress relative to the starting pc */
-  if (gimli_dwarf_unwind_next(cur) && cur->st.pc && cur->st.pc != c.st.pc) {
+  if (cur->strategy == GIMLI_UNWIND_FP) {
+    return fp_unwind_next(cur);
+  }
+
+  /* sanity check that dwarf made progress relative to the starting pc;
+   * a recursive call returns to the same pc, but in a caller frame */
+  if (gimli_dwarf_unwind_next(cur) && cur->st.pc &&
+      (cur->st.pc != prev_pc || cur->st.fp > prev_fp) &&
+      gimli_unwind_cfa_in_stack(cur, cur->st.fp)) {
 //    printf("dwarf unwound to fp=%p sp=%p pc=%p\n", cur->st.fp, cur->st.sp, cur->st.pc);
 #if defined(__x86_64__)
     cur->st.regs.rsp = (intptr_t)cur->st.fp;
@@ -405,19 +647,23 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
 #endif
     return 1;
   }
+  if (cur->strategy == GIMLI_UNWIND_DWARF) {
+    return 0;
+  }
 
 //printf("dwarf unwind didn't succeed, doing it the hard way\n");
-//printf("fp=%p sp=%p pc=%p\n", c.st.fp, c.st.sp, c.st.pc);
+//printf("fp=%p pc=%p\n", prev_fp, prev_pc);
 
-  if (c.st.fp) {
-    if (gimli_read_mem(cur->proc, (gimli_addr_t)c.st.fp,
+  if (prev_fp) {
+    if (gimli_read_mem(cur->proc, (gimli_addr_t)prev_fp,
           &frame, sizeof(frame)) != sizeof(frame)) {
       memset(&frame, 0, sizeof(frame));
     }
 //    printf("read frame: fp=%p pc=%p\n", frame.next, frame.retpc);
     /* If we don't appear to be making progress, or we end up in page 0,
      * then assume we're done */
-    if (c.st.fp == frame.next || frame.next == (void*)0 || frame.retpc < (void*)1024) {
+    if (prev_fp == frame.next || frame.next == (void*)0 || frame.retpc < (void*)1024 ||
+        !gimli_unwind_cfa_in_stack(cur, frame.next)) {
       return 0;
     }
     cur->st.fp = frame.next;
@@ -428,6 +674,7 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
 #ifdef __i386__
     cur->st.regs.ebp = (intptr_t)cur->st.fp;
 #endif
+    cur->method = GIMLI_UNWIND_METHOD_FP;
     return 1;
   }
 
@@ -522,6 +769,10 @@ gimli_err_t gimli_detach(gimli_proc_t proc)
   ptrace(PTRACE_DETACH, proc->pid, NULL, SIGCONT);
 
   // FIXME: free all bits from tdep properly
+  free(proc->tdep.sigtramps);
+  proc->tdep.sigtramps = NULL;
+  proc->tdep.num_sigtramps = 0;
+  proc->tdep.sigtramps_resolved = 0;
 
   return GIMLI_ERR_OK;
 }
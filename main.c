@@ -460,6 +460,12 @@ static void trace_child(struct kid_proc *p)
       dup2(tracefd, 1);
       dup2(tracefd, 2);
       close(tracefd);
+      /* budget the tracer so that it wraps up before we kill it,
+       * rather than leaving the trace half written */
+      if (!getenv("GIMLI_TRACE_BUDGET") && trace_interval > 4) {
+        snprintf(buf, sizeof(buf)-1, "%d", trace_interval * 3 / 4);
+        setenv("GIMLI_TRACE_BUDGET", buf, 1);
+      }
       execlp(cmdbuf, cmdbuf, pidbuf, (char*)NULL);
       logprint("execlp: %s %s failed: %s\n", cmdbuf, pidbuf, strerror(errno));
       _exit(1);
@@ -21,25 +21,12 @@ static int sort_compare_mapping(const void *A, const void *B)
   return a->len - b->len;
 }
 
-static int search_compare_mapping(const void *addrp, const void *L)
-{
-  gimli_addr_t addr = *(gimli_addr_t*)addrp;
-  struct gimli_object_mapping *m = *(struct gimli_object_mapping**)L;
-
-  if (addr < m->base) {
-    return -1;
-  }
-  if (addr < m->base + m->len) {
-    return 0;
-  }
-  return 1;
-}
-
 void gimli_show_memory_map(gimli_proc_t proc)
 {
   int i;
   /* print out the maps, coalesce adjacent maps for the same object */
-  printf("\nMEMORY MAP: (executable, shared objects and named mmaps)\n");
+  gimli_out_printf(
+      "\nMEMORY MAP: (executable, shared objects and named mmaps)\n");
   i = 0;
   while (i < proc->nmaps) {
     int j;
@@ -57,40 +44,285 @@ void gimli_show_memory_map(gimli_proc_t proc)
       break;
     }
 
-    printf(PTRFMT " - " PTRFMT " %s\n",
+    gimli_out_printf(PTRFMT " - " PTRFMT " %s\n",
         map->base, upper, map->objfile->objname);
     i++;
   }
-  printf("\n\n");
+  gimli_out_printf("\n\n");
 }
 
+static uint32_t map_generations = 0;
+
+static void grow_map_index(gimli_proc_t proc)
+{
+  if (proc->nmaps > proc->alloc_map_index) {
+    proc->alloc_map_index = proc->alloc_maps;
+    proc->map_index = realloc(proc->map_index,
+        proc->alloc_map_index * sizeof(struct gimli_mapping_index));
+  }
+}
+
+/* Rebuilds the index from the mappings, once they've changed */
+static void build_map_index(gimli_proc_t proc)
+{
+  struct gimli_mapping_index *idx;
+  int i;
+
+  /* (re)sort the list of maps */
+  qsort(proc->mappings, proc->nmaps, sizeof(struct gimli_object_mapping*),
+      sort_compare_mapping);
+
+  grow_map_index(proc);
+  for (i = 0; i < proc->nmaps; i++) {
+    idx = &proc->map_index[i];
+    idx->start = proc->mappings[i]->base;
+    idx->end = idx->start + proc->mappings[i]->len;
+    idx->map = proc->mappings[i];
+  }
+  proc->maps_changed = 0;
+  /* drawn from a global sequence, so that no two builds of any index
+   * look alike to last_map */
+  proc->map_generation = ++map_generations;
+}
+
+/* This sits beneath every symbol, FDE and DWARF lookup, and successive
+ * lookups tend to land in the same object, so each thread remembers
+ * its last hit.  Otherwise we binary search the flat index */
+static __thread struct {
+  gimli_proc_t proc;
+  uint32_t generation;
+  struct gimli_mapping_index hit;
+} last_map;
+
 struct gimli_object_mapping *gimli_mapping_for_addr(gimli_proc_t proc, gimli_addr_t addr)
 {
-  struct gimli_object_mapping **mptr, *m;
+  struct gimli_mapping_index *idx;
+  int lo, hi, mid;
 
   if (proc->maps_changed) {
-    /* (re)sort the list of maps */
-    qsort(proc->mappings, proc->nmaps, sizeof(struct gimli_object_mapping*),
-        sort_compare_mapping);
-    proc->maps_changed = 0;
+    build_map_index(proc);
   }
 
-  mptr = bsearch(&addr, proc->mappings, proc->nmaps, sizeof(struct gimli_object_mapping*),
-      search_compare_mapping);
+  if (last_map.proc == proc && last_map.generation == proc->map_generation &&
+      addr >= last_map.hit.start && addr < last_map.hit.end) {
+    return last_map.hit.map;
+  }
 
-  if (mptr) {
-    m = *mptr;
-    if (addr < m->base + m->len) {
-      return m;
+  lo = 0;
+  hi = proc->nmaps;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    idx = &proc->map_index[mid];
+    if (addr < idx->start) {
+      hi = mid;
+    } else if (addr >= idx->end) {
+      lo = mid + 1;
+    } else {
+      last_map.proc = proc;
+      last_map.generation = proc->map_generation;
+      last_map.hit = *idx;
+      return idx->map;
     }
   }
   return NULL;
 }
 
+/* Called as proc is freed; a later proc may be allocated at the same
+ * address, and must not be mistaken for this one */
+void gimli_forget_mappings(gimli_proc_t proc)
+{
+  if (last_map.proc == proc) {
+    memset(&last_map, 0, sizeof(last_map));
+  }
+  proc->map_generation = ++map_generations;
+}
+
+/* Records a region of the address space.  The OS reports these in
+ * address order, so we simply append */
+void gimli_add_region(gimli_proc_t proc, gimli_addr_t start,
+  gimli_addr_t end, int prot, int kind)
+{
+  struct gimli_vm_region *r;
+
+  if (proc->nregions + 1 >= proc->alloc_regions) {
+    proc->alloc_regions = proc->alloc_regions ? proc->alloc_regions * 2 : 64;
+    proc->regions = realloc(proc->regions,
+        proc->alloc_regions * sizeof(*r));
+  }
+  r = &proc->regions[proc->nregions++];
+  r->start = start;
+  r->end = end;
+  r->prot = prot;
+  r->kind = kind;
+  r->lwpid = 0;
+
+  /* the cache holds indices that may now be stale */
+  memset(proc->region_cache, 0, sizeof(proc->region_cache));
+}
+
+static int search_compare_region(const void *addrp, const void *R)
+{
+  gimli_addr_t addr = *(gimli_addr_t*)addrp;
+  struct gimli_vm_region *r = (struct gimli_vm_region*)R;
+
+  if (addr < r->start) {
+    return -1;
+  }
+  if (addr < r->end) {
+    return 0;
+  }
+  return 1;
+}
+
+struct gimli_vm_region *gimli_region_for_addr(gimli_proc_t proc,
+  gimli_addr_t addr)
+{
+  gimli_addr_t page = addr >> GIMLI_REGION_PAGE_SHIFT;
+  struct gimli_vm_region_cache *c =
+    &proc->region_cache[page & (GIMLI_REGION_CACHE_SIZE - 1)];
+  struct gimli_vm_region *r;
+
+  /* regions are made of whole pages, so any address in the page
+   * lies in the same region */
+  if (c->region && c->page == page) {
+    return &proc->regions[c->region - 1];
+  }
+
+  r = bsearch(&addr, proc->regions, proc->nregions,
+      sizeof(struct gimli_vm_region), search_compare_region);
+  if (r) {
+    c->page = page;
+    c->region = (r - proc->regions) + 1;
+  }
+  return r;
+}
+
+/* Returns true if all len bytes at addr are mapped readable in the
+ * target.  This is answered from the region table, without touching
+ * the target, unless the OS didn't give us one; in that case we probe
+ * the first and the last byte */
+int gimli_addr_readable(gimli_proc_t proc, gimli_addr_t addr, size_t len)
+{
+  gimli_addr_t end = addr + (len ? len : 1);
+  struct gimli_vm_region *r;
+  char dummy;
+
+  if (end < addr) {
+    return 0;
+  }
+  if (proc->nregions == 0) {
+    return gimli_read_mem(proc, addr, &dummy, 1) == 1 &&
+      gimli_read_mem(proc, end - 1, &dummy, 1) == 1;
+  }
+  while (addr < end) {
+    r = gimli_region_for_addr(proc, addr);
+    if (!r || !(r->prot & PROT_READ)) {
+      return 0;
+    }
+    addr = r->end;
+  }
+  return 1;
+}
+
+/* Describes the anonymous memory holding addr, such as "heap" or "stack
+ * of LWP 42".  Returns NULL for file backed memory, where a symbol
+ * name says more, and for addresses that aren't mapped at all */
+const char *gimli_region_describe(gimli_proc_t proc, gimli_addr_t addr,
+  char *buf, int buflen)
+{
+  struct gimli_vm_region *r = gimli_region_for_addr(proc, addr);
+
+  if (!r) {
+    return NULL;
+  }
+  switch (r->kind) {
+    case gimli_vm_region_is_heap:
+      return "heap";
+    case gimli_vm_region_is_stack:
+    case gimli_vm_region_is_thread_stack:
+      if (r->lwpid) {
+        snprintf(buf, buflen, "stack of LWP %d", r->lwpid);
+        return buf;
+      }
+      return "stack";
+    case gimli_vm_region_is_anon:
+      return "anon mmap";
+    default:
+      return NULL;
+  }
+}
+
+/* If addr lies in memory that could be a stack (private, writable and
+ * not backed by a file), returns 1 and its bounds */
+int gimli_stack_region_for_addr(gimli_proc_t proc, gimli_addr_t addr,
+  gimli_addr_t *lo, gimli_addr_t *hi)
+{
+  struct gimli_vm_region *r = gimli_region_for_addr(proc, addr);
+
+  if (!r || (r->prot & (PROT_READ|PROT_WRITE)) != (PROT_READ|PROT_WRITE)) {
+    return 0;
+  }
+  switch (r->kind) {
+    case gimli_vm_region_is_anon:
+    case gimli_vm_region_is_stack:
+    case gimli_vm_region_is_thread_stack:
+      *lo = r->start;
+      *hi = r->end;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* Determines the stack bounds for a thread.  base and size come from
+ * the thread library, if it told us; not all of them do (glibc does
+ * not), and they don't agree on whether base is the top or the
+ * bottom, so we only trust them if they contain the stack pointer.
+ * Otherwise the region holding the stack pointer is used */
+void gimli_set_thread_stack(gimli_proc_t proc,
+  struct gimli_thread_state *thr, gimli_addr_t base, size_t size)
+{
+  gimli_addr_t sp = (gimli_addr_t)thr->sp;
+  struct gimli_vm_region *r;
+
+  thr->stack_lo = 0;
+  thr->stack_hi = 0;
+
+  if (base && size) {
+    if (sp >= base && sp < base + size) {
+      thr->stack_lo = base;
+      thr->stack_hi = base + size;
+    } else if (sp < base && sp >= base - size) {
+      thr->stack_lo = base - size;
+      thr->stack_hi = base;
+    }
+  }
+  if (!thr->stack_hi &&
+      !gimli_stack_region_for_addr(proc, sp,
+        &thr->stack_lo, &thr->stack_hi)) {
+    return;
+  }
+
+  r = gimli_region_for_addr(proc, sp);
+  if (r && r->kind == gimli_vm_region_is_anon) {
+    r->kind = gimli_vm_region_is_thread_stack;
+  }
+  if (r && (r->kind == gimli_vm_region_is_stack ||
+        r->kind == gimli_vm_region_is_thread_stack)) {
+    r->lwpid = thr->lwpid;
+  }
+  if (debug) {
+    fprintf(stderr, "STACK: lwp %d " PTRFMT " - " PTRFMT "\n",
+        thr->lwpid, (PTRFMT_T)thr->stack_lo, (PTRFMT_T)thr->stack_hi);
+  }
+}
+
 const char *gimli_data_sym_name(gimli_proc_t proc, gimli_addr_t addr, char *buf, int buflen)
 {
   struct gimli_object_mapping *m;
   struct gimli_symbol *s;
+  const char *name;
+  uint64_t off;
 
   m = gimli_mapping_for_addr(proc, (gimli_addr_t)addr);
   if (m) {
@@ -102,6 +334,15 @@ const char *gimli_data_sym_name(gimli_proc_t proc, gimli_addr_t addr, char *buf,
         snprintf(buf, buflen-1, "%s`%s+%lx",
             m->objfile->objname, s->name, (uintmax_t)(addr - s->addr));
       }
+    } else if ((name = gimli_dwarf_data_var_name(proc, addr, &off))) {
+      /* not in the symbol table (a static that was stripped, say),
+       * but the debug info knows where it is */
+      if (off) {
+        snprintf(buf, buflen-1, "%s`%s+%" PRIx64,
+            m->objfile->objname, name, off);
+      } else {
+        snprintf(buf, buflen-1, "%s`%s", m->objfile->objname, name);
+      }
     } else {
       /* just identify the containing module; the caller will typically
        * annotate with the address */
@@ -141,6 +382,7 @@ struct gimli_object_mapping *gimli_add_mapping(
   unsigned long offset)
 {
   struct gimli_object_mapping *m = calloc(1, sizeof(*m));
+  struct gimli_mapping_index *idx;
 
   m->proc = proc; // FIXME: refcnt
   m->base = base;
@@ -156,9 +398,31 @@ struct gimli_object_mapping *gimli_add_mapping(
   }
 
   /* add to our collection */
-  proc->mappings = realloc(proc->mappings, (proc->nmaps + 1) * sizeof(m));
+  if (proc->nmaps + 1 >= proc->alloc_maps) {
+    proc->alloc_maps = proc->alloc_maps ? proc->alloc_maps * 2 : 64;
+    proc->mappings = realloc(proc->mappings,
+        proc->alloc_maps * sizeof(m));
+  }
   proc->mappings[proc->nmaps++] = m;
-  proc->maps_changed = 1;
+  if (proc->nmaps == 1) {
+    /* no proc's index ever shares a generation, even if it is never
+     * rebuilt, so a last_map hit can't outlive its proc */
+    proc->map_generation = ++map_generations;
+  }
+
+  /* the OS reports mappings in address order, so they normally go on
+   * the end of the index as they are; lookups made while we're still
+   * loading the maps then don't have to rebuild it */
+  if (!proc->maps_changed && (proc->nmaps == 1 ||
+        proc->mappings[proc->nmaps - 2]->base < base)) {
+    grow_map_index(proc);
+    idx = &proc->map_index[proc->nmaps - 1];
+    idx->start = base;
+    idx->end = base + len;
+    idx->map = m;
+  } else {
+    proc->maps_changed = 1;
+  }
 
   return m;
 }
@@ -211,8 +475,11 @@ void gimli_mapped_object_delete(gimli_mapped_object_t file)
   if (file->aux_elf) {
     gimli_object_file_destroy(file->aux_elf);
   }
-  if (file->lines) {
-    free(file->lines);
+  if (file->line_tables) {
+    gimli_hash_destroy(file->line_tables);
+  }
+  if (file->line_seqs) {
+    free(file->line_seqs);
   }
   if (file->types) {
     gimli_type_collection_delete(file->types);
@@ -227,6 +494,8 @@ void gimli_mapped_object_delete(gimli_mapped_object_t file)
     destroy_cu(file->debug_info.cus);
   }
   free(file->arange);
+  free(file->pcranges);
+  free(file->varaddrs);
   gimli_dw_fde_destroy(file);
   gimli_slab_destroy(&file->dieslab);
   gimli_slab_destroy(&file->attrslab);
@@ -255,11 +524,27 @@ gimli_mapped_object_t gimli_add_object(
   const char *objname, gimli_addr_t base)
 {
   gimli_mapped_object_t f = gimli_find_object(proc, objname);
-  struct gimli_symbol *sym;
-  char *name = NULL;
 
   if (f) return f;
 
+#ifndef __MACH__
+  return gimli_add_object_with_elf(proc, objname, base,
+      gimli_elf_open(objname));
+#else
+  return gimli_add_object_with_elf(proc, objname, base, NULL);
+#endif
+}
+
+/* Adds an object whose image has already been opened; this allows
+ * the image to come from somewhere other than the named file, such as
+ * the memory of the target.  Takes ownership of elf */
+gimli_mapped_object_t gimli_add_object_with_elf(
+  gimli_proc_t proc,
+  const char *objname, gimli_addr_t base,
+  gimli_object_file_t elf)
+{
+  gimli_mapped_object_t f;
+
   f = calloc(1, sizeof(*f));
   f->refcnt = 1;
   f->objname = strdup(objname);
@@ -274,7 +559,7 @@ gimli_mapped_object_t gimli_add_object(
   }
 
 #ifndef __MACH__
-  f->elf = gimli_elf_open(f->objname);
+  f->elf = elf;
   if (f->elf) {
     f->elf->gobject = f;
     /* need to determine the base address offset for this object */
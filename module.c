@@ -20,11 +20,23 @@ static STAILQ_HEAD(modulelist, module_item)
 
 static gimli_hash_t hooks = NULL;
 
+/* true if any v2 modules, which have per-frame and per-thread
+ * callbacks, were loaded */
+int gimli_have_modules(void)
+{
+  return STAILQ_FIRST(&modules) != NULL;
+}
+
 gimli_iter_status_t gimli_visit_modules(gimli_module_visit_f func, void *arg)
 {
   struct module_item *mod;
   gimli_iter_status_t status = GIMLI_ITER_CONT;
 
+  /* modules print with stdio; put what we've rendered ahead of them */
+  if (STAILQ_FIRST(&modules)) {
+    gimli_out_flush();
+  }
+
   STAILQ_FOREACH(mod, &modules, modules) {
     status = func(mod, arg);
     if (status != GIMLI_ITER_CONT) {
@@ -62,9 +74,9 @@ static gimli_iter_status_t v2_printer_shim(gimli_proc_t proc,
 
   if (mod->ptr.v2->before_print_frame_var(&ana_api,
         mod->exename,
-        frame ? frame->cur.tid : 0,
-        frame ? frame->cur.frameno : 0,
-        frame ? frame->cur.st.pc : 0,
+        frame ? frame->trace->thr->lwpid : 0,
+        frame ? frame->frameno : 0,
+        frame ? (void*)frame->pc : 0,
         frame,
         typename,
         varname,
@@ -170,6 +182,13 @@ static gimli_iter_status_t load_modules_for_file(const char *k, int klen,
 {
   gimli_mapped_object_t file = item;
 
+  /* synthetic objects such as [vdso], JIT code or memfd mappings have no
+   * directory of their own; resolving a module name relative to them
+   * would load whatever happens to be in our cwd */
+  if (file->objname[0] != '/' || access(file->objname, F_OK)) {
+    return GIMLI_ITER_CONT;
+  }
+
   load_module_for_file(file);
 
   return GIMLI_ITER_CONT;
@@ -0,0 +1,561 @@
+/*
+ * Copyright (c) 2012 Message Systems, Inc. All rights reserved
+ * For licensing information, see:
+ * https://bitbucket.org/wez/gimli/src/tip/LICENSE
+ */
+#include "impl.h"
+
+/* Everything that we render for a trace is accumulated in an output
+ * buffer and written out with large writes.  By default that is the
+ * buffer for stdout, but a thread may direct its rendering into a
+ * buffer of its own (see gimli_out_target()) so that several threads
+ * can render at once and have their output stitched together later.
+ *
+ * Modules print using stdio, so we flush before handing control to
+ * them; see gimli_visit_modules() and gimli_module_call_tracers().
+ * In a structured stream their output is instead captured and
+ * emitted as a record of its own; see gimli_out_capture_begin() */
+struct gimli_outbuf {
+  char *buf;
+  size_t len;
+  size_t alloc;
+  /* where the buffer is written when it fills, or -1 to let it grow */
+  int fd;
+};
+
+#define OUTBUF_SIZE 65536
+
+static struct gimli_outbuf stdout_buf = { NULL, 0, 0, STDOUT_FILENO };
+static __thread struct gimli_outbuf *target = NULL;
+static int registered = 0;
+
+#define OUT (target ? target : &stdout_buf)
+
+static void outbuf_flush(struct gimli_outbuf *b)
+{
+  char *p = b->buf;
+  size_t n = b->len;
+  ssize_t w;
+
+  if (b->fd == -1 || n == 0) {
+    return;
+  }
+  b->len = 0;
+
+  if (b->fd == STDOUT_FILENO) {
+    /* hand it to stdio, so that it stays in order with whatever
+     * modules print there.  This is cheap: a chunk of this size
+     * goes straight out */
+    fwrite(p, 1, n, stdout);
+    return;
+  }
+  while (n) {
+    w = write(b->fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    p += w;
+    n -= w;
+  }
+}
+
+static void flush_at_exit(void)
+{
+  outbuf_flush(&stdout_buf);
+}
+
+/* Makes room for at least len more bytes */
+static char *outbuf_reserve(struct gimli_outbuf *b, size_t len)
+{
+  size_t alloc;
+
+  if (b->len + len > b->alloc) {
+    outbuf_flush(b);
+    if (b->len + len > b->alloc) {
+      alloc = b->alloc ? b->alloc : OUTBUF_SIZE;
+      while (alloc < b->len + len) {
+        alloc *= 2;
+      }
+      b->buf = realloc(b->buf, alloc);
+      b->alloc = alloc;
+    }
+    if (b == &stdout_buf && !registered) {
+      registered = 1;
+      atexit(flush_at_exit);
+    }
+  }
+  return b->buf + b->len;
+}
+
+struct gimli_outbuf *gimli_outbuf_new(void)
+{
+  struct gimli_outbuf *b = calloc(1, sizeof(*b));
+
+  b->fd = -1;
+  return b;
+}
+
+void gimli_outbuf_delete(struct gimli_outbuf *b)
+{
+  free(b->buf);
+  free(b);
+}
+
+/* Directs the calling thread's output to b, or back to stdout if b is
+ * NULL.  Returns the previous target */
+struct gimli_outbuf *gimli_out_target(struct gimli_outbuf *b)
+{
+  struct gimli_outbuf *prior = target;
+
+  target = b;
+  return prior;
+}
+
+/* Moves everything accumulated in b to the calling thread's output */
+void gimli_out_append(struct gimli_outbuf *b)
+{
+  gimli_out_write(b->buf, b->len);
+  b->len = 0;
+}
+
+void gimli_out_flush(void)
+{
+  outbuf_flush(OUT);
+}
+
+void gimli_out_write(const char *buf, size_t len)
+{
+  struct gimli_outbuf *b = OUT;
+
+  if (len == 0) {
+    return;
+  }
+  memcpy(outbuf_reserve(b, len), buf, len);
+  b->len += len;
+}
+
+void gimli_out_puts(const char *str)
+{
+  gimli_out_write(str, strlen(str));
+}
+
+void gimli_out_putc(int c)
+{
+  struct gimli_outbuf *b = OUT;
+
+  if (b->len == b->alloc) {
+    outbuf_reserve(b, 1);
+  }
+  b->buf[b->len++] = c;
+}
+
+void gimli_out_spaces(int n)
+{
+  struct gimli_outbuf *b = OUT;
+
+  if (n <= 0) {
+    return;
+  }
+  memset(outbuf_reserve(b, n), ' ', n);
+  b->len += n;
+}
+
+void gimli_out_printf(const char *fmt, ...)
+{
+  struct gimli_outbuf *b = OUT;
+  va_list ap;
+  size_t avail;
+  int n;
+
+  outbuf_reserve(b, 1);
+  avail = b->alloc - b->len;
+
+  va_start(ap, fmt);
+  n = vsnprintf(b->buf + b->len, avail, fmt, ap);
+  va_end(ap);
+  if (n < 0) {
+    return;
+  }
+  if ((size_t)n >= avail) {
+    /* didn't fit; make room and try again */
+    outbuf_reserve(b, n + 1);
+    va_start(ap, fmt);
+    vsnprintf(b->buf + b->len, n + 1, fmt, ap);
+    va_end(ap);
+  }
+  b->len += n;
+}
+
+/* Word-at-a-time tests; see "Bit Twiddling Hacks".  HAS_LESS is
+ * exact for n <= 128 */
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+#define HAS_LESS(x, n) (((x) - ONES * (n)) & ~(x) & HIGHS)
+#define HAS_BYTE(x, c) HAS_LESS((x) ^ (ONES * (c)), 1)
+
+/* Returns the length of the run at the start of buf that is printable
+ * ASCII; for json, it also stops at characters that need escaping.
+ * Most of what we render is plain, so we check eight bytes at a time
+ * and only look at individual bytes near the end of the run */
+size_t gimli_out_printable_run(const char *buf, size_t len, int json)
+{
+  size_t i = 0;
+  uint64_t x;
+  unsigned char c;
+
+  while (i + sizeof(x) <= len) {
+    memcpy(&x, buf + i, sizeof(x));
+    /* control characters, or DEL and above */
+    if (HAS_LESS(x, 0x20) || (((x + ONES) | x) & HIGHS)) {
+      break;
+    }
+    if (json && (HAS_BYTE(x, '"') || HAS_BYTE(x, '\\'))) {
+      break;
+    }
+    i += sizeof(x);
+  }
+  for (; i < len; i++) {
+    c = buf[i];
+    if (c < 0x20 || c >= 0x7f || (json && (c == '"' || c == '\\'))) {
+      break;
+    }
+  }
+  return i;
+}
+
+/* Writes len bytes of buf as the body of a JSON string; the caller
+ * supplies the surrounding quotes */
+void gimli_out_json_chars(const char *buf, size_t len)
+{
+  static const char hex[] = "0123456789abcdef";
+  const char *end = buf + len;
+  char esc[6] = { '\\', 'u', '0', '0', 0, 0 };
+  unsigned char c;
+  size_t n;
+
+  while (buf < end) {
+    n = gimli_out_printable_run(buf, end - buf, 1);
+    gimli_out_write(buf, n);
+    buf += n;
+    if (buf == end) {
+      break;
+    }
+    c = *buf++;
+    switch (c) {
+      case '"': gimli_out_write("\\\"", 2); break;
+      case '\\': gimli_out_write("\\\\", 2); break;
+      case '\n': gimli_out_write("\\n", 2); break;
+      case '\r': gimli_out_write("\\r", 2); break;
+      case '\t': gimli_out_write("\\t", 2); break;
+      default:
+        /* the target's bytes are not necessarily UTF-8; escape
+         * anything outside of printable ASCII so that we always
+         * produce valid JSON */
+        esc[4] = hex[c >> 4];
+        esc[5] = hex[c & 0xf];
+        gimli_out_write(esc, 6);
+    }
+  }
+}
+
+void gimli_out_json_string(const char *str)
+{
+  if (!str) {
+    gimli_out_write("null", 4);
+    return;
+  }
+  gimli_out_putc('"');
+  gimli_out_json_chars(str, strlen(str));
+  gimli_out_putc('"');
+}
+
+/* While capturing, stdout is pointed at a scratch file, and what the
+ * modules write there is handed to the backend when they return */
+static int capture_fd = -1;
+static int saved_stdout = -1;
+
+/* Call before running module code that may print.  In a text trace
+ * its output simply goes inline, so this does nothing */
+void gimli_out_capture_begin(void)
+{
+  FILE *fp;
+
+  if (!gimli_output->structured || saved_stdout != -1) {
+    return;
+  }
+  if (capture_fd == -1) {
+    fp = tmpfile();
+    if (!fp) {
+      return;
+    }
+    capture_fd = dup(fileno(fp));
+    fclose(fp);
+    if (capture_fd == -1) {
+      return;
+    }
+  }
+  fflush(stdout);
+  saved_stdout = dup(STDOUT_FILENO);
+  if (saved_stdout == -1) {
+    return;
+  }
+  dup2(capture_fd, STDOUT_FILENO);
+}
+
+/* Call once the module code returns; anything that it printed is
+ * emitted as a record attributed to thread tid and frame depth (either
+ * may be -1) and the name of the hook that was run */
+void gimli_out_capture_end(int tid, int depth, const char *hook)
+{
+  off_t len;
+  ssize_t n;
+  char *buf;
+
+  if (saved_stdout == -1) {
+    return;
+  }
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+  saved_stdout = -1;
+
+  len = lseek(capture_fd, 0, SEEK_END);
+  if (len > 0) {
+    buf = malloc(len);
+    if (buf) {
+      n = pread(capture_fd, buf, len, 0);
+      if (n > 0) {
+        gimli_output->module_output(tid, depth, hook, buf, n);
+      }
+      free(buf);
+    }
+  }
+  if (ftruncate(capture_fd, 0) == 0) {
+    lseek(capture_fd, 0, SEEK_SET);
+  }
+}
+
+/* {{{ text: the traditional human readable rendering */
+
+static void text_begin_process(gimli_proc_t proc)
+{
+  gimli_show_memory_map(proc);
+}
+
+static void text_begin_thread(int tid, gimli_stack_trace_t trace,
+    gimli_thread_t *shared, int nshared)
+{
+  int i;
+
+  if (shared) {
+    gimli_out_printf("%d thread%s with this stack: LWP", nshared,
+        nshared == 1 ? "" : "s");
+    for (i = 0; i < nshared; i++) {
+      gimli_out_printf(" %d", shared[i]->lwpid);
+    }
+    gimli_out_putc('\n');
+  }
+  gimli_out_printf("Thread %d (LWP %d)\n", tid, trace->thr->lwpid);
+}
+
+static void text_render_frame(int tid, gimli_stack_frame_t frame)
+{
+  gimli_render_frame(tid, frame->frameno, frame);
+}
+
+static void text_render_stack(int tid, gimli_stack_trace_t trace,
+    gimli_thread_t *shared, int nshared)
+{
+  text_begin_thread(tid, trace, shared, nshared);
+  gimli_render_stack(tid, trace);
+  gimli_out_putc('\n');
+}
+
+static void text_end_thread(int tid, gimli_stack_trace_t trace)
+{
+  gimli_out_putc('\n');
+}
+
+static void text_end_process(gimli_proc_t proc)
+{
+  gimli_out_putc('\n');
+}
+
+static void text_omitted(int tid, int depth, int count, const char *what)
+{
+  if (count) {
+    gimli_out_printf("    [%d %s omitted: %s budget exhausted]\n",
+        count, what, gimli_budget_reason());
+  } else {
+    gimli_out_printf("    [%s omitted: %s budget exhausted]\n",
+        what, gimli_budget_reason());
+  }
+}
+
+static void text_module_output(int tid, int depth, const char *hook,
+    const char *text, size_t len)
+{
+  gimli_out_write(text, len);
+}
+
+static struct gimli_output_backend text_output = {
+  "text",
+  0,
+  text_begin_process,
+  text_begin_thread,
+  text_render_frame,
+  text_render_stack,
+  text_end_thread,
+  text_end_process,
+  text_omitted,
+  text_module_output,
+};
+
+/* }}} */
+
+/* {{{ json: one JSON object per line; a process record, a stack record
+ * for each thread, then a thread record for each thread followed by its
+ * frames, each followed by its variables.  What modules print is
+ * carried in "module" records.  Every record carries a "type" field */
+
+static void json_begin_process(gimli_proc_t proc)
+{
+  gimli_out_printf("{\"type\":\"process\",\"pid\":%d,\"exe\":", proc->pid);
+  gimli_out_json_string(proc->first_file ? proc->first_file->objname : NULL);
+  gimli_out_write("}\n", 2);
+}
+
+/* the fields common to thread and stack records */
+static void json_thread_fields(int tid, gimli_stack_trace_t trace,
+    gimli_thread_t *shared, int nshared)
+{
+  int i;
+
+  gimli_out_printf(",\"thread\":%d,\"lwp\":%d,"
+      "\"frames\":%d,\"truncated\":%s", tid, trace->thr->lwpid,
+      trace->num_frames, trace->truncated ? "true" : "false");
+  if (shared) {
+    gimli_out_write(",\"lwps\":[", 9);
+    for (i = 0; i < nshared; i++) {
+      gimli_out_printf("%s%d", i ? "," : "", shared[i]->lwpid);
+    }
+    gimli_out_putc(']');
+  }
+}
+
+static void json_begin_thread(int tid, gimli_stack_trace_t trace,
+    gimli_thread_t *shared, int nshared)
+{
+  gimli_out_printf("{\"type\":\"thread\"");
+  json_thread_fields(tid, trace, shared, nshared);
+  gimli_out_write("}\n", 2);
+}
+
+/* a stack record holds the frames inline, in the same form as frame
+ * records but without the source lines */
+static void json_render_stack(int tid, gimli_stack_trace_t trace,
+    gimli_thread_t *shared, int nshared)
+{
+  gimli_out_printf("{\"type\":\"stack\"");
+  json_thread_fields(tid, trace, shared, nshared);
+  gimli_out_printf(",\"stack\":");
+  gimli_json_render_stack(tid, trace);
+  gimli_out_write("}\n", 2);
+}
+
+static void json_end_thread(int tid, gimli_stack_trace_t trace)
+{
+}
+
+static void json_end_process(gimli_proc_t proc)
+{
+}
+
+static void json_omitted(int tid, int depth, int count, const char *what)
+{
+  gimli_out_printf("{\"type\":\"omitted\"");
+  if (tid >= 0) {
+    gimli_out_printf(",\"thread\":%d", tid);
+  }
+  if (depth >= 0) {
+    gimli_out_printf(",\"frame\":%d", depth);
+  }
+  gimli_out_printf(",\"what\":");
+  gimli_out_json_string(what);
+  if (count) {
+    gimli_out_printf(",\"count\":%d", count);
+  }
+  gimli_out_printf(",\"reason\":");
+  gimli_out_json_string(gimli_budget_reason());
+  gimli_out_write("}\n", 2);
+}
+
+static void json_module_output(int tid, int depth, const char *hook,
+    const char *text, size_t len)
+{
+  gimli_out_printf("{\"type\":\"module\"");
+  if (tid >= 0) {
+    gimli_out_printf(",\"thread\":%d", tid);
+  }
+  if (depth >= 0) {
+    gimli_out_printf(",\"frame\":%d", depth);
+  }
+  gimli_out_printf(",\"hook\":");
+  gimli_out_json_string(hook);
+  gimli_out_printf(",\"text\":\"");
+  gimli_out_json_chars(text, len);
+  gimli_out_write("\"}\n", 3);
+}
+
+static struct gimli_output_backend json_output = {
+  "json",
+  1,
+  json_begin_process,
+  json_begin_thread,
+  gimli_json_render_frame,
+  json_render_stack,
+  json_end_thread,
+  json_end_process,
+  json_omitted,
+  json_module_output,
+};
+
+/* }}} */
+
+struct gimli_output_backend *gimli_output = &text_output;
+
+/* Selects the output backend.  The library prints diagnostics to
+ * stdout as it goes; those would spoil a structured stream, so in that
+ * case we keep the real stdout for the records and send anything else
+ * that is printed there to stderr instead */
+int gimli_set_output_format(const char *name)
+{
+  struct gimli_output_backend *backend;
+  int fd;
+
+  if (!strcmp(name, text_output.name)) {
+    backend = &text_output;
+  } else if (!strcmp(name, json_output.name)) {
+    backend = &json_output;
+  } else {
+    return 0;
+  }
+
+  if (backend->structured && stdout_buf.fd == STDOUT_FILENO) {
+    outbuf_flush(&stdout_buf);
+    fflush(stdout);
+    fd = dup(STDOUT_FILENO);
+    if (fd == -1) {
+      fprintf(stderr, "unable to claim stdout: %s\n", strerror(errno));
+      return 0;
+    }
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    stdout_buf.fd = fd;
+  }
+  gimli_output = backend;
+  return 1;
+}
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2012 Message Systems, Inc. All rights reserved
+ * For licensing information, see:
+ * https://bitbucket.org/wez/gimli/src/tip/LICENSE
+ */
+#include "impl.h"
+#include <sys/stat.h>
+
+/* JIT compilers (LuaJIT, the PCRE JIT and friends) describe the code
+ * that they generate by appending "START SIZE name" lines to
+ * /tmp/perf-<pid>.map.  That code lives in anonymous executable
+ * mappings; each of those is given a synthetic object, and symbols
+ * from the map are added to the object whose mapping contains them.
+ * The map is only ever appended to, so we remember how far we have
+ * read and pick up from there when the file changes.
+ *
+ * Anyone can create a file in /tmp, so, like perf, we only believe a
+ * map that belongs to the target (or root) and that nobody else can
+ * write to; otherwise a local user could plant names in our traces */
+struct gimli_perf_map {
+  gimli_proc_t proc;
+  char *path;
+  /* owner of the target process */
+  uid_t uid;
+  /* how much of the file we have consumed, and how it looked then */
+  off_t offset;
+  off_t size;
+  time_t mtime;
+  /* when we last looked at the file */
+  time_t checked;
+  /* symbol names; the symbol tables point into these */
+  char **names;
+  uint32_t num_names;
+  uint32_t alloc_names;
+};
+
+static int is_trusted(struct gimli_perf_map *map, struct stat *st)
+{
+  if (!S_ISREG(st->st_mode)) {
+    return 0;
+  }
+  if (st->st_uid != map->uid && st->st_uid != 0) {
+    return 0;
+  }
+  if (st->st_mode & (S_IWGRP|S_IWOTH)) {
+    return 0;
+  }
+  return 1;
+}
+
+struct gimli_perf_map *gimli_perf_map_open(gimli_proc_t proc)
+{
+  struct gimli_perf_map *map;
+  char path[1024];
+  struct stat st;
+  uid_t uid;
+
+  snprintf(path, sizeof(path), "/proc/%d", proc->pid);
+  if (stat(path, &st) != 0) {
+    return NULL;
+  }
+  uid = st.st_uid;
+
+  snprintf(path, sizeof(path), "/tmp/perf-%d.map", proc->pid);
+  if (stat(path, &st) != 0) {
+    return NULL;
+  }
+
+  map = calloc(1, sizeof(*map));
+  map->proc = proc;
+  map->uid = uid;
+  map->path = strdup(path);
+
+  if (!is_trusted(map, &st)) {
+    fprintf(stderr, "ignoring %s: not owned by uid %d or root, "
+        "or writable by others\n", path, (int)uid);
+    gimli_perf_map_destroy(map);
+    return NULL;
+  }
+  return map;
+}
+
+void gimli_perf_map_destroy(struct gimli_perf_map *map)
+{
+  uint32_t i;
+
+  for (i = 0; i < map->num_names; i++) {
+    free(map->names[i]);
+  }
+  free(map->names);
+  free(map->path);
+  free(map);
+}
+
+/* Creates the synthetic object for an anonymous executable mapping
+ * that may hold JIT code described by the map */
+void gimli_perf_map_add_region(struct gimli_perf_map *map,
+  gimli_addr_t base, unsigned long len)
+{
+  gimli_proc_t proc = map->proc;
+  gimli_mapped_object_t f;
+  char name[64];
+
+  snprintf(name, sizeof(name), "[jit " PTRFMT "]", (PTRFMT_T)base);
+  f = gimli_add_object_with_elf(proc, name, base, NULL);
+  f->perf_map = map;
+  /* JIT code is often placed low in the address space; don't let it
+   * pose as the main executable */
+  if (proc->first_file == f) {
+    proc->first_file = NULL;
+  }
+  gimli_add_mapping(proc, name, base, len, 0);
+}
+
+static void parse_line(struct gimli_perf_map *map, char *line)
+{
+  struct gimli_object_mapping *m;
+  gimli_addr_t start;
+  uint64_t size;
+  char *end, *name;
+
+  start = strtoull(line, &end, 16);
+  if (end == line || *end != ' ') {
+    return;
+  }
+  size = strtoull(end + 1, &end, 16);
+  if (*end != ' ' || size == 0) {
+    return;
+  }
+
+  /* code placed after we read the mappings has nowhere to go */
+  m = gimli_mapping_for_addr(map->proc, start);
+  if (!m || m->objfile->perf_map != map) {
+    return;
+  }
+
+  name = strdup(end + 1);
+  if (map->num_names + 1 >= map->alloc_names) {
+    map->alloc_names = map->alloc_names ? map->alloc_names * 2 : 1024;
+    map->names = realloc(map->names, map->alloc_names * sizeof(char*));
+  }
+  map->names[map->num_names++] = name;
+
+  gimli_add_symbol(m->objfile, name, start, size);
+}
+
+static gimli_iter_status_t forget_symbols(const char *k, int klen,
+    void *item, void *arg)
+{
+  gimli_mapped_object_t f = item;
+
+  if (f->perf_map == arg) {
+    /* the names stay allocated until the map is destroyed, as
+     * callers may still be holding on to them */
+    f->symcount = 0;
+    f->symchanged = 1;
+  }
+  return GIMLI_ITER_CONT;
+}
+
+/* Loads any symbols that have been added to the map since we last
+ * looked.  This is cheap to call often; the file is examined at most
+ * once per second and only read when its size or mtime change */
+void gimli_perf_map_refresh(struct gimli_perf_map *map)
+{
+  time_t now = time(NULL);
+  char line[1024];
+  struct stat st;
+  FILE *fp;
+  size_t n;
+  int c;
+
+  if (map->checked == now) {
+    return;
+  }
+  map->checked = now;
+
+  if (stat(map->path, &st) != 0) {
+    return;
+  }
+  if (st.st_size == map->size && st.st_mtime == map->mtime) {
+    return;
+  }
+  if (st.st_size < map->offset) {
+    /* it was rewritten rather than appended to; start over, and
+     * drop what we loaded from the old contents so that we don't
+     * end up with each symbol twice */
+    map->offset = 0;
+    gimli_hash_iter(map->proc->files, forget_symbols, map);
+  }
+
+  fp = fopen(map->path, "r");
+  if (!fp) {
+    return;
+  }
+  /* check what we actually opened; the name may have been replaced */
+  if (fstat(fileno(fp), &st) != 0 || !is_trusted(map, &st)) {
+    fclose(fp);
+    return;
+  }
+  if (fseeko(fp, map->offset, SEEK_SET) == 0) {
+    while (fgets(line, sizeof(line), fp)) {
+      n = strlen(line);
+      if (line[n-1] != '\n') {
+        if (feof(fp)) {
+          /* the JIT is part way through writing this line;
+           * we'll get the rest of it next time */
+          break;
+        }
+        /* too long to be useful; skip to the end of it */
+        while ((c = fgetc(fp)) != EOF) {
+          n++;
+          if (c == '\n') break;
+        }
+        map->offset += n;
+        continue;
+      }
+      map->offset += n;
+      line[n-1] = '\0';
+      parse_line(map, line);
+    }
+  }
+  fclose(fp);
+
+  map->size = st.st_size;
+  map->mtime = st.st_mtime;
+}
+
+/* vim:ts=2:sw=2:et:
+ */
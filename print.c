@@ -4,14 +4,22 @@
  * https://bitbucket.org/wez/gimli/src/tip/LICENSE
  */
 #include "impl.h"
+#include <math.h>
 
-static gimli_hash_t derefd = NULL;
 static int max_depth = 4;
 static int max_arr = 16;
 
 static char indentstr[] =
 "                                                                      ";
 
+static void print_indent(int n)
+{
+  if (n > (int)sizeof(indentstr) - 1) {
+    n = sizeof(indentstr) - 1;
+  }
+  gimli_out_spaces(n);
+}
+
 struct print_data {
   gimli_proc_t proc;
   gimli_stack_frame_t frame;
@@ -22,6 +30,8 @@ struct print_data {
   unsigned in_array;
   const char *prefix;
   const char *suffix;
+  /* variables skipped for want of budget */
+  int omitted;
 
   int depth;
   gimli_var_t var;
@@ -34,40 +44,254 @@ struct print_data {
 
 static int print_var(struct print_data *data, gimli_type_t t, const char *varname);
 
+/* The structs and unions that we've rendered, keyed by their type and
+ * address, so that anything reachable along more than one path is
+ * shown only once; later references name the variable under which it
+ * was shown.  The set is an open addressed table that lasts for the
+ * rendering of one thread, and stops growing at DEREF_SET_MAX.
+ * Each rendering thread has a set of its own */
+struct deref_entry {
+  gimli_type_t type;
+  gimli_addr_t addr;
+  /* where it was rendered */
+  gimli_var_t var;
+  int frame;
+};
+
+struct deref_set {
+  /* the thread whose variables these are */
+  gimli_thread_t owner;
+  struct deref_entry *slots;
+  unsigned size;
+  unsigned count;
+};
+
+#define DEREF_SET_MAX 65536
+
+static __thread struct deref_set derefs;
+static pthread_once_t deref_once = PTHREAD_ONCE_INIT;
+static pthread_key_t deref_key;
+
+/* frees a rendering thread's set as it exits */
+static void tidy_deref(void *ptr)
+{
+  struct deref_set *set = ptr;
+
+  free(set->slots);
+  memset(set, 0, sizeof(*set));
+}
+
+static void make_deref_key(void)
+{
+  pthread_key_create(&deref_key, tidy_deref);
+}
+
+/* Begins a fresh set, unless we're still rendering owner */
+static void deref_scope(gimli_thread_t owner)
+{
+  if (!derefs.slots) {
+    pthread_once(&deref_once, make_deref_key);
+    pthread_setspecific(deref_key, &derefs);
+  } else if (owner == derefs.owner) {
+    return;
+  }
+  if (derefs.count || !derefs.slots) {
+    free(derefs.slots);
+    derefs.size = 256;
+    derefs.slots = calloc(derefs.size, sizeof(*derefs.slots));
+    derefs.count = 0;
+  }
+  derefs.owner = owner;
+}
+
+static struct deref_entry *deref_slot(struct deref_entry *slots,
+    unsigned size, gimli_type_t type, gimli_addr_t addr)
+{
+  uint64_t h = ((uint64_t)(intptr_t)type ^ addr) * 0x9e3779b97f4a7c15ULL;
+  unsigned i = (h >> 32) & (size - 1);
+
+  while (slots[i].type &&
+      (slots[i].type != type || slots[i].addr != addr)) {
+    i = (i + 1) & (size - 1);
+  }
+  return &slots[i];
+}
+
+static struct deref_entry *deref_find(gimli_type_t type, gimli_addr_t addr)
+{
+  struct deref_entry *e;
+
+  if (!derefs.slots) {
+    return NULL;
+  }
+  e = deref_slot(derefs.slots, derefs.size, type, addr);
+  return e->type ? e : NULL;
+}
+
+/* Records that we're rendering type at addr.  Returns false if the set
+ * is full, in which case the caller carries on regardless; max_depth
+ * still bounds the rendering */
+static int deref_insert(struct print_data *data, gimli_type_t type,
+    gimli_addr_t addr)
+{
+  struct deref_entry *slots, *e;
+  unsigned i;
+
+  if (!derefs.slots) {
+    deref_scope(NULL);
+  }
+  if (derefs.count >= DEREF_SET_MAX) {
+    return 0;
+  }
+  if ((derefs.count + 1) * 4 > derefs.size * 3) {
+    /* keep it no more than 3/4 full */
+    slots = calloc(derefs.size * 2, sizeof(*slots));
+    for (i = 0; i < derefs.size; i++) {
+      if (derefs.slots[i].type) {
+        *deref_slot(slots, derefs.size * 2, derefs.slots[i].type,
+            derefs.slots[i].addr) = derefs.slots[i];
+      }
+    }
+    free(derefs.slots);
+    derefs.slots = slots;
+    derefs.size *= 2;
+  }
+  e = deref_slot(derefs.slots, derefs.size, type, addr);
+  e->type = type;
+  e->addr = addr;
+  e->var = data->var;
+  e->frame = data->frame ? data->frame->depth : -1;
+  derefs.count++;
+  return 1;
+}
+
+/* Says where we rendered it before */
+static void print_deref_above(struct deref_entry *e, gimli_addr_t addr)
+{
+  if (e->var && e->var->varname && e->frame >= 0) {
+    gimli_out_printf(" " PTRFMT " [deref'd above: #%d %s]", addr,
+        e->frame, e->var->varname);
+  } else {
+    gimli_out_printf(" " PTRFMT " [deref'd above]", addr);
+  }
+}
+
+/* Aggregates are fetched from the target in one go and their members
+ * decoded from the local copy, rather than reading each member on its
+ * own.  This is the most that we'll fetch at once */
+#define WINDOW_MAX 65536
+
+/* this many identical array elements in a row are shown as one */
+#define REPEAT_THRESHOLD 10
+
+/* Copies len bytes at addr out of win, the aggregate that we are
+ * rendering, if it holds them; otherwise reads them from the target */
+static int read_mem(gimli_proc_t proc, gimli_mem_ref_t win,
+    gimli_addr_t addr, void *buf, int len)
+{
+  gimli_addr_t base;
+
+  if (win) {
+    base = gimli_mem_ref_target(win);
+    if (addr >= base && addr + len <= base + gimli_mem_ref_size(win)) {
+      memcpy(buf, (char*)gimli_mem_ref_local(win) + (addr - base), len);
+      return len;
+    }
+  }
+  return gimli_read_mem(proc, addr, buf, len);
+}
+
+/* Returns a window holding the size bytes at addr: either win, if it
+ * already does, or a newly fetched one.  Pass the result to
+ * release_window() along with win when done with it */
+static gimli_mem_ref_t fetch_window(gimli_proc_t proc,
+    gimli_mem_ref_t win, gimli_addr_t addr, uint64_t size)
+{
+  gimli_mem_ref_t ref;
+  gimli_addr_t base;
+
+  if (size == 0) {
+    return win;
+  }
+  if (win) {
+    base = gimli_mem_ref_target(win);
+    if (addr >= base && addr + size <= base + gimli_mem_ref_size(win)) {
+      return win;
+    }
+  }
+  if (size > WINDOW_MAX) {
+    size = WINDOW_MAX;
+  }
+  if (gimli_proc_mem_ref(proc, addr, size, &ref) != GIMLI_ERR_OK) {
+    return win;
+  }
+  return ref;
+}
+
+static void release_window(gimli_mem_ref_t ref, gimli_mem_ref_t win)
+{
+  if (ref != win) {
+    gimli_mem_ref_delete(ref);
+  }
+}
+
+/* Moves ref, a window that we fetched on top of win, along so that it
+ * covers the size bytes at addr */
+static gimli_mem_ref_t slide_window(gimli_proc_t proc, gimli_mem_ref_t ref,
+    gimli_mem_ref_t win, gimli_addr_t addr, uint64_t size)
+{
+  gimli_mem_ref_t next = fetch_window(proc, ref, addr, size);
+
+  if (next != ref) {
+    release_window(ref, win);
+  }
+  return next;
+}
+
 static void print_quoted_string(gimli_proc_t proc, gimli_addr_t addr)
 {
+  static const char hex[] = "0123456789abcdef";
   gimli_mem_ref_t ref;
   gimli_err_t err;
   char *buf, *end;
-  int len, i;
+  char esc[4] = { '\\', 'x', 0, 0 };
+  int len, nul = 0;
+  size_t n;
 #define STRING_AT_ONCE 1024
 
   err = gimli_proc_mem_ref(proc, addr, STRING_AT_ONCE, &ref);
   if (err != GIMLI_ERR_OK) {
-    printf("<unable to read string>");
+    gimli_out_printf("<unable to read string>");
     return;
   }
 
-  printf("\"");
+  gimli_out_putc('"');
   while (1) {
     buf = gimli_mem_ref_local(ref);
     len = gimli_mem_ref_size(ref);
     addr += len;
     end = buf + len;
 
+    /* write out runs of printable characters in one go */
     while (buf < end) {
-      if (buf[0] == '\0') goto done;
-      if (isprint(buf[0])) {
-        printf("%c", buf[0]);
-      } else if (buf[0] == '"') {
-        printf("\\\"");
-      } else if (buf[0] == '\\') {
-        printf("\\\\");
-      } else {
-        printf("\\x%02x", ((int)buf[0]) & 0xff);
+      n = gimli_out_printable_run(buf, end - buf, 0);
+      gimli_out_write(buf, n);
+      buf += n;
+      if (buf == end) {
+        break;
+      }
+      if (buf[0] == '\0') {
+        nul = 1;
+        break;
       }
+      esc[2] = hex[(buf[0] >> 4) & 0xf];
+      esc[3] = hex[buf[0] & 0xf];
+      gimli_out_write(esc, 4);
       buf++;
     }
+    if (nul) {
+      break;
+    }
 
     gimli_mem_ref_delete(ref);
     err = gimli_proc_mem_ref(proc, addr, STRING_AT_ONCE, &ref);
@@ -75,17 +299,14 @@ static void print_quoted_string(gimli_proc_t proc, gimli_addr_t addr)
       break;
     }
   }
-done:
-  printf("\"");
+  gimli_out_putc('"');
   if (err != GIMLI_ERR_OK) {
-    printf(" <invalid read>");
+    gimli_out_printf(" <invalid read>");
   }
 
   gimli_mem_ref_delete(ref);
 }
 
-
-
 static gimli_iter_status_t print_member(const char *name,
     struct gimli_type_membinfo *info,
     void *arg)
@@ -99,7 +320,7 @@ static gimli_iter_status_t print_member(const char *name,
   return GIMLI_ITER_CONT;
 }
 
-static void print_float(gimli_proc_t proc,
+static void print_float(struct print_data *data,
     gimli_type_t t, gimli_addr_t addr,
     uint64_t offset, uint64_t bits)
 {
@@ -115,29 +336,29 @@ static void print_float(gimli_proc_t proc,
 
   addr += (offset / 8);
 
-  if (gimli_read_mem(proc, addr, &u.f, bytes) != bytes) {
-    printf("<unable to read %" PRIu64 " bytes @ " PTRFMT ">",
+  if (read_mem(data->proc, data->mem, addr, &u.f, bytes) != bytes) {
+    gimli_out_printf("<unable to read %" PRIu64 " bytes @ " PTRFMT ">",
       bytes, addr);
     return;
   }
 
   switch (enc.format) {
     case GIMLI_FP_SINGLE:
-      printf("%f", u.f);
+      gimli_out_printf("%f", u.f);
       break;
     case GIMLI_FP_DOUBLE:
-      printf("%f", u.d);
+      gimli_out_printf("%f", u.d);
       break;
     case GIMLI_FP_LONG_DOUBLE:
-      printf("%Lf", u.ld);
+      gimli_out_printf("%Lf", u.ld);
       break;
     default:
-      printf("??? <unsupported FP format %" PRIu32 " %" PRIu64 " bits>",
+      gimli_out_printf("??? <unsupported FP format %" PRIu32 " %" PRIu64 " bits>",
           enc.format, bits);
   }
 }
 
-static void print_enum(gimli_proc_t proc,
+static void print_enum(struct print_data *data,
     gimli_type_t t, gimli_addr_t addr,
     uint64_t offset, uint64_t bits)
 {
@@ -155,8 +376,8 @@ static void print_enum(gimli_proc_t proc,
   addr += (offset / 8);
   u.u64 = 0;
 
-  if (gimli_read_mem(proc, addr, &u.u64, bytes) != bytes) {
-    printf("<unable to read %" PRIu64 " bytes @ " PTRFMT ">",
+  if (read_mem(data->proc, data->mem, addr, &u.u64, bytes) != bytes) {
+    gimli_out_printf("<unable to read %" PRIu64 " bytes @ " PTRFMT ">",
         bytes, addr);
     return;
   }
@@ -178,16 +399,18 @@ static void print_enum(gimli_proc_t proc,
 
   label = gimli_type_enum_resolve(t, val);
   if (label) {
-    printf("%s %u (0x%x)", label, val, val);
+    gimli_out_printf("%s %u (0x%x)", label, val, val);
   } else {
-    printf("<invalid enum value> %u (0x%x)", val, val);
+    gimli_out_printf("<invalid enum value> %u (0x%x)", val, val);
   }
 }
 
-static void print_integer(struct print_data *data,
-    gimli_proc_t proc,
-    gimli_type_t t, gimli_addr_t addr,
-    uint64_t offset, uint64_t bits)
+/* Reads an integer, or a bitfield, of the given size and offset (both
+ * in bits).  Returns the width in bytes of the value stored in *valp,
+ * or 0 if it could not be read, in which case err describes why */
+static int read_integer(gimli_proc_t proc, gimli_mem_ref_t win,
+    gimli_addr_t addr, uint64_t offset, uint64_t bits, uint64_t *valp,
+    char *err, size_t errlen)
 {
   uint64_t bytes;
   union {
@@ -196,16 +419,6 @@ static void print_integer(struct print_data *data,
     uint16_t u16;
     uint8_t  u8;
   } u;
-  uint64_t val;
-  const char *sformats[4] = {
-    "%d (0x%x)", "%d (0x%x)", "%d (0x%x)", "%" PRId64 " (0x%" PRIx64 ")" };
-  const char *uformats[4] = {
-    "%u (0x%x)", "%u (0x%x)", "%u (0x%x)", "%" PRId64 " (0x%" PRIx64 ")" };
-  const char *tsformats[4] = { "%d", "%d", "%d", "%" PRId64 };
-  const char *tuformats[4] = { "0x%x", "0x%x", "0x%x", "0x%" PRIx64 };
-  const char *fmt;
-  struct gimli_type_encoding enc;
-  int fmtidx;
 
   bytes = bits / 8;
   addr += (offset / 8);
@@ -230,13 +443,13 @@ static void print_integer(struct print_data *data,
 
 //printf("bitfield read from " PTRFMT " bits=%" PRIu64 " bytes=%" PRIu64 " offset=%" PRIu64 " bitoff=%d shift=%d mask=%" PRIx64 "\n", addr, bits, bytes, offset, bitoff, shift, mask);
     if (bytes > sizeof(u.u64)) {
-      printf("??? <invalid bitfield size %" PRIu64 ">", bits);
-      return;
+      snprintf(err, errlen, "??? <invalid bitfield size %" PRIu64 ">", bits);
+      return 0;
     }
-    if (gimli_read_mem(proc, addr, &u.u64, bytes) != bytes) {
-      printf("<unable to read %" PRIu64 " bytes @ " PTRFMT ">",
+    if (read_mem(proc, win, addr, &u.u64, bytes) != bytes) {
+      snprintf(err, errlen, "<unable to read %" PRIu64 " bytes @ " PTRFMT ">",
         bytes, addr);
-      return;
+      return 0;
     }
 //printf("READ: 0x%" PRIx64 "\n", u.u64);
     u.u64 >>= shift;
@@ -245,49 +458,82 @@ static void print_integer(struct print_data *data,
 
     bytes = 8;
 
-  } else if (gimli_read_mem(proc, addr, &u.u64, bytes) != bytes) {
-    printf("<unable to read %" PRIu64 " bytes @ " PTRFMT ">",
+  } else if (read_mem(proc, win, addr, &u.u64, bytes) != bytes) {
+    snprintf(err, errlen, "<unable to read %" PRIu64 " bytes @ " PTRFMT ">",
         bytes, addr);
-    return;
+    return 0;
   }
 
 #if 0
   printf("bytes = %" PRIu64 " bits = %" PRIu64 " offset=%" PRIu64 "\n",
       bytes, bits, offset);
 
-  printf("RAW %p INT @ " PTRFMT " -> %" PRIu64 "\n", t, addr, u.u64);
+  printf("RAW INT @ " PTRFMT " -> %" PRIu64 "\n", addr, u.u64);
 #endif
 
-  gimli_type_encoding(t, &enc);
-
   switch (bytes) {
     case 1:
-      val = u.u8;
-      fmtidx = 0;
+      *valp = u.u8;
       break;
     case 2:
-      val = u.u16;
-      fmtidx = 1;
+      *valp = u.u16;
       break;
     case 4:
-      val = u.u32;
-      fmtidx = 2;
+      *valp = u.u32;
       break;
     case 8:
-      val = u.u64;
-      fmtidx = 3;
+      *valp = u.u64;
       break;
     default:
       /* not possible due to bifield check above */
       abort();
   }
+  return bytes;
+}
+
+static void print_integer(struct print_data *data,
+    gimli_proc_t proc,
+    gimli_type_t t, gimli_addr_t addr,
+    uint64_t offset, uint64_t bits)
+{
+  uint64_t val;
+  const char *sformats[4] = {
+    "%d (0x%x)", "%d (0x%x)", "%d (0x%x)", "%" PRId64 " (0x%" PRIx64 ")" };
+  const char *uformats[4] = {
+    "%u (0x%x)", "%u (0x%x)", "%u (0x%x)", "%" PRId64 " (0x%" PRIx64 ")" };
+  const char *tsformats[4] = { "%d", "%d", "%d", "%" PRId64 };
+  const char *tuformats[4] = { "0x%x", "0x%x", "0x%x", "0x%" PRIx64 };
+  const char *fmt;
+  struct gimli_type_encoding enc;
+  char err[128];
+  int fmtidx;
+
+  switch (read_integer(proc, data->mem, addr, offset, bits, &val,
+        err, sizeof(err))) {
+    case 0:
+      gimli_out_puts(err);
+      return;
+    case 1:
+      fmtidx = 0;
+      break;
+    case 2:
+      fmtidx = 1;
+      break;
+    case 4:
+      fmtidx = 2;
+      break;
+    default:
+      fmtidx = 3;
+  }
+
+  gimli_type_encoding(t, &enc);
 
   if (data->terse) {
     fmt = (enc.format & GIMLI_INT_SIGNED) ? tsformats[fmtidx] : tuformats[fmtidx];
-    printf(fmt, val);
+    gimli_out_printf(fmt, val);
   } else {
     fmt = (enc.format & GIMLI_INT_SIGNED) ? sformats[fmtidx] : uformats[fmtidx];
-    printf(fmt, val, val);
+    gimli_out_printf(fmt, val, val);
   }
 }
 
@@ -300,13 +546,14 @@ static void print_array(struct print_data *sdata, gimli_type_t t)
   uint64_t off = sdata->offset;
   int depth = sdata->depth;
   char addrkey[64];
-  uint32_t i;
+  uint64_t i, n, reps, elsize;
   struct print_data data = *sdata;
-  int is_struct;
+  int is_struct, can_repeat;
   gimli_type_t target;
+  char first[16], next[16];
 
   if (!gimli_type_arinfo(t, &arinfo)) {
-    printf("not an array type in print_array!?\n");
+    gimli_out_printf("not an array type in print_array!?\n");
     return;
   }
 
@@ -322,13 +569,13 @@ static void print_array(struct print_data *sdata, gimli_type_t t)
       enc.format & GIMLI_INT_CHAR) {
     /* Could be a string; try to read and print it as such */
 
-    printf("[ ");
+    gimli_out_printf("[ ");
     print_quoted_string(data.proc, addr);
-    printf(" ]");
+    gimli_out_printf(" ]");
     return;
   }
   if (depth + 1 > max_depth) {
-    printf("[ ... ]");
+    gimli_out_printf("[ ... ]");
     return;
   }
 
@@ -349,16 +596,14 @@ static void print_array(struct print_data *sdata, gimli_type_t t)
       break;
   }
 
-  printf("\n%.*s[",
-      (data.depth + 1) * 4, indentstr);
+  gimli_out_putc('\n');
+  print_indent((data.depth + 1) * 4);
+  gimli_out_putc('[');
 
-  if (gimli_type_kind(target) == GIMLI_K_ARRAY) {
-    printf("%.*s",
-      (data.depth + 2) * 4, indentstr);
-  } else {
-    printf("\n%.*s",
-      (data.depth + 2) * 4, indentstr);
+  if (gimli_type_kind(target) != GIMLI_K_ARRAY) {
+    gimli_out_putc('\n');
   }
+  print_indent((data.depth + 2) * 4);
   data.offset = 0;
   data.size = gimli_type_size(target);
   data.show_decl = 0;
@@ -367,30 +612,73 @@ static void print_array(struct print_data *sdata, gimli_type_t t)
   data.terse = 1;
   data.in_array++;
 
-  for (i = 0; i < arinfo.nelems && i < max_arr; i++) {
+  /* runs of identical scalars are rendered once, with a count, and
+   * only count once towards max_arr */
+  elsize = data.size / 8;
+  switch (gimli_type_kind(target)) {
+    case GIMLI_K_INTEGER:
+    case GIMLI_K_FLOAT:
+    case GIMLI_K_ENUM:
+      can_repeat = elsize > 0 && elsize <= sizeof(first) &&
+        data.size % 8 == 0;
+      break;
+    default:
+      can_repeat = 0;
+  }
+
+  for (i = 0, n = 0; i < arinfo.nelems && n < max_arr; n++) {
     data.depth = depth + 1;
-    data.addr = addr + (i * (data.size / 8));
+    data.addr = addr + (i * elsize);
+    data.mem = slide_window(data.proc, data.mem, sdata->mem, data.addr,
+        (arinfo.nelems - i) * elsize);
+
+    reps = 1;
+    if (can_repeat &&
+        read_mem(data.proc, data.mem, data.addr, first, elsize) == elsize) {
+      while (i + reps < arinfo.nelems) {
+        gimli_addr_t a = data.addr + (reps * elsize);
+
+        data.mem = slide_window(data.proc, data.mem, sdata->mem, a,
+            (arinfo.nelems - i - reps) * elsize);
+        if (read_mem(data.proc, data.mem, a, next, elsize) != elsize ||
+            memcmp(first, next, elsize)) {
+          break;
+        }
+        reps++;
+      }
+      if (reps < REPEAT_THRESHOLD) {
+        reps = 1;
+      }
+    }
 
-    if (i) {
+    if (n) {
       if (is_struct) {
-        printf("\n%.*s,\n%.*s",
-            (depth + 2) * 4, indentstr,
-            (depth + 2) * 4, indentstr);
+        gimli_out_putc('\n');
+        print_indent((depth + 2) * 4);
+        gimli_out_write(",\n", 2);
+        print_indent((depth + 2) * 4);
       } else {
-        printf(", ");
+        gimli_out_write(", ", 2);
       }
     }
     print_var(&data, target, "");
+    if (reps > 1) {
+      gimli_out_printf(" <repeats %" PRIu64 " times>", reps);
+    }
+    i += reps;
   }
-  if (arinfo.nelems > max_arr) {
-    printf(" ...");
+  release_window(data.mem, sdata->mem);
+  if (i < arinfo.nelems) {
+    gimli_out_puts(" ...");
   }
-  printf("\n%.*s]", (depth + 1) * 4, indentstr);
+  gimli_out_putc('\n');
+  print_indent((depth + 1) * 4);
+  gimli_out_putc(']');
 }
 
 static void print_pointer(struct print_data *data, gimli_type_t t)
 {
-  void *dummy;
+  struct deref_entry *seen;
   gimli_type_t target = gimli_type_resolve(gimli_type_follow_pointer(t));
   struct gimli_type_encoding enc;
   void *tptr;
@@ -398,26 +686,25 @@ static void print_pointer(struct print_data *data, gimli_type_t t)
   gimli_addr_t addr = data->addr + (data->offset / 8);
   gimli_addr_t addrsave = data->addr;
   int depth = data->depth;
-  char addrkey[64];
   char namebuf[1024];
   const char *symname;
   struct print_data savdata = *data;
 
   if (data->addr == 0) {
-    printf("nil");
+    gimli_out_printf("nil");
     return;
   }
 
-  if (gimli_read_mem(data->proc, addr, &tptr,
+  if (read_mem(data->proc, data->mem, addr, &tptr,
         sizeof(tptr)) != sizeof(tptr)) {
-    printf("<unable to read %lu bytes at " PTRFMT ">",
+    gimli_out_printf("<unable to read %lu bytes at " PTRFMT ">",
         sizeof(ptr), data->addr);
     return;
   }
   ptr = (gimli_addr_t)tptr;
 
   if (ptr == 0) {
-    printf("nil");
+    gimli_out_printf("nil");
     return;
   }
 
@@ -426,52 +713,61 @@ static void print_pointer(struct print_data *data, gimli_type_t t)
   symname = gimli_data_sym_name(data->proc, ptr, namebuf, sizeof(namebuf));
   if (symname && strlen(symname)) {
     if (gimli_type_kind(target) == GIMLI_K_FUNCTION) {
-      printf("%s", symname);
+      gimli_out_puts(symname);
       return;
     }
-    printf("(%s) ", symname);
+    gimli_out_printf("(%s) ", symname);
+  } else if ((symname = gimli_region_describe(data->proc, ptr,
+          namebuf, sizeof(namebuf)))) {
+    /* no symbol; say what sort of memory it is instead */
+    gimli_out_printf("(%s) ", symname);
   }
 
   /* if we are a char*, render as a string */
   if (gimli_type_kind(target) == GIMLI_K_INTEGER &&
       (enc.format & GIMLI_INT_CHAR)) {
 
-    printf(PTRFMT " ", ptr);
+    gimli_out_printf(PTRFMT " ", ptr);
     print_quoted_string(data->proc, ptr);
     return;
   }
 
   /* don't deref function pointers */
   if (gimli_type_kind(target) == GIMLI_K_FUNCTION) {
-    printf(PTRFMT, ptr);
+    gimli_out_printf(PTRFMT, ptr);
     return;
   }
 
   /* don't deref void* */
   if (!strcmp(gimli_type_name(target), "void")) {
-    printf(PTRFMT, ptr);
+    gimli_out_printf(PTRFMT, ptr);
     return;
   }
 
   /* don't deref if the target is invalid memory */
-  if (!gimli_read_mem(data->proc, ptr, &dummy, 1) ||
-      !gimli_read_mem(data->proc, ptr + gimli_type_size(target), &dummy, 1)) {
-    printf(PTRFMT " <invalid>", ptr);
+  if (!gimli_addr_readable(data->proc, ptr,
+        (gimli_type_size(target) + 7) / 8)) {
+    gimli_out_printf(PTRFMT " <invalid>", ptr);
     return;
   }
 
   if (data->depth + 1 > max_depth) {
-    printf(PTRFMT, ptr);
+    gimli_out_printf(PTRFMT, ptr);
     return;
   }
 
-  snprintf(addrkey, sizeof(addrkey), "%p:%" PRIx64, target, data->addr);
-  if (gimli_hash_find(derefd, addrkey, &dummy)) {
-    printf(" " PTRFMT " [deref'd above]", ptr);
+  if (!gimli_budget_allows(GIMLI_TIER_LOCALS)) {
+    gimli_out_printf(PTRFMT " [deref omitted: %s budget exhausted]", ptr,
+        gimli_budget_reason());
     return;
   }
 
-  printf(PTRFMT " [deref'ing]\n", ptr);
+  if ((seen = deref_find(target, ptr))) {
+    print_deref_above(seen, ptr);
+    return;
+  }
+
+  gimli_out_printf(PTRFMT " [deref'ing]\n", ptr);
 
   data->show_decl = 1;
   data->prefix = " = ";
@@ -504,8 +800,8 @@ static gimli_iter_status_t after_print_var(
     }
 
     mod->ptr.v2->after_print_frame_var(&ana_api,
-          mod->exename, data->frame->cur.tid,
-          data->frame->cur.frameno, data->frame->cur.st.pc,
+          mod->exename, data->frame->trace->thr->lwpid,
+          data->frame->frameno, (void*)data->frame->pc,
           data->frame,
           typename,
           data->var->varname,
@@ -519,8 +815,7 @@ static int print_var(struct print_data *data, gimli_type_t t, const char *varnam
 {
   int indent = 4 * (data->depth + 1);
   gimli_addr_t addr;
-  char addrkey[64];
-  void *dummy;
+  struct deref_entry *seen;
 
   if (data->frame) {
 
@@ -532,20 +827,20 @@ static int print_var(struct print_data *data, gimli_type_t t, const char *varnam
   }
 
   if (!t) {
-    printf("%.*s%s <optimized out>%s",
-        indent, indentstr, varname, data->suffix);
+    print_indent(indent);
+    gimli_out_printf("%s <optimized out>%s", varname, data->suffix);
   } else {
     if (data->show_decl) {
-      printf("%.*s%s",
-          indent, indentstr,
-          gimli_type_declname(t));
+      print_indent(indent);
+      gimli_out_puts(gimli_type_declname(t));
       if (varname) {
-        printf(" %s", varname);
+        gimli_out_putc(' ');
+        gimli_out_puts(varname);
       }
     }
 
     if (data->addr == 0) {
-      printf(" <optimized out>%s", data->suffix);
+      gimli_out_printf(" <optimized out>%s", data->suffix);
       goto after;
     }
 
@@ -555,57 +850,58 @@ static int print_var(struct print_data *data, gimli_type_t t, const char *varnam
     switch (gimli_type_kind(t)) {
       case GIMLI_K_UNION:
       case GIMLI_K_STRUCT:
-        snprintf(addrkey, sizeof(addrkey), "%p:%" PRIx64, t, addr);
-        if (gimli_hash_find(derefd, addrkey, &dummy)) {
-          printf(" " PTRFMT " [deref'd above]\n", addr);
-          return;
-        }
-        if (!gimli_hash_insert(derefd, addrkey, NULL)) {
-          printf(" " PTRFMT " <hash insert failed>\n", addr);
-          return;
+        if ((seen = deref_find(t, addr))) {
+          print_deref_above(seen, addr);
+          gimli_out_putc('\n');
+          return GIMLI_ITER_CONT;
         }
+        deref_insert(data, t, addr);
 
-        printf(" " PTRFMT " = {\n", addr);
+        gimli_out_printf(" " PTRFMT " = {\n", addr);
         {
           struct print_data d = *data;
           d.depth++;
           d.addr = addr;
           d.offset = 0;
+          d.mem = fetch_window(d.proc, data->mem, addr,
+              gimli_type_size(t) / 8);
           gimli_type_member_visit(t, print_member, &d);
+          release_window(d.mem, data->mem);
         }
-        printf("%.*s}\n", indent, indentstr);
+        print_indent(indent);
+        gimli_out_write("}\n", 2);
         break;
       case GIMLI_K_INTEGER:
-        printf("%s", data->prefix);
+        gimli_out_puts(data->prefix);
         print_integer(data, data->proc, t, data->addr, data->offset, data->size);
-        printf("%s", data->suffix);
+        gimli_out_puts(data->suffix);
         break;
       case GIMLI_K_FLOAT:
-        printf("%s", data->prefix);
-        print_float(data->proc, t, data->addr, data->offset, data->size);
-        printf("%s", data->suffix);
+        gimli_out_puts(data->prefix);
+        print_float(data, t, data->addr, data->offset, data->size);
+        gimli_out_puts(data->suffix);
         break;
       case GIMLI_K_POINTER:
-        printf("%s", data->prefix);
+        gimli_out_puts(data->prefix);
         print_pointer(data, t);
-        printf("%s", data->suffix);
+        gimli_out_puts(data->suffix);
         break;
       case GIMLI_K_ENUM:
-        printf("%s", data->prefix);
-        print_enum(data->proc, t, data->addr, data->offset, data->size);
-        printf("%s", data->suffix);
+        gimli_out_puts(data->prefix);
+        print_enum(data, t, data->addr, data->offset, data->size);
+        gimli_out_puts(data->suffix);
         break;
       case GIMLI_K_ARRAY:
-        printf("%s", data->prefix);
+        gimli_out_puts(data->prefix);
         print_array(data, t);
-        printf("%s", data->suffix);
+        gimli_out_puts(data->suffix);
         break;
       default:
-        printf(" <kind:%d offsetbits:%" PRIu64 " @" PTRFMT ">",
+        gimli_out_printf(" <kind:%d offsetbits:%" PRIu64 " @" PTRFMT ">",
             gimli_type_kind(t),
             data->offset,
             data->addr + (data->offset / 8));
-        printf("%s", data->suffix);
+        gimli_out_puts(data->suffix);
     }
   }
 
@@ -624,6 +920,12 @@ static gimli_iter_status_t show_var(
 {
   struct print_data *data = arg;
 
+  if (!gimli_budget_allows(var->is_param == GIMLI_WANT_PARAMS ?
+        GIMLI_TIER_PARAMS : GIMLI_TIER_LOCALS)) {
+    data->omitted++;
+    return GIMLI_ITER_CONT;
+  }
+
   data->var = var;
   data->is_param = var->is_param;
   data->addr = var->addr;
@@ -635,14 +937,6 @@ static gimli_iter_status_t show_var(
   return GIMLI_ITER_CONT;
 }
 
-static void tidy_deref(void)
-{
-  if (derefd) {
-    gimli_hash_destroy(derefd);
-    derefd = NULL;
-  }
-}
-
 int gimli_print_addr_as_type(gimli_proc_t proc,
     gimli_stack_frame_t frame, const char *varname,
     gimli_type_t t, gimli_addr_t addr)
@@ -658,52 +952,601 @@ int gimli_print_addr_as_type(gimli_proc_t proc,
   data.addr = addr;
   data.size = gimli_type_size(t);
 
+  deref_scope(frame ? frame->trace->thr : NULL);
   print_var(&data, t, varname);
 
   return 1;
 }
 
-void gimli_render_frame(int tid, int nframe, gimli_stack_frame_t frame)
+/* Renders the line that introduces a frame, after a note if it starts
+ * a folded cycle.  Returns true if the frame has a symbol that we can
+ * say more about; signal frames and those we couldn't afford to
+ * symbolize have nothing more.  The source line needs the DWARF line
+ * tables, so it is only shown when lines is set */
+static int render_frame_line(gimli_proc_t proc, gimli_stack_frame_t frame,
+    int lines)
 {
   const char *name;
   char namebuf[1024];
   char filebuf[1024];
   uint64_t lineno;
-  struct gimli_unwind_cursor cur = frame->cur;
-  struct print_data data;
+  struct gimli_unwind_cursor *cur;
+  /* frames are numbered by their depth, so that any folded recursion
+   * is apparent from the numbering too */
+  int nframe = frame->depth;
+  int symbolized = 0;
+
+  if (frame->cycle_len) {
+    gimli_out_printf("    frames %d-%d: cycle of %d x %d\n", frame->depth,
+        frame->depth + frame->cycle_len * frame->cycle_count - 1,
+        frame->cycle_len, frame->cycle_count);
+  }
 
-  if (gimli_is_signal_frame(&cur)) {
-    if (cur.si.si_signo) {
-      gimli_render_siginfo(cur.proc, &cur.si, namebuf, sizeof(namebuf));
-      printf("#%-2d %s\n", nframe, namebuf);
+  if (frame->flags & GIMLI_FRAME_SIGNAL) {
+    cur = gimli_stack_frame_cursor(frame);
+    if (cur && cur->si.si_signo) {
+      gimli_render_siginfo(proc, &cur->si, namebuf, sizeof(namebuf));
+      gimli_out_printf("#%-2d %s", nframe, namebuf);
     } else {
-      printf("#%-2d signal handler\n", nframe);
+      gimli_out_printf("#%-2d signal handler", nframe);
     }
+  } else if (!gimli_budget_allows(GIMLI_TIER_SYMBOLS)) {
+    gimli_out_printf("#%-2d " PTRFMT " [symbol omitted: %s budget exhausted]",
+        nframe, (PTRFMT_T)frame->pc, gimli_budget_reason());
   } else {
-    name = gimli_pc_sym_name(cur.proc, (gimli_addr_t)cur.st.pc,
-        namebuf, sizeof(namebuf));
-    printf("#%-2d " PTRFMT " %s", nframe, (PTRFMT_T)cur.st.pc, name);
-    if (gimli_determine_source_line_number(cur.proc, (gimli_addr_t)cur.st.pc,
+    name = gimli_pc_sym_name(proc, frame->pc, namebuf, sizeof(namebuf));
+    gimli_out_printf("#%-2d " PTRFMT " %s", nframe, (PTRFMT_T)frame->pc, name);
+    if (lines && gimli_determine_source_line_number(proc, frame->pc,
           filebuf, sizeof(filebuf), &lineno)) {
-      printf(" (%s:%" PRId64 ")", filebuf, lineno);
+      gimli_out_printf(" (%s:%" PRId64 ")", filebuf, lineno);
+    }
+    symbolized = 1;
+  }
+  if (gimli_show_unwind_method) {
+    gimli_out_printf(" [%s]", gimli_unwind_method_name(frame->method));
+  }
+  gimli_out_printf("\n");
+
+  return symbolized;
+}
+
+/* Renders just the frame lines of a trace, from the symbol tables
+ * alone; no debug information is loaded for this */
+void gimli_render_stack(int tid, gimli_stack_trace_t trace)
+{
+  gimli_stack_frame_t frame;
+
+  STAILQ_FOREACH(frame, &trace->frames, frames) {
+    render_frame_line(trace->thr->proc, frame, 0);
+  }
+}
+
+void gimli_render_frame(int tid, int nframe, gimli_stack_frame_t frame)
+{
+  const char *name;
+  gimli_proc_t proc = frame->trace->thr->proc;
+  struct print_data data;
+  struct gimli_dwarf_die *chain[16];
+  struct gimli_object_mapping *m;
+  int n, i;
+
+  if (render_frame_line(proc, frame, 1)) {
+    /* the symbol is that of the function the code was inlined into;
+     * name the inlined functions, innermost first */
+    n = gimli_dwarf_get_die_chain_for_pc(proc, frame->pc,
+        chain, sizeof(chain)/sizeof(chain[0]));
+    if (n > 1) {
+      m = gimli_mapping_for_addr(proc, frame->pc);
+      for (i = 0; i < n - 1; i++) {
+        name = gimli_dwarf_die_name(m->objfile, chain[i]);
+        gimli_out_printf("    inlined: %s\n", name ? name : "?");
+      }
     }
-    printf("\n");
 
     memset(&data, 0, sizeof(data));
-    data.proc = frame->cur.proc;
+    data.proc = proc;
     data.frame = frame;
     data.show_decl = 1;
     data.prefix = " = ";
     data.suffix = "\n";
 
-    if (!derefd) {
-      derefd = gimli_hash_new(NULL);
-      atexit(tidy_deref);
-    }
+    deref_scope(frame->trace->thr);
 
+    /* loading the variables is the costly part; don't start unless we
+     * can show at least the parameters */
+    if (!gimli_budget_allows(GIMLI_TIER_PARAMS)) {
+      gimli_output->omitted(tid, frame->depth, 0, "variables");
+      return;
+    }
     gimli_stack_frame_visit_vars(frame, GIMLI_WANT_ALL, show_var, &data);
+    if (data.omitted) {
+      gimli_output->omitted(tid, frame->depth, data.omitted, "variables");
+    }
+  }
+}
+
+/* {{{ JSON rendering of frames and their variables */
+
+/* strings are capped at this length; the text rendering isn't, but
+ * a consumer of JSON is unlikely to want to page through megabytes */
+#define JSON_MAX_STRING 4096
+
+struct json_data {
+  gimli_proc_t proc;
+  int tid;
+  int depth;
+  gimli_addr_t addr;
+  int nmembers;
+  /* the aggregate that we are rendering; see fetch_window() */
+  gimli_mem_ref_t mem;
+  /* variables skipped for want of budget */
+  int omitted;
+};
+
+static void json_value(struct json_data *data, gimli_type_t t,
+    gimli_addr_t addr, uint64_t offset, uint64_t size);
+
+static void json_error(const char *err)
+{
+  gimli_out_printf("{\"error\":");
+  gimli_out_json_string(err);
+  gimli_out_putc('}');
+}
+
+/* Emits "string":"..." for up to limit bytes of the string at addr,
+ * along with "truncated" or "invalid" if we didn't get all of it.
+ * The caller supplies the enclosing object */
+static void json_target_string(gimli_proc_t proc, gimli_addr_t addr,
+    uint64_t limit)
+{
+  gimli_mem_ref_t ref;
+  char *buf, *nul;
+  uint64_t len, total = 0;
+
+  gimli_out_printf("\"string\":\"");
+  while (1) {
+    if (gimli_proc_mem_ref(proc, addr, STRING_AT_ONCE, &ref)
+        != GIMLI_ERR_OK) {
+      gimli_out_printf("\",\"invalid\":true");
+      return;
+    }
+    buf = gimli_mem_ref_local(ref);
+    len = gimli_mem_ref_size(ref);
+    nul = memchr(buf, '\0', len);
+    if (nul) {
+      len = nul - buf;
+    }
+    if (total + len > limit) {
+      len = limit - total;
+      nul = NULL;
+    }
+    gimli_out_json_chars(buf, len);
+    gimli_mem_ref_delete(ref);
+    total += len;
+    addr += len;
+
+    if (nul) {
+      gimli_out_putc('"');
+      return;
+    }
+    if (total >= limit) {
+      gimli_out_printf("\",\"truncated\":true");
+      return;
+    }
+  }
+}
+
+static void json_float(struct json_data *data, gimli_type_t t,
+    gimli_addr_t addr, uint64_t bits)
+{
+  union {
+    float f;
+    double d;
+    long double ld;
+  } u;
+  uint64_t bytes = bits / 8;
+  struct gimli_type_encoding enc;
+  long double val;
+
+  gimli_type_encoding(t, &enc);
+
+  if (read_mem(data->proc, data->mem, addr, &u.f, bytes) != bytes) {
+    json_error("unable to read");
+    return;
+  }
+
+  switch (enc.format) {
+    case GIMLI_FP_SINGLE:
+      val = u.f;
+      break;
+    case GIMLI_FP_DOUBLE:
+      val = u.d;
+      break;
+    case GIMLI_FP_LONG_DOUBLE:
+      val = u.ld;
+      break;
+    default:
+      json_error("unsupported FP format");
+      return;
+  }
+  /* JSON has no way to express these as numbers */
+  if (isnan(val)) {
+    gimli_out_printf("\"nan\"");
+  } else if (isinf(val)) {
+    gimli_out_printf(val < 0 ? "\"-inf\"" : "\"inf\"");
+  } else if (enc.format == GIMLI_FP_SINGLE) {
+    gimli_out_printf("%.9g", u.f);
+  } else {
+    gimli_out_printf("%.17Lg", val);
+  }
+}
+
+static void json_pointer(struct json_data *data, gimli_type_t t,
+    gimli_addr_t addr)
+{
+  gimli_type_t target = gimli_type_resolve(gimli_type_follow_pointer(t));
+  struct gimli_type_encoding enc;
+  void *tptr;
+  gimli_addr_t ptr;
+  char namebuf[1024];
+  const char *symname;
+
+  if (read_mem(data->proc, data->mem, addr, &tptr,
+        sizeof(tptr)) != sizeof(tptr)) {
+    json_error("unable to read");
+    return;
+  }
+  ptr = (gimli_addr_t)tptr;
+
+  gimli_out_printf("{\"ptr\":\"" PTRFMT "\"", (PTRFMT_T)ptr);
+  if (ptr == 0) {
+    gimli_out_putc('}');
+    return;
+  }
+
+  symname = gimli_data_sym_name(data->proc, ptr, namebuf, sizeof(namebuf));
+  if (symname && strlen(symname)) {
+    gimli_out_printf(",\"sym\":");
+    gimli_out_json_string(symname);
+  } else if ((symname = gimli_region_describe(data->proc, ptr,
+          namebuf, sizeof(namebuf)))) {
+    gimli_out_printf(",\"region\":");
+    gimli_out_json_string(symname);
+  }
+
+  gimli_type_encoding(target, &enc);
+
+  if (gimli_type_kind(target) == GIMLI_K_INTEGER &&
+      (enc.format & GIMLI_INT_CHAR)) {
+    gimli_out_putc(',');
+    json_target_string(data->proc, ptr, JSON_MAX_STRING);
+  } else if (gimli_type_kind(target) == GIMLI_K_FUNCTION ||
+      !strcmp(gimli_type_name(target), "void")) {
+    /* nothing to follow */
+  } else if (!gimli_addr_readable(data->proc, ptr,
+        (gimli_type_size(target) + 7) / 8)) {
+    gimli_out_printf(",\"invalid\":true");
+  } else if (data->depth + 1 > max_depth) {
+    gimli_out_printf(",\"truncated\":true");
+  } else if (!gimli_budget_allows(GIMLI_TIER_LOCALS)) {
+    gimli_out_printf(",\"deref_omitted\":");
+    gimli_out_json_string(gimli_budget_reason());
+  } else {
+    gimli_out_printf(",\"target\":");
+    data->depth++;
+    json_value(data, target, ptr, 0, gimli_type_size(target));
+    data->depth--;
   }
+  gimli_out_putc('}');
 }
 
+static void json_array(struct json_data *data, gimli_type_t t,
+    gimli_addr_t addr)
+{
+  struct gimli_type_encoding enc;
+  struct gimli_type_arinfo arinfo;
+  gimli_type_t target;
+  gimli_mem_ref_t win;
+  uint64_t size;
+  uint32_t i;
+
+  if (!gimli_type_arinfo(t, &arinfo)) {
+    json_error("not an array");
+    return;
+  }
+
+  target = gimli_type_resolve(arinfo.contents);
+  gimli_type_encoding(target, &enc);
+
+  gimli_out_printf("{\"length\":%" PRIu64, arinfo.nelems);
+
+  if (gimli_type_kind(target) == GIMLI_K_INTEGER &&
+      enc.format & GIMLI_INT_CHAR) {
+    gimli_out_putc(',');
+    json_target_string(data->proc, addr,
+        arinfo.nelems && arinfo.nelems < JSON_MAX_STRING ?
+        arinfo.nelems : JSON_MAX_STRING);
+    gimli_out_putc('}');
+    return;
+  }
+  if (data->depth + 1 > max_depth) {
+    gimli_out_printf(",\"truncated\":true}");
+    return;
+  }
+
+  size = gimli_type_size(target);
+  gimli_out_printf(",\"elements\":[");
+  win = data->mem;
+  data->mem = fetch_window(data->proc, win, addr,
+      (arinfo.nelems < max_arr ? arinfo.nelems : max_arr) * (size / 8));
+  data->depth++;
+  for (i = 0; i < arinfo.nelems && i < max_arr; i++) {
+    if (i) {
+      gimli_out_putc(',');
+    }
+    json_value(data, target, addr + (i * (size / 8)), 0, size);
+  }
+  data->depth--;
+  release_window(data->mem, win);
+  data->mem = win;
+  gimli_out_putc(']');
+  if (arinfo.nelems > max_arr) {
+    gimli_out_printf(",\"truncated\":true");
+  }
+  gimli_out_putc('}');
+}
+
+static gimli_iter_status_t json_member(const char *name,
+    struct gimli_type_membinfo *info,
+    void *arg)
+{
+  struct json_data *data = arg;
+
+  if (data->nmembers++) {
+    gimli_out_putc(',');
+  }
+  gimli_out_json_string(name ? name : "");
+  gimli_out_putc(':');
+  json_value(data, info->type, data->addr, info->offset, info->size);
+
+  return GIMLI_ITER_CONT;
+}
+
+/* Renders the value of type t whose storage begins offset bits from
+ * addr and is size bits long */
+static void json_value(struct json_data *data, gimli_type_t t,
+    gimli_addr_t addr, uint64_t offset, uint64_t size)
+{
+  struct gimli_type_encoding enc;
+  struct json_data d;
+  const char *label;
+  char err[128];
+  uint64_t val;
+
+  t = gimli_type_resolve(t);
+
+  switch (gimli_type_kind(t)) {
+    case GIMLI_K_UNION:
+    case GIMLI_K_STRUCT:
+      d = *data;
+      d.depth++;
+      d.addr = addr + (offset / 8);
+      d.nmembers = 0;
+      d.mem = fetch_window(d.proc, data->mem, d.addr, gimli_type_size(t) / 8);
+      gimli_out_putc('{');
+      gimli_type_member_visit(t, json_member, &d);
+      gimli_out_putc('}');
+      release_window(d.mem, data->mem);
+      break;
+    case GIMLI_K_INTEGER:
+      if (!read_integer(data->proc, data->mem, addr, offset, size, &val,
+            err, sizeof(err))) {
+        json_error(err);
+        break;
+      }
+      gimli_type_encoding(t, &enc);
+      if (enc.format & GIMLI_INT_BOOL) {
+        gimli_out_printf(val ? "true" : "false");
+      } else if (enc.format & GIMLI_INT_SIGNED) {
+        /* sign extend from the width of the type */
+        if (size && size < 64 && (val & (1ULL << (size - 1)))) {
+          val |= ~((1ULL << size) - 1);
+        }
+        gimli_out_printf("%" PRId64, (int64_t)val);
+      } else {
+        gimli_out_printf("%" PRIu64, val);
+      }
+      break;
+    case GIMLI_K_FLOAT:
+      json_float(data, t, addr + (offset / 8), size);
+      break;
+    case GIMLI_K_POINTER:
+      json_pointer(data, t, addr + (offset / 8));
+      break;
+    case GIMLI_K_ENUM:
+      if (!read_integer(data->proc, data->mem, addr, offset, size, &val,
+            err, sizeof(err))) {
+        json_error(err);
+        break;
+      }
+      label = gimli_type_enum_resolve(t, (int)val);
+      gimli_out_printf("{\"enum\":");
+      gimli_out_json_string(label);
+      gimli_out_printf(",\"value\":%" PRIu64 "}", val);
+      break;
+    case GIMLI_K_ARRAY:
+      json_array(data, t, addr + (offset / 8));
+      break;
+    default:
+      gimli_out_printf("{\"kind\":%d}", gimli_type_kind(t));
+  }
+}
+
+static gimli_iter_status_t json_var(
+    gimli_stack_frame_t frame,
+    gimli_var_t var,
+    void *arg)
+{
+  struct json_data *data = arg;
+
+  if (!gimli_budget_allows(var->is_param == GIMLI_WANT_PARAMS ?
+        GIMLI_TIER_PARAMS : GIMLI_TIER_LOCALS)) {
+    data->omitted++;
+    return GIMLI_ITER_CONT;
+  }
+
+  gimli_out_printf("{\"type\":\"var\",\"thread\":%d,\"frame\":%d,\"name\":",
+      data->tid, frame->depth);
+  gimli_out_json_string(var->varname);
+  gimli_out_printf(",\"ctype\":");
+  gimli_out_json_string(var->type ? gimli_type_declname(var->type) : NULL);
+  gimli_out_printf(",\"param\":%s",
+      var->is_param == GIMLI_WANT_PARAMS ? "true" : "false");
+
+  if (!var->type || !var->addr) {
+    gimli_out_printf(",\"optimized_out\":true");
+  } else {
+    gimli_out_printf(",\"addr\":\"" PTRFMT "\",\"value\":",
+        (PTRFMT_T)var->addr);
+    data->depth = 0;
+    json_value(data, var->type, var->addr, 0, gimli_type_size(var->type));
+  }
+  gimli_out_printf("}\n");
+
+  return GIMLI_ITER_CONT;
+}
+
+/* Renders the fields that describe a frame, after the opening brace
+ * of its object.  Returns true if the frame has a symbol that we can
+ * say more about.  As for render_frame_line(), the source line and the
+ * inlined functions are only looked up when full is set */
+static int json_frame_fields(gimli_proc_t proc, gimli_stack_frame_t frame,
+    int full)
+{
+  struct gimli_unwind_cursor *cur;
+  struct gimli_object_mapping *m;
+  struct gimli_symbol *s;
+  struct gimli_dwarf_die *chain[16];
+  char namebuf[1024];
+  char filebuf[1024];
+  const char *name;
+  uint64_t lineno;
+  int n, i;
+
+  gimli_out_printf("\"frame\":%d,\"pc\":\"" PTRFMT "\",\"method\":\"%s\"",
+      frame->depth, (PTRFMT_T)frame->pc,
+      gimli_unwind_method_name(frame->method));
+
+  if (frame->cycle_len) {
+    gimli_out_printf(",\"cycle\":{\"length\":%d,\"count\":%d}",
+        frame->cycle_len, frame->cycle_count);
+  }
+
+  if (frame->flags & GIMLI_FRAME_SIGNAL) {
+    cur = gimli_stack_frame_cursor(frame);
+    if (cur && cur->si.si_signo) {
+      gimli_render_siginfo(proc, &cur->si, namebuf, sizeof(namebuf));
+      gimli_out_printf(",\"signal\":{\"signo\":%d,\"desc\":",
+          cur->si.si_signo);
+      gimli_out_json_string(namebuf);
+      gimli_out_putc('}');
+    } else {
+      gimli_out_printf(",\"signal\":{}");
+    }
+    return 0;
+  }
+
+  if (!gimli_budget_allows(GIMLI_TIER_SYMBOLS)) {
+    gimli_out_printf(",\"symbol_omitted\":");
+    gimli_out_json_string(gimli_budget_reason());
+    return 0;
+  }
+
+  m = gimli_mapping_for_addr(proc, frame->pc);
+  if (m) {
+    gimli_out_printf(",\"object\":");
+    gimli_out_json_string(m->objfile->objname);
+    s = find_symbol_for_addr(m->objfile, frame->pc);
+    if (s) {
+      gimli_out_printf(",\"symbol\":");
+      gimli_out_json_string(s->name);
+      gimli_out_printf(",\"offset\":%" PRIu64,
+          (uint64_t)(frame->pc - s->addr));
+    }
+  }
+  if (!full) {
+    return 1;
+  }
+  if (gimli_determine_source_line_number(proc, frame->pc,
+        filebuf, sizeof(filebuf), &lineno)) {
+    gimli_out_printf(",\"file\":");
+    gimli_out_json_string(filebuf);
+    gimli_out_printf(",\"line\":%" PRIu64, lineno);
+  }
+
+  n = gimli_dwarf_get_die_chain_for_pc(proc, frame->pc,
+      chain, sizeof(chain)/sizeof(chain[0]));
+  if (n > 1 && m) {
+    gimli_out_printf(",\"inlined\":[");
+    for (i = 0; i < n - 1; i++) {
+      name = gimli_dwarf_die_name(m->objfile, chain[i]);
+      if (i) {
+        gimli_out_putc(',');
+      }
+      gimli_out_json_string(name);
+    }
+    gimli_out_putc(']');
+  }
+  return 1;
+}
+
+/* The JSON counterpart of gimli_render_stack(): the frames of a trace
+ * as the elements of an array, without their variables */
+void gimli_json_render_stack(int tid, gimli_stack_trace_t trace)
+{
+  gimli_stack_frame_t frame;
+
+  gimli_out_putc('[');
+  STAILQ_FOREACH(frame, &trace->frames, frames) {
+    if (frame != STAILQ_FIRST(&trace->frames)) {
+      gimli_out_putc(',');
+    }
+    gimli_out_putc('{');
+    json_frame_fields(trace->thr->proc, frame, 0);
+    gimli_out_putc('}');
+  }
+  gimli_out_putc(']');
+}
+
+/* The JSON counterpart of gimli_render_frame(): a frame record
+ * followed by a record for each of its variables */
+void gimli_json_render_frame(int tid, gimli_stack_frame_t frame)
+{
+  gimli_proc_t proc = frame->trace->thr->proc;
+  struct json_data data;
+
+  gimli_out_printf("{\"type\":\"frame\",\"thread\":%d,\"lwp\":%d,",
+      tid, frame->trace->thr->lwpid);
+  if (!json_frame_fields(proc, frame, 1)) {
+    gimli_out_printf("}\n");
+    return;
+  }
+  gimli_out_printf("}\n");
+
+  memset(&data, 0, sizeof(data));
+  data.proc = proc;
+  data.tid = tid;
+  if (!gimli_budget_allows(GIMLI_TIER_PARAMS)) {
+    gimli_output->omitted(tid, frame->depth, 0, "variables");
+    return;
+  }
+  gimli_stack_frame_visit_vars(frame, GIMLI_WANT_ALL, json_var, &data);
+  if (data.omitted) {
+    gimli_output->omitted(tid, frame->depth, data.omitted, "variables");
+  }
+}
+
+/* }}} */
+
 /* vim:ts=2:sw=2:et:
  */
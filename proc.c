@@ -25,11 +25,17 @@ void gimli_proc_delete(gimli_proc_t proc)
     free(thr);
   }
   gimli_hash_destroy(proc->files);
+  if (proc->perf_map) {
+    gimli_perf_map_destroy(proc->perf_map);
+  }
 
+  gimli_forget_mappings(proc);
   for (i = 0; i < proc->nmaps; i++) {
     free(proc->mappings[i]);
   }
   free(proc->mappings);
+  free(proc->map_index);
+  free(proc->regions);
 
   free(proc);
 }
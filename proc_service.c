@@ -152,6 +152,8 @@ static int enum_threads2(const td_thrhandle_t *thr, void *pp)
 #ifdef sun
   get_lwp_status(proc->pid, info.ti_lid, &th->lwpst);
 #endif
+  gimli_set_thread_stack(proc, th,
+      (gimli_addr_t)info.ti_stkbase, info.ti_stksize);
   th->valid = 1;
   return 0;
 }
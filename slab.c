@@ -59,6 +59,47 @@ void gimli_slab_destroy(struct gimli_slab *slab)
   slab->next_avail = 0;
 }
 
+/* Transfer ownership of the pages in src over to dest.
+ * The current (head) page of dest remains current so that
+ * subsequent allocations continue to fill it; the items
+ * that were allocated from src remain valid and are freed
+ * along with dest */
+void gimli_slab_merge(struct gimli_slab *dest, struct gimli_slab *src)
+{
+  struct gimli_slab_page *p, *head;
+
+  if (src->item_size != dest->item_size) {
+    fprintf(stderr, "slab_merge: %s and %s have differing item sizes\n",
+        dest->name, src->name);
+    abort();
+  }
+
+  head = LIST_FIRST(&dest->pages);
+  if (!head) {
+    /* dest adopts the src page list wholesale, including the
+     * fill position of its current page */
+    while ((p = LIST_FIRST(&src->pages)) != NULL) {
+      LIST_REMOVE(p, list);
+      if (head) {
+        LIST_INSERT_AFTER(head, p, list);
+      } else {
+        LIST_INSERT_HEAD(&dest->pages, p, list);
+      }
+      head = p;
+    }
+    dest->next_avail = src->next_avail;
+  } else {
+    while ((p = LIST_FIRST(&src->pages)) != NULL) {
+      LIST_REMOVE(p, list);
+      LIST_INSERT_AFTER(head, p, list);
+    }
+  }
+  dest->total_allocd += src->total_allocd;
+
+  src->total_allocd = 0;
+  src->next_avail = 0;
+}
+
 
 /* vim:ts=2:sw=2:et:
  */
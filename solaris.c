@@ -382,6 +382,7 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
     cur->st.sp = (void*)cur->st.regs[R_SP];
     /* registers are all good for dwarf */
     cur->dwarffail = 0;
+    cur->method = GIMLI_UNWIND_METHOD_SIGNAL;
     return 1;
   }
 
@@ -461,6 +462,7 @@ int gimli_unwind_next(struct gimli_unwind_cursor *cur)
        * with the non-dwarf aware way of detecting a signal frame */
       cur->st.pc = (void*)-1;
     }
+    cur->method = GIMLI_UNWIND_METHOD_FP;
     return 1;
   }
   return 0;
@@ -147,6 +147,9 @@ struct gimli_symbol *find_symbol_for_addr(gimli_mapped_object_t f,
   struct gimli_symbol *csym, *best, *last;
   int i, n, bu, cu;
 
+  if (f->perf_map) {
+    gimli_perf_map_refresh(f->perf_map);
+  }
   bake_symtab(f);
   if (!f->symcount) return NULL;
 
@@ -319,6 +322,96 @@ struct gimli_symbol *gimli_sym_lookup(gimli_proc_t proc, const char *obj, const
 }
 
 
+struct batch_item {
+  gimli_addr_t addr;
+  int idx;
+};
+
+static int sort_compare_batch_item(const void *A, const void *B)
+{
+  const struct batch_item *a = A, *b = B;
+
+  if (a->addr != b->addr) {
+    return a->addr < b->addr ? -1 : 1;
+  }
+  return a->idx - b->idx;
+}
+
+int gimli_symbolize_batch(gimli_proc_t proc, const gimli_addr_t *addrs,
+  int n, struct gimli_symbolized *results)
+{
+  struct batch_item *items;
+  struct gimli_object_mapping *m = NULL;
+  struct gimli_symbol *s = NULL;
+  struct gimli_line_hint hint;
+  struct gimli_source_location loc;
+  struct gimli_symbolized *r, *prev = NULL;
+  gimli_addr_t addr;
+  int i, sorted;
+
+  if (n <= 0) {
+    return 1;
+  }
+  items = malloc(n * sizeof(*items));
+  if (!items) {
+    return 0;
+  }
+  sorted = 1;
+  for (i = 0; i < n; i++) {
+    items[i].addr = addrs[i];
+    items[i].idx = i;
+    if (i && addrs[i] < addrs[i - 1]) {
+      sorted = 0;
+    }
+  }
+  /* samples that have already been merged are often in order */
+  if (!sorted) {
+    qsort(items, n, sizeof(*items), sort_compare_batch_item);
+  }
+  memset(&hint, 0, sizeof(hint));
+
+  /* walk them in address order; whatever we found for one address is
+   * likely to hold for the next, so check that before looking again */
+  for (i = 0; i < n; i++) {
+    addr = items[i].addr;
+    r = &results[items[i].idx];
+
+    if (prev && prev->addr == addr) {
+      *r = *prev;
+      continue;
+    }
+    memset(r, 0, sizeof(*r));
+    r->addr = addr;
+    prev = r;
+
+    if (!m || addr < m->base || addr >= m->base + m->len) {
+      m = gimli_mapping_for_addr(proc, addr);
+      s = NULL;
+    }
+    if (!m) {
+      continue;
+    }
+    r->objname = m->objfile->objname;
+
+    if (!s || addr < s->addr || addr >= s->addr + s->size) {
+      s = find_symbol_for_addr(m->objfile, addr);
+    }
+    if (s) {
+      r->symname = s->name;
+      r->offset = addr - s->addr;
+    }
+
+    if (gimli_source_location_near(proc, m, addr, &hint, &loc)) {
+      r->filename = loc.filename;
+      r->lineno = loc.lineno;
+    }
+  }
+
+  free(items);
+  return 1;
+}
+
+
 /* vim:ts=2:sw=2:et:
  */
 
@@ -7,12 +7,132 @@
 
 int debug = 0;
 int max_frames = 256;
+/* recursion is folded rather than stored, so we can afford to walk
+ * well beyond max_frames to find the outermost frames */
+int max_unwind_depth = 8192;
+/* use the compact unwind tables, where possible */
+int gimli_compact_unwind = 0;
+gimli_unwind_strategy_t gimli_unwind_strategy = GIMLI_UNWIND_AUTO;
+/* annotate rendered frames with the unwinder that produced them */
+int gimli_show_unwind_method = 0;
 gimli_proc_t the_proc = NULL;
 
+/* Saves the full unwind state for a frame.  It lives in the trace's
+ * slab, so it stays put until the trace is deleted */
+static struct gimli_unwind_cursor *save_cursor(gimli_stack_frame_t frame,
+  struct gimli_unwind_cursor *cur)
+{
+  gimli_stack_trace_t trace = frame->trace;
+
+  frame->cursor = gimli_slab_alloc(&trace->cursorslab);
+  if (frame->cursor) {
+    *frame->cursor = *cur;
+  }
+  return frame->cursor;
+}
+
+/* Recursion folding.
+ * Once the last few frames consist of a cycle of up to GIMLI_MAX_CYCLE
+ * pcs repeated GIMLI_MIN_CYCLE_REPEATS times, we keep only the first
+ * repetition and count the rest.  Shallow recursion is left alone, as
+ * its variables are usually of interest */
+#define GIMLI_MAX_CYCLE 8
+#define GIMLI_MIN_CYCLE_REPEATS 4
+#define GIMLI_CYCLE_HISTORY (GIMLI_MAX_CYCLE * GIMLI_MIN_CYCLE_REPEATS)
+
+struct fold_state {
+  /* ring of the most recently stored frames */
+  gimli_stack_frame_t recent[GIMLI_CYCLE_HISTORY];
+  int nrecent;
+  /* run[p] counts consecutive frames whose pc matches the frame p
+   * before it */
+  int run[GIMLI_MAX_CYCLE + 1];
+  /* while folding: the first frame of the cycle, its pcs and our
+   * position within the current repetition */
+  gimli_stack_frame_t base;
+  gimli_addr_t pcs[GIMLI_MAX_CYCLE];
+  int pos;
+  /* the frames of a repetition in progress; stored if it breaks off */
+  struct gimli_stack_frame pending[GIMLI_MAX_CYCLE];
+};
+
+static gimli_stack_frame_t add_frame(gimli_stack_trace_t trace,
+  gimli_stack_frame_t src)
+{
+  gimli_stack_frame_t frame = gimli_slab_alloc(&trace->frameslab);
+
+  *frame = *src;
+  STAILQ_INIT(&frame->vars);
+  frame->trace = trace;
+  frame->frameno = trace->num_frames++;
+  STAILQ_INSERT_TAIL(&trace->frames, frame, frames);
+  return frame;
+}
+
+static void fold_push(gimli_stack_trace_t trace, struct fold_state *f,
+  gimli_stack_frame_t frame)
+{
+  gimli_stack_frame_t prev, last;
+  int p, i, n;
+
+  f->recent[f->nrecent++ % GIMLI_CYCLE_HISTORY] = frame;
+  n = f->nrecent;
+
+  for (p = 1; p <= GIMLI_MAX_CYCLE; p++) {
+    if (n <= p) break;
+    prev = f->recent[(n - 1 - p) % GIMLI_CYCLE_HISTORY];
+    if (prev->pc == frame->pc &&
+        !(prev->flags & GIMLI_FRAME_SIGNAL) &&
+        !(frame->flags & GIMLI_FRAME_SIGNAL)) {
+      f->run[p]++;
+    } else {
+      f->run[p] = 0;
+    }
+  }
+
+  for (p = 1; p <= GIMLI_MAX_CYCLE; p++) {
+    if (f->run[p] < (GIMLI_MIN_CYCLE_REPEATS - 1) * p) continue;
+
+    /* keep the first repetition and drop the others; their records
+     * are released along with the rest of the slab */
+    f->base = f->recent[(n - GIMLI_MIN_CYCLE_REPEATS * p) %
+      GIMLI_CYCLE_HISTORY];
+    last = f->recent[(n - (GIMLI_MIN_CYCLE_REPEATS - 1) * p - 1) %
+      GIMLI_CYCLE_HISTORY];
+    for (i = 0; i < p; i++) {
+      f->pcs[i] = f->recent[(n - GIMLI_MIN_CYCLE_REPEATS * p + i) %
+        GIMLI_CYCLE_HISTORY]->pc;
+    }
+    STAILQ_NEXT(last, frames) = NULL;
+    trace->frames.stqh_last = &STAILQ_NEXT(last, frames);
+    trace->num_frames -= (GIMLI_MIN_CYCLE_REPEATS - 1) * p;
+
+    f->base->cycle_len = p;
+    f->base->cycle_count = GIMLI_MIN_CYCLE_REPEATS;
+    f->pos = 0;
+    return;
+  }
+}
+
+/* the cycle has ended; store any partial repetition and start
+ * looking afresh */
+static void fold_end(gimli_stack_trace_t trace, struct fold_state *f,
+  int max_frames)
+{
+  int i;
+
+  for (i = 0; i < f->pos && trace->num_frames < max_frames; i++) {
+    add_frame(trace, &f->pending[i]);
+  }
+  memset(f, 0, sizeof(*f));
+}
+
 gimli_stack_trace_t gimli_thread_stack_trace(gimli_thread_t thr, int max_frames)
 {
   gimli_stack_trace_t trace = calloc(1, sizeof(*trace));
   struct gimli_unwind_cursor cur;
+  struct gimli_stack_frame rec;
+  struct fold_state fold;
   gimli_stack_frame_t frame;
   struct {
     const char *name;
@@ -34,15 +154,22 @@ gimli_stack_trace_t gimli_thread_stack_trace(gimli_thread_t thr, int max_frames)
   };
   int i;
   int stop;
+  int depth = 0;
 
   if (!trace) return NULL;
 
   trace->refcnt = 1;
   trace->thr = thr;
   STAILQ_INIT(&trace->frames);
+  gimli_slab_init(&trace->frameslab, sizeof(*frame), "frame");
+  gimli_slab_init(&trace->cursorslab, sizeof(cur), "cursor");
+  memset(&fold, 0, sizeof(fold));
 
   memset(&cur, 0, sizeof(cur));
   cur.proc = thr->proc;
+  cur.strategy = gimli_unwind_strategy;
+  cur.method = GIMLI_UNWIND_METHOD_REGS;
+  gimli_thread_stack_range(thr, &cur.stack_lo, &cur.stack_hi);
 
   if (!gimli_init_unwind(&cur, thr)) {
     free(trace);
@@ -73,14 +200,43 @@ gimli_stack_trace_t gimli_thread_stack_trace(gimli_thread_t thr, int max_frames)
       break;
     }
 
-    frame = calloc(1, sizeof(*frame));
-
-    STAILQ_INIT(&frame->vars);
-    cur.frameno = trace->num_frames++;
+    cur.frameno = depth++;
     cur.tid = thr->lwpid;
 
-    frame->cur = cur;
-    STAILQ_INSERT_TAIL(&trace->frames, frame, frames);
+    memset(&rec, 0, sizeof(rec));
+    rec.pc = (gimli_addr_t)cur.st.pc;
+    rec.cfa = (gimli_addr_t)cur.st.fp;
+    rec.sp = (gimli_addr_t)cur.st.sp;
+    rec.depth = cur.frameno;
+    rec.method = cur.method;
+    if (gimli_is_signal_frame(&cur)) {
+      rec.flags |= GIMLI_FRAME_SIGNAL;
+    }
+
+    if (fold.base) {
+      if (!(rec.flags & GIMLI_FRAME_SIGNAL) &&
+          rec.pc == fold.pcs[fold.pos]) {
+        /* another lap around the cycle */
+        fold.pending[fold.pos++] = rec;
+        if (fold.pos == fold.base->cycle_len) {
+          fold.base->cycle_count++;
+          fold.pos = 0;
+        }
+        continue;
+      }
+      fold_end(trace, &fold, max_frames);
+      if (trace->num_frames >= max_frames) {
+        break;
+      }
+    }
+
+    frame = add_frame(trace, &rec);
+    /* the innermost frame is where any replay starts from, and
+     * signal frames need their siginfo when they are rendered */
+    if ((frame->flags & GIMLI_FRAME_SIGNAL) || frame->depth == 0) {
+      save_cursor(frame, &cur);
+    }
+    fold_push(trace, &fold, frame);
 
     for (i = 0; i < sizeof(stopsyms)/sizeof(stopsyms[0]); i++) {
       if (stopsyms[i].before || !stopsyms[i].sym) continue;
@@ -94,9 +250,16 @@ gimli_stack_trace_t gimli_thread_stack_trace(gimli_thread_t thr, int max_frames)
       break;
     }
 
-  } while (trace->num_frames < max_frames &&
+  } while (trace->num_frames < max_frames && depth < max_unwind_depth &&
       cur.st.pc && gimli_unwind_next(&cur) && cur.st.pc);
 
+  if (fold.base) {
+    fold_end(trace, &fold, max_frames);
+  }
+  /* did we run into one of the limits before the end of the stack? */
+  trace->truncated = !stop && cur.st.pc &&
+    (trace->num_frames >= max_frames || depth >= max_unwind_depth);
+
   return trace;
 }
 
@@ -129,12 +292,57 @@ void gimli_stack_trace_delete(gimli_stack_trace_t trace)
       // FIXME: release type?
       free(var);
     }
-    free(frame);
   }
+  gimli_slab_destroy(&trace->frameslab);
+  gimli_slab_destroy(&trace->cursorslab);
 
   free(trace);
 }
 
+/* Returns the full unwind state for a frame.  If we didn't keep it
+ * while tracing, it is recomputed by replaying the unwind from the
+ * nearest frame that we did keep, stepping through any folded frames
+ * in between; the target is stopped, so this arrives at the same
+ * place as it did the first time around */
+struct gimli_unwind_cursor *gimli_stack_frame_cursor(gimli_stack_frame_t frame)
+{
+  gimli_stack_trace_t trace = frame->trace;
+  gimli_stack_frame_t f, from = NULL;
+  struct gimli_unwind_cursor cur;
+
+  if (frame->cursor) {
+    return frame->cursor;
+  }
+
+  STAILQ_FOREACH(f, &trace->frames, frames) {
+    if (f == frame) {
+      break;
+    }
+    if (f->cursor) {
+      from = f;
+    }
+  }
+  if (!from) {
+    return NULL;
+  }
+
+  cur = *from->cursor;
+  while (cur.frameno < frame->depth) {
+    if (!gimli_unwind_next(&cur)) {
+      break;
+    }
+    cur.frameno++;
+  }
+  if (cur.frameno != frame->depth || (gimli_addr_t)cur.st.pc != frame->pc) {
+    if (debug) {
+      fprintf(stderr, "replay of frame %d diverged at depth %d\n",
+          frame->frameno, cur.frameno);
+    }
+    return NULL;
+  }
+  return save_cursor(frame, &cur);
+}
+
 gimli_iter_status_t gimli_stack_trace_visit(
     gimli_stack_trace_t trace,
     gimli_stack_trace_visit_f func,
@@ -296,12 +504,112 @@ int gimli_render_siginfo(gimli_proc_t proc, siginfo_t *si, char *buf, size_t buf
 
 gimli_addr_t gimli_stack_frame_pcaddr(gimli_stack_frame_t frame)
 {
-  return (gimli_addr_t)frame->cur.st.pc;
+  return frame->pc;
 }
 
 int gimli_stack_frame_number(gimli_stack_frame_t frame)
 {
-  return frame->cur.frameno;
+  return frame->frameno;
+}
+
+int gimli_stack_frame_depth(gimli_stack_frame_t frame)
+{
+  return frame->depth;
+}
+
+int gimli_stack_frame_cycle(gimli_stack_frame_t frame,
+  int *len, int *count)
+{
+  if (!frame->cycle_len) {
+    return 0;
+  }
+  *len = frame->cycle_len;
+  *count = frame->cycle_count;
+  return 1;
+}
+
+void gimli_set_unwind_strategy(gimli_unwind_strategy_t strategy)
+{
+  gimli_unwind_strategy = strategy;
+}
+
+gimli_unwind_method_t gimli_stack_frame_unwind_method(
+    gimli_stack_frame_t frame)
+{
+  return frame->method;
+}
+
+const char *gimli_unwind_method_name(gimli_unwind_method_t method)
+{
+  switch (method) {
+    case GIMLI_UNWIND_METHOD_REGS:    return "regs";
+    case GIMLI_UNWIND_METHOD_DWARF:   return "dwarf";
+    case GIMLI_UNWIND_METHOD_COMPACT: return "compact";
+    case GIMLI_UNWIND_METHOD_FP:      return "fp";
+    case GIMLI_UNWIND_METHOD_SIGNAL:  return "signal";
+  }
+  return "?";
+}
+
+/* Decides whether a frame pointer link read from the stack at fp is
+ * plausible enough to follow when we have nothing better to go on.
+ * The stack grows down, so the caller's frame must be above ours and
+ * suitably aligned; a NULL link marks the outermost frame.  Either way,
+ * the return address must land in executable code that we know about.
+ * The fallback path used in AUTO mode is deliberately looser than this,
+ * as it has historically coped with alternate signal stacks */
+int gimli_fp_frame_is_sane(gimli_proc_t proc, void *fp,
+  void *next_fp, void *retpc)
+{
+  if (next_fp) {
+    if ((uintptr_t)next_fp <= (uintptr_t)fp) {
+      return 0;
+    }
+    if ((uintptr_t)next_fp & (sizeof(void*) - 1)) {
+      return 0;
+    }
+  }
+  if (!gimli_mapping_for_addr(proc, (gimli_addr_t)retpc)) {
+    return 0;
+  }
+  /* a mapping may also be an object's data; a stale stack word pointing
+   * there is no return address.  Only some platforms record regions */
+  if (proc->nregions) {
+    struct gimli_vm_region *r;
+
+    r = gimli_region_for_addr(proc, (gimli_addr_t)retpc);
+    if (!r || !(r->prot & PROT_EXEC)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Returns 0 if the cfa cannot belong to the stack that the cursor is
+ * walking; a corrupt stack is then abandoned right away rather than
+ * chased for max_frames.  When the bounds aren't known, anything goes */
+int gimli_unwind_cfa_in_stack(struct gimli_unwind_cursor *cur, void *cfa)
+{
+  if (!cur->stack_hi) {
+    return 1;
+  }
+  /* the outermost CFA may sit right at the top */
+  return (gimli_addr_t)cfa >= cur->stack_lo &&
+    (gimli_addr_t)cfa <= cur->stack_hi;
+}
+
+int gimli_thread_stack_range(gimli_thread_t thr,
+  gimli_addr_t *lo, gimli_addr_t *hi)
+{
+  if (!thr->stack_hi && thr->sp) {
+    gimli_set_thread_stack(thr->proc, thr, 0, 0);
+  }
+  if (!thr->stack_hi) {
+    return 0;
+  }
+  *lo = thr->stack_lo;
+  *hi = thr->stack_hi;
+  return 1;
 }
 
 gimli_iter_status_t gimli_stack_frame_visit_vars(